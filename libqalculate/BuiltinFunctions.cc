@@ -17,11 +17,14 @@
 #include "Number.h"
 #include "Calculator.h"
 #include "Variable.h"
+#include "DataSet.h"
+#include "EvaluationPlan.h"
 
 #include <sstream>
 #include <glib.h>
 #include <time.h>
 #include <limits>
+#include <map>
 
 #define FR_FUNCTION(FUNC)	Number nr(vargs[0].number()); if(!nr.FUNC() || (eo.approximation == APPROXIMATION_EXACT && nr.isApproximate()) || (!eo.allow_complex && nr.isComplex() && !vargs[0].number().isComplex()) || (!eo.allow_infinite && nr.isInfinite() && !vargs[0].number().isInfinite())) {return 0;} else {mstruct.set(nr); return 1;}
 #define FR_FUNCTION_2(FUNC)	Number nr(vargs[0].number()); if(!nr.FUNC(vargs[1].number()) || (eo.approximation == APPROXIMATION_EXACT && nr.isApproximate()) || (!eo.allow_complex && nr.isComplex() && !vargs[0].number().isComplex() && !vargs[1].number().isComplex()) || (!eo.allow_infinite && nr.isInfinite() && !vargs[0].number().isInfinite() && !vargs[1].number().isInfinite())) {return 0;} else {mstruct.set(nr); return 1;}
@@ -2180,10 +2183,14 @@ int ModeFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 	bool b;
 	vector<const MathStructure*> vargs_nodup;
 	vector<size_t> is;
+	// unique values with the same structural hash, in order of appearance
+	map<size_t, vector<size_t> > hash_indices;
 	const MathStructure *value = NULL;
 	for(size_t index_c = 0; index_c < vargs[0].size(); index_c++) {
 		b = true;
-		for(size_t index = 0; index < vargs_nodup.size(); index++) {
+		vector<size_t> &indices = hash_indices[vargs[0][index_c].structuralHash()];
+		for(size_t i = 0; i < indices.size(); i++) {
+			size_t index = indices[i];
 			if(vargs_nodup[index]->equals(vargs[0][index_c])) {
 				is[index]++;
 				b = false;
@@ -2191,6 +2198,7 @@ int ModeFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 			}
 		}
 		if(b) {
+			indices.push_back(vargs_nodup.size());
 			vargs_nodup.push_back(&vargs[0][index_c]);
 			is.push_back(1);
 		}
@@ -2643,13 +2651,35 @@ ForFunction::ForFunction() : MathFunction("for", 7) {
 }
 int ForFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions &eo) {
 
+	if(vargs[0].isNumber() && vargs[4].isNumber()) {
+		EvaluationPlan plan_test, plan_count, plan_update;
+		vector<MathStructure> update_vars;
+		update_vars.push_back(vargs[1]);
+		update_vars.push_back(vargs[6]);
+		if(plan_test.compile(vargs[2], vargs[1], eo) && plan_count.compile(vargs[3], vargs[1], eo) && plan_update.compile(vargs[5], update_vars, eo)) {
+			Number nr_counter(vargs[0].number()), nr_value(vargs[4].number()), nr_test;
+			bool b = true;
+			while(true) {
+				if(CALCULATOR->aborted(ABORT_LOCATION_SUM)) return 0;
+				if(!plan_test.run(nr_counter, nr_test)) {b = false; break;}
+				if(!nr_test.getBoolean()) break;
+				if(!plan_update.run(nr_counter, nr_value, nr_value) || !plan_count.run(nr_counter, nr_counter)) {b = false; break;}
+			}
+			if(b) {
+				mstruct = nr_value;
+				return 1;
+			}
+		}
+	}
+
 	mstruct = vargs[4];
 	MathStructure mcounter = vargs[0];
 	MathStructure mtest;
 	MathStructure mcount;
 	MathStructure mupdate;
 	while(true) {
-		mtest = vargs[3];
+		if(CALCULATOR->aborted(ABORT_LOCATION_SUM)) return 0;
+		mtest = vargs[2];
 		mtest.replace(vargs[1], mcounter);
 		mtest.eval(eo);
 		if(!mtest.isNumber()) return 0;
@@ -2675,13 +2705,33 @@ SumFunction::SumFunction() : MathFunction("sum", 3, 4) {
 	setDefaultValue(4, "x");
 	setCondition("\\z >= \\y");
 }
-int SumFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions&) {
+int SumFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions &eo) {
+
+	EvaluationPlan plan;
+	if(plan.compile(vargs[0], vargs[3], eo)) {
+		Number i_nr(vargs[1].number()), nr_term;
+		Number nr_calc;
+		bool b = true;
+		while(i_nr.isLessThanOrEqualTo(vargs[2].number())) {
+			if(CALCULATOR->aborted(ABORT_LOCATION_SUM)) return 0;
+			if(!plan.run(i_nr, nr_term) || !nr_calc.add(nr_term)) {
+				b = false;
+				break;
+			}
+			i_nr += 1;
+		}
+		if(b) {
+			mstruct = nr_calc;
+			return 1;
+		}
+	}
 
 	mstruct.clear();
 	Number i_nr(vargs[1].number());
 	MathStructure mstruct_calc;
 	bool started = false, s2 = false;
 	while(i_nr.isLessThanOrEqualTo(vargs[2].number())) {	
+		if(CALCULATOR->aborted(ABORT_LOCATION_SUM)) return 0;
 		mstruct_calc.set(vargs[0]);
 		mstruct_calc.replace(vargs[3], i_nr);
 		if(started) {
@@ -2703,13 +2753,33 @@ ProductFunction::ProductFunction() : MathFunction("product", 3, 4) {
 	setDefaultValue(4, "x");
 	setCondition("\\z >= \\y");
 }
-int ProductFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions&) {
+int ProductFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions &eo) {
+
+	EvaluationPlan plan;
+	if(plan.compile(vargs[0], vargs[3], eo)) {
+		Number i_nr(vargs[1].number()), nr_term;
+		Number nr_calc(1, 1);
+		bool b = true;
+		while(i_nr.isLessThanOrEqualTo(vargs[2].number())) {
+			if(CALCULATOR->aborted(ABORT_LOCATION_SUM)) return 0;
+			if(!plan.run(i_nr, nr_term) || !nr_calc.multiply(nr_term)) {
+				b = false;
+				break;
+			}
+			i_nr += 1;
+		}
+		if(b) {
+			mstruct = nr_calc;
+			return 1;
+		}
+	}
 
 	mstruct.clear();
 	Number i_nr(vargs[1].number());
 	MathStructure mstruct_calc;
 	bool started = false, s2 = false;
 	while(i_nr.isLessThanOrEqualTo(vargs[2].number())) {	
+		if(CALCULATOR->aborted(ABORT_LOCATION_SUM)) return 0;
 		mstruct_calc.set(vargs[0]);
 		mstruct_calc.replace(vargs[3], i_nr);
 		if(started) {
@@ -2965,6 +3035,76 @@ int SelectFunction::calculate(MathStructure &mstruct, const MathStructure &vargs
 	}
 	return 1;
 }
+DataSet *get_data_set_argument(const MathStructure &arg) {
+	DataSet *ds = CALCULATOR->getDataSet(arg.symbol());
+	if(!ds) CALCULATOR->error(true, _("Data set %s not found."), arg.symbol().c_str(), NULL);
+	return ds;
+}
+DataProperty *get_data_property_argument(DataSet *ds, const MathStructure &arg) {
+	DataProperty *dp = ds->getProperty(arg.symbol());
+	if(!dp) CALCULATOR->error(true, _("Property %s not available in data set."), arg.symbol().c_str(), NULL);
+	return dp;
+}
+DataColumnFunction::DataColumnFunction() : MathFunction("datacolumn", 2) {
+	setArgumentDefinition(1, new TextArgument());
+	setArgumentDefinition(2, new TextArgument());
+}
+int DataColumnFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions&) {
+	DataSet *ds = get_data_set_argument(vargs[0]);
+	if(!ds) return 0;
+	DataProperty *dp = get_data_property_argument(ds, vargs[1]);
+	if(!dp) return 0;
+	mstruct.clearVector();
+	// values are read directly from the objects, in one pass, without lookup of each object
+	DataObjectIter it;
+	DataObject *o = ds->getFirstObject(&it);
+	while(o) {
+		const MathStructure *pmstruct = o->getPropertyStruct(dp);
+		if(pmstruct) mstruct.addChild(*pmstruct);
+		o = ds->getNextObject(&it);
+	}
+	return 1;
+}
+DataSelectFunction::DataSelectFunction() : MathFunction("dataselect", 3, 5) {
+	setArgumentDefinition(1, new TextArgument());
+	setArgumentDefinition(2, new TextArgument());
+	setArgumentDefinition(4, new TextArgument());
+	setDefaultValue(4, "\"\"");
+	setArgumentDefinition(5, new SymbolicArgument());
+	setDefaultValue(5, "x");
+}
+int DataSelectFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions &eo) {
+	DataSet *ds = get_data_set_argument(vargs[0]);
+	if(!ds) return 0;
+	DataProperty *dp = get_data_property_argument(ds, vargs[1]);
+	if(!dp) return 0;
+	// the primary key (e.g. the symbol of an element) is returned by default
+	DataProperty *dp_result = NULL;
+	if(vargs[3].symbol().empty()) dp_result = ds->getPrimaryKeyProperty();
+	else dp_result = get_data_property_argument(ds, vargs[3]);
+	if(!dp_result) return 0;
+	MathStructure mtest;
+	mstruct.clearVector();
+	DataObjectIter it;
+	DataObject *o = ds->getFirstObject(&it);
+	while(o) {
+		const MathStructure *pmstruct = o->getPropertyStruct(dp);
+		const MathStructure *pmresult = (pmstruct ? o->getPropertyStruct(dp_result) : NULL);
+		if(pmresult) {
+			mtest = vargs[2];
+			mtest.replace(vargs[4], *pmstruct);
+			mtest.eval(eo);
+			if(!mtest.isNumber() || mtest.number().getBoolean() < 0) {
+				CALCULATOR->error(true, _("Comparison failed."), NULL);
+				return -1;
+			}
+			if(mtest.number().getBoolean() > 0) mstruct.addChild(*pmresult);
+		}
+		if(CALCULATOR->aborted()) return 0;
+		o = ds->getNextObject(&it);
+	}
+	return 1;
+}
 IFFunction::IFFunction() : MathFunction("if", 3) {
 	NON_COMPLEX_NUMBER_ARGUMENT(1)
 }
@@ -3019,18 +3159,34 @@ int LoadFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 	}
 	return 1;
 }
-ExportFunction::ExportFunction() : MathFunction("export", 2, 3) {
+ExportFunction::ExportFunction() : MathFunction("export", 2, 4) {
 	setArgumentDefinition(1, new VectorArgument());
 	setArgumentDefinition(2, new FileArgument());
 	setArgumentDefinition(3, new TextArgument());
 	setDefaultValue(3, ",");	
+	setArgumentDefinition(4, new TextArgument());
+	setDefaultValue(4, "\"\"");
 }
 int ExportFunction::calculate(MathStructure&, const MathStructure &vargs, const EvaluationOptions&) {
 	string delim = vargs[2].symbol();
 	if(delim == "tab") {
 		delim = "\t";
 	}
-	if(!CALCULATOR->exportCSV(vargs[0], vargs[1].symbol().c_str(), delim)) {
+	// number format: "exact" for exact fractions, a number of significant digits for decimals, or empty
+	CSVNumberFormat number_format = CSV_NUMBER_FORMAT_DEFAULT;
+	int precision = 0;
+	string format_str = vargs[3].symbol();
+	remove_blank_ends(format_str);
+	if(format_str == "exact") {
+		number_format = CSV_NUMBER_FORMAT_EXACT;
+	} else if(!format_str.empty() && format_str.find_first_not_of(NUMBERS) == string::npos && s2i(format_str) > 0) {
+		number_format = CSV_NUMBER_FORMAT_DECIMAL;
+		precision = s2i(format_str);
+	} else if(!format_str.empty()) {
+		CALCULATOR->error(true, _("Unrecognized number format: %s. Use \"exact\" or a number of significant digits."), format_str.c_str(), NULL);
+		return 0;
+	}
+	if(!CALCULATOR->exportCSV(vargs[0], vargs[1].symbol().c_str(), delim, number_format, precision)) {
 		CALCULATOR->error(true, "Failed to export to %s.", vargs[1].symbol().c_str(), NULL);
 		return 0;
 	}
@@ -234,6 +234,8 @@ DECLARE_BUILTIN_FUNCTION(ProcessMatrixFunction)
 DECLARE_BUILTIN_FUNCTION(CustomSumFunction)
 DECLARE_BUILTIN_FUNCTION(FunctionFunction)
 DECLARE_BUILTIN_FUNCTION(SelectFunction)
+DECLARE_BUILTIN_FUNCTION(DataColumnFunction)
+DECLARE_BUILTIN_FUNCTION(DataSelectFunction)
 DECLARE_BUILTIN_FUNCTION(TitleFunction)
 DECLARE_BUILTIN_FUNCTION(IFFunction)
 DECLARE_BUILTIN_FUNCTION(IsNumberFunction)
@@ -33,7 +33,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#ifndef _WIN32
+#	include <sys/mman.h>
+#	include <fcntl.h>
+#endif
+#include <float.h>
+#include <cmath>
 #include <queue>
+#include <list>
+#include <map>
+#include <algorithm>
 #include <glib.h>
 #include <glib/gstdio.h>
 //#include <dlfcn.h>
@@ -157,12 +166,14 @@ int CalculatorMessage::category() const {
 }
 
 void Calculator::addStringAlternative(string replacement, string standard) {
+	parseDefinitionsChanged();
 	signs.push_back(replacement);
 	real_signs.push_back(standard);
 }
 bool Calculator::delStringAlternative(string replacement, string standard) {
 	for(size_t i = 0; i < signs.size(); i++) {
 		if(signs[i] == replacement && real_signs[i] == standard) {
+			parseDefinitionsChanged();
 			signs.erase(signs.begin() + i);
 			real_signs.erase(real_signs.begin() + i);
 			return true;
@@ -171,12 +182,14 @@ bool Calculator::delStringAlternative(string replacement, string standard) {
 	return false;
 }
 void Calculator::addDefaultStringAlternative(string replacement, string standard) {
+	parseDefinitionsChanged();
 	default_signs.push_back(replacement);
 	default_real_signs.push_back(standard);
 }
 bool Calculator::delDefaultStringAlternative(string replacement, string standard) {
 	for(size_t i = 0; i < default_signs.size(); i++) {
 		if(default_signs[i] == replacement && default_real_signs[i] == standard) {
+			parseDefinitionsChanged();
 			default_signs.erase(default_signs.begin() + i);
 			default_real_signs.erase(default_real_signs.begin() + i);
 			return true;
@@ -205,6 +218,79 @@ protected:
 	virtual void run();
 };
 
+/*
+	Asynchronous calculations are queued as jobs and performed in order by the calculation thread.
+	The job queue and the state of all jobs are protected by calculation_job_mutex. calculation_job_cond is signalled when a job is queued or finished.
+*/
+static GMutex calculation_job_mutex;
+static GCond calculation_job_cond;
+
+// time (in milliseconds) that an aborted calculation is given to reach a safe point before the calculation thread is cancelled
+#define ABORT_GRACE_PERIOD 1000
+
+static volatile gint abort_location_counts[ABORT_LOCATION_FORCED + 1];
+
+class CalculationJob_p {
+	public:
+		bool b_parse;
+		string expression;
+		MathStructure *mstruct, *parsed_struct, *to_struct;
+		bool make_to_division;
+		EvaluationOptions eo;
+		int proc_command;
+		size_t rpn_index;
+		CalculationContext *context;
+		bool b_finished, b_aborted;
+		int i_ref;
+};
+
+CalculationJob::CalculationJob() {
+	priv = new CalculationJob_p;
+	priv->b_parse = false;
+	priv->mstruct = NULL;
+	priv->parsed_struct = NULL;
+	priv->to_struct = NULL;
+	priv->make_to_division = true;
+	priv->proc_command = PROC_NO_COMMAND;
+	priv->rpn_index = 0;
+	priv->context = NULL;
+	priv->b_finished = false;
+	priv->b_aborted = false;
+	priv->i_ref = 1;
+}
+CalculationJob::~CalculationJob() {
+	delete priv;
+}
+bool CalculationJob::wait(int msecs) {
+	gint64 end_time = g_get_monotonic_time() + (gint64) msecs * 1000;
+	g_mutex_lock(&calculation_job_mutex);
+	while(!priv->b_finished) {
+		if(msecs < 0) g_cond_wait(&calculation_job_cond, &calculation_job_mutex);
+		else if(!g_cond_wait_until(&calculation_job_cond, &calculation_job_mutex, end_time)) break;
+	}
+	bool b = priv->b_finished;
+	g_mutex_unlock(&calculation_job_mutex);
+	return b;
+}
+bool CalculationJob::isFinished() const {
+	g_mutex_lock(&calculation_job_mutex);
+	bool b = priv->b_finished;
+	g_mutex_unlock(&calculation_job_mutex);
+	return b;
+}
+bool CalculationJob::isAborted() const {
+	g_mutex_lock(&calculation_job_mutex);
+	bool b = priv->b_aborted;
+	g_mutex_unlock(&calculation_job_mutex);
+	return b;
+}
+void CalculationJob::ref() {
+	g_atomic_int_inc(&priv->i_ref);
+}
+void CalculationJob::unref() {
+	if(g_atomic_int_dec_and_test(&priv->i_ref)) delete this;
+}
+
 
 void autoConvert(const MathStructure &morig, MathStructure &mconv, const EvaluationOptions &eo) {
 	switch(eo.auto_post_conversion) {
@@ -218,30 +304,154 @@ void autoConvert(const MathStructure &morig, MathStructure &mconv, const Evaluat
 	}
 }
 
+struct UFVEntry {
+	void *object;
+	size_t index, length, seq;
+	int type;
+};
+bool ufv_entry_before(const UFVEntry &e1, const UFVEntry &e2) {
+	return e1.seq < e2.seq;
+}
+struct UFVNode {
+	vector<pair<char, size_t> > children;
+	vector<UFVEntry> entries;
+};
+/// Names matching the text at a position, in the same buckets (type and length) and order as names were added
+struct UFVMatches {
+	vector<UFVEntry> v[4][UFV_LENGTHS];
+};
+
+struct ParseCacheEntry {
+	string key;
+	MathStructure *mstruct;
+	size_t generation;
+};
+
+struct ProfileStage {
+	size_t calls;
+	gint64 usecs, start;
+	int depth;
+	string name;
+	ProfileStage() : calls(0), usecs(0), start(0), depth(0) {}
+};
+
+struct ContextValue {
+	size_t version;
+	MathStructure *mstruct;
+};
+
+class CalculationContext_p {
+	public:
+		// copies of values of variables, by variable and precision (see Calculator::setContextValue())
+		map<pair<KnownVariable*, int>, ContextValue> variable_values;
+		vector<CalculatorMessage> messages;
+		int precision;
+		int disable_errors_ref;
+		vector<int> stopped_errors_count;
+		vector<int> stopped_warnings_count;
+		vector<int> stopped_messages_count;
+		int current_stage;
+		unordered_map<size_t, MathStructure*> id_structs;
+		unordered_map<size_t, bool> ids_p;
+		vector<size_t> freed_ids;
+		size_t ids_i;
+		size_t parse_depth, message_count;
+		bool hardware_float;
+		bool b_controlled, abort_recorded;
+		int i_timeout, i_aborted;
+		struct timeval t_end;
+		vector<ProfileStage> profile_stages;
+		map<MathFunction*, ProfileStage> profile_functions;
+};
+
+class Calculator_p {
+	public:
+		CalculationContext *default_context;
+		CalculationContext_p *context() const;
+		MathStructure *idStruct(size_t id) const;
+		size_t parse_generation;
+		size_t parse_cache_size;
+		GMutex parse_cache_mutex;
+		list<ParseCacheEntry> parse_cache;
+		map<string, list<ParseCacheEntry>::iterator> parse_cache_index;
+		vector<UFVNode> ufv_nodes;
+		map<void*, vector<size_t> > ufv_object_nodes;
+		size_t ufv_seq;
+		void addUFV(void *object, int type, size_t index, const string &name, bool case_sensitive);
+		void removeUFV(void *object);
+		void findUFV(const string &str, size_t str_index, size_t max_length, UFVMatches &matches, int type = -1) const;
+		unordered_map<size_t, vector<ExpressionItem*> > name_index;
+		map<ExpressionItem*, vector<size_t> > name_index_keys;
+		void addToNameIndex(ExpressionItem *item);
+		void removeContextValues(KnownVariable *v);
+		void removeFromNameIndex(ExpressionItem *item);
+		ExpressionItem *findName(const Calculator *calc, const string &name, int type, int active = -1, int composite = -1, const ExpressionItem *exclude = NULL) const;
+		deque<CalculationJob*> job_queue;
+		CalculationJob *current_job, *last_job;
+		void finishAbortedJob(CalculationJob *job);
+		void requestAbort(CalculationContext *context);
+		void resetAbortedContext(CalculationContext_p *ctx);
+		bool profiling;
+		void beginProfileStage(EvaluationStage stage, MathFunction *f);
+		void endProfileStage(EvaluationStage stage, MathFunction *f);
+		bool definitions_cache;
+		bool lazy_definitions;
+		string deferred_locale, deferred_localebase;
+		int deferred_fulfilled_translation;
+};
+
 void CalculateThread::run() {
 	while(true) {
-		bool b_parse = read<bool>();
-		void *x = read<void *>();
-		MathStructure *mstruct = (MathStructure*) x;
-		if(b_parse) {
+		g_mutex_lock(&calculation_job_mutex);
+		while(CALCULATOR->priv->job_queue.empty()) {
+			g_cond_wait(&calculation_job_cond, &calculation_job_mutex);
+		}
+		CalculationJob *job = CALCULATOR->priv->job_queue.front();
+		CALCULATOR->priv->job_queue.pop_front();
+		CALCULATOR->priv->current_job = job;
+		CalculationJob_p *j = job->priv;
+		MathStructure *mstruct = j->mstruct;
+		CALCULATOR->setCalculationContext(j->context);
+		// abortJob() requests an abort with calculation_job_mutex locked, so that it cannot be lost here
+		CALCULATOR->startControl();
+		g_mutex_unlock(&calculation_job_mutex);
+		if(j->b_parse) {
 			mstruct->setAborted();
-			if(CALCULATOR->tmp_parsedstruct) CALCULATOR->tmp_parsedstruct->setAborted();
-			//if(CALCULATOR->tmp_tostruct) CALCULATOR->tmp_tostruct->setUndefined();
-			mstruct->set(CALCULATOR->calculate(CALCULATOR->expression_to_calculate, CALCULATOR->tmp_evaluationoptions, CALCULATOR->tmp_parsedstruct, CALCULATOR->tmp_tostruct, CALCULATOR->tmp_maketodivision));
+			if(j->parsed_struct) j->parsed_struct->setAborted();
+			//if(j->to_struct) j->to_struct->setUndefined();
+			mstruct->set(CALCULATOR->calculate(j->expression, j->eo, j->parsed_struct, j->to_struct, j->make_to_division));
 		} else {
 			MathStructure meval(*mstruct);
 			mstruct->setAborted();
-			meval.eval(CALCULATOR->tmp_evaluationoptions);
-			if(CALCULATOR->tmp_evaluationoptions.auto_post_conversion == POST_CONVERSION_NONE) mstruct->set(meval);
-			else autoConvert(meval, *mstruct, CALCULATOR->tmp_evaluationoptions);
-		}
-		switch(CALCULATOR->tmp_proc_command) {
+			meval.eval(j->eo);
+			if(j->eo.auto_post_conversion == POST_CONVERSION_NONE) mstruct->set(meval);
+			else autoConvert(meval, *mstruct, j->eo);
+		}
+		g_mutex_lock(&calculation_job_mutex);
+		CalculationContext_p *ctx = CALCULATOR->priv->context();
+		bool b_aborted = g_atomic_int_get(&ctx->i_aborted) > 0;
+		CALCULATOR->stopControl();
+		g_mutex_unlock(&calculation_job_mutex);
+		if(b_aborted) {
+			// the calculation has stopped at a safe point; discard the result and any changes made during the calculation
+			if(j->proc_command == PROC_NO_COMMAND) mstruct->setAborted();
+			CALCULATOR->restoreState();
+			CALCULATOR->priv->resetAbortedContext(ctx);
+			CALCULATOR->clearBuffers();
+			g_mutex_lock(&calculation_job_mutex);
+			CALCULATOR->priv->current_job = NULL;
+			CALCULATOR->priv->finishAbortedJob(job);
+			g_mutex_unlock(&calculation_job_mutex);
+			job->unref();
+			continue;
+		}
+		switch(j->proc_command) {
 			case PROC_RPN_ADD: {
 				CALCULATOR->RPNStackEnter(mstruct, false);
 				break;
 			}
 			case PROC_RPN_SET: {
-				CALCULATOR->setRPNRegister(CALCULATOR->tmp_rpnindex, mstruct, false);
+				CALCULATOR->setRPNRegister(j->rpn_index, mstruct, false);
 				break;
 			}
 			case PROC_RPN_OPERATION_1: {
@@ -265,17 +475,231 @@ void CalculateThread::run() {
 			}
 			case PROC_NO_COMMAND: {}
 		}
-		CALCULATOR->b_busy = false;
+		g_mutex_lock(&calculation_job_mutex);
+		j->b_finished = true;
+		CALCULATOR->priv->current_job = NULL;
+		g_cond_broadcast(&calculation_job_cond);
+		g_mutex_unlock(&calculation_job_mutex);
+		job->unref();
 	}
 }
 
-class Calculator_p {
-	public:
-		unordered_map<size_t, MathStructure*> id_structs;
-		unordered_map<size_t, bool> ids_p;
-		vector<size_t> freed_ids;
-		size_t ids_i;
-};
+CalculationContext::CalculationContext(int precision) {
+	priv = new CalculationContext_p;
+	if(precision < 1) precision = (CALCULATOR ? CALCULATOR->getPrecision() : DEFAULT_PRECISION);
+	priv->precision = precision;
+	priv->disable_errors_ref = 0;
+	priv->current_stage = MESSAGE_STAGE_UNSET;
+	priv->ids_i = 0;
+	priv->parse_depth = 0;
+	priv->message_count = 0;
+	priv->hardware_float = (CALCULATOR ? CALCULATOR->usesHardwareFloat() : false);
+	priv->b_controlled = false;
+	priv->abort_recorded = false;
+	priv->i_timeout = 0;
+	priv->i_aborted = 0;
+	priv->profile_stages.resize(EVALUATION_STAGE_PRINT + 1);
+}
+CalculationContext::~CalculationContext() {
+	for(unordered_map<size_t, MathStructure*>::iterator it = priv->id_structs.begin(); it != priv->id_structs.end(); ++it) {
+		it->second->unref();
+	}
+	for(map<pair<KnownVariable*, int>, ContextValue>::iterator it = priv->variable_values.begin(); it != priv->variable_values.end(); ++it) {
+		it->second.mstruct->unref();
+		it->first.first->unref();
+	}
+	delete priv;
+}
+void CalculationContext::setPrecision(int precision) {
+	if(precision <= 0) precision = DEFAULT_PRECISION;
+	priv->precision = precision;
+}
+int CalculationContext::getPrecision() const {
+	return priv->precision;
+}
+void CalculationContext::useHardwareFloat(bool use_hardware_float) {
+	priv->hardware_float = use_hardware_float;
+}
+bool CalculationContext::usesHardwareFloat() const {
+	return priv->hardware_float;
+}
+
+// calculation context activated for the current thread
+static GPrivate current_calculation_context = G_PRIVATE_INIT(NULL);
+
+// releases the copies of the values of a deleted variable in the default context (other contexts keep the variable until they are deleted)
+void Calculator_p::removeContextValues(KnownVariable *v) {
+	CalculationContext_p *ctx = default_context->priv;
+	map<pair<KnownVariable*, int>, ContextValue>::iterator it = ctx->variable_values.lower_bound(pair<KnownVariable*, int>(v, 0));
+	while(it != ctx->variable_values.end() && it->first.first == v) {
+		it->second.mstruct->unref();
+		v->unref();
+		ctx->variable_values.erase(it++);
+	}
+}
+CalculationContext_p *Calculator_p::context() const {
+	CalculationContext *context = (CalculationContext*) g_private_get(&current_calculation_context);
+	if(!context) return default_context->priv;
+	return context->priv;
+}
+MathStructure *Calculator_p::idStruct(size_t id) const {
+	CalculationContext_p *ctx = context();
+	unordered_map<size_t, MathStructure*>::iterator it = ctx->id_structs.find(id);
+	if(it == ctx->id_structs.end()) return NULL;
+	return it->second;
+}
+
+/*
+	Names (of prefixes, functions, units and variables) not longer than UFV_LENGTHS are stored in a trie, with ASCII letters in lower case.
+	Case insensitive names are only stored up to the first non-ASCII character, since g_utf8_strdown() is used for comparison of these.
+	The trie is only used to find candidates, which are then compared with compare_name() or compare_name_no_case().
+*/
+void Calculator_p::addUFV(void *object, int type, size_t index, const string &name, bool case_sensitive) {
+	size_t node = 0;
+	for(size_t i = 0; i < name.length(); i++) {
+		char c = name[i];
+		if(c < 0 && !case_sensitive) break;
+		if(c >= 'A' && c <= 'Z') c += 32;
+		size_t child = 0;
+		for(size_t i2 = 0; i2 < ufv_nodes[node].children.size(); i2++) {
+			if(ufv_nodes[node].children[i2].first == c) {
+				child = ufv_nodes[node].children[i2].second;
+				break;
+			}
+		}
+		if(child == 0) {
+			child = ufv_nodes.size();
+			ufv_nodes.push_back(UFVNode());
+			ufv_nodes[node].children.push_back(pair<char, size_t>(c, child));
+		}
+		node = child;
+	}
+	UFVEntry entry;
+	entry.object = object;
+	entry.index = index;
+	entry.length = name.length();
+	entry.seq = ufv_seq++;
+	entry.type = type;
+	ufv_nodes[node].entries.push_back(entry);
+	vector<size_t> &nodes = ufv_object_nodes[object];
+	if(nodes.empty() || nodes.back() != node) nodes.push_back(node);
+}
+void Calculator_p::removeUFV(void *object) {
+	map<void*, vector<size_t> >::iterator it = ufv_object_nodes.find(object);
+	if(it == ufv_object_nodes.end()) return;
+	for(size_t i = 0; i < it->second.size(); i++) {
+		vector<UFVEntry> &entries = ufv_nodes[it->second[i]].entries;
+		for(size_t i2 = 0; i2 < entries.size();) {
+			if(entries[i2].object == object) entries.erase(entries.begin() + i2);
+			else i2++;
+		}
+	}
+	ufv_object_nodes.erase(it);
+}
+void Calculator_p::findUFV(const string &str, size_t str_index, size_t max_length, UFVMatches &matches, int type) const {
+	size_t node = 0;
+	for(size_t i = 0; ; i++) {
+		for(size_t i2 = 0; i2 < ufv_nodes[node].entries.size(); i2++) {
+			const UFVEntry &entry = ufv_nodes[node].entries[i2];
+			if((type < 0 || entry.type == type) && entry.length > 0 && entry.length <= max_length) {
+				matches.v[entry.type][entry.length - 1].push_back(entry);
+			}
+		}
+		if(i >= max_length || str_index + i >= str.length()) break;
+		char c = str[str_index + i];
+		if(c >= 'A' && c <= 'Z') c += 32;
+		size_t child = 0;
+		for(size_t i2 = 0; i2 < ufv_nodes[node].children.size(); i2++) {
+			if(ufv_nodes[node].children[i2].first == c) {
+				child = ufv_nodes[node].children[i2].second;
+				break;
+			}
+		}
+		if(child == 0) break;
+		node = child;
+	}
+	for(size_t i = 0; i < 4; i++) {
+		for(size_t i2 = 0; i2 < UFV_LENGTHS; i2++) {
+			if(matches.v[i][i2].size() > 1) sort(matches.v[i][i2].begin(), matches.v[i][i2].end(), ufv_entry_before);
+		}
+	}
+}
+
+/*
+	All variables, functions and units, active and inactive, are indexed by expression_name_hash() of each name, so that names that
+	are equal according to ExpressionItem::hasName() always have the same hash.
+	Since different names might have the same hash, candidates must always be checked with hasName().
+*/
+void Calculator_p::addToNameIndex(ExpressionItem *item) {
+	vector<size_t> &keys = name_index_keys[item];
+	for(size_t i = 1; i <= item->countNames(); i++) {
+		if(item->getName(i).name.empty()) continue;
+		size_t key = expression_name_hash(item->getName(i).name);
+		if(find(keys.begin(), keys.end(), key) != keys.end()) continue;
+		keys.push_back(key);
+		name_index[key].push_back(item);
+	}
+}
+void Calculator_p::removeFromNameIndex(ExpressionItem *item) {
+	map<ExpressionItem*, vector<size_t> >::iterator it = name_index_keys.find(item);
+	if(it == name_index_keys.end()) return;
+	for(size_t i = 0; i < it->second.size(); i++) {
+		unordered_map<size_t, vector<ExpressionItem*> >::iterator it2 = name_index.find(it->second[i]);
+		if(it2 == name_index.end()) continue;
+		vector<ExpressionItem*>::iterator it3 = find(it2->second.begin(), it2->second.end(), item);
+		if(it3 != it2->second.end()) it2->second.erase(it3);
+		if(it2->second.empty()) name_index.erase(it2);
+	}
+	name_index_keys.erase(it);
+}
+bool name_index_match(const ExpressionItem *item, const string &name, int type, int active, int composite, const ExpressionItem *exclude) {
+	if(item == exclude || item->type() != type) return false;
+	if(active >= 0 && item->isActive() != (active > 0)) return false;
+	if(composite >= 0 && (item->subtype() == SUBTYPE_COMPOSITE_UNIT) != (composite > 0)) return false;
+	return item->hasName(name) > 0;
+}
+/*
+	Returns the first matching item, in the order of Calculator::variables, Calculator::functions or Calculator::units, with the specified type.
+	active and composite (only relevant for units) are -1 to ignore the property, 0 for false and 1 for true.
+*/
+ExpressionItem *Calculator_p::findName(const Calculator *calc, const string &name, int type, int active, int composite, const ExpressionItem *exclude) const {
+	if(name.empty()) return NULL;
+	unordered_map<size_t, vector<ExpressionItem*> >::const_iterator it = name_index.find(expression_name_hash(name));
+	if(it == name_index.end()) return NULL;
+	ExpressionItem *item = NULL;
+	bool multiple = false;
+	for(size_t i = 0; i < it->second.size(); i++) {
+		if(name_index_match(it->second[i], name, type, active, composite, exclude)) {
+			if(item) {
+				multiple = true;
+				break;
+			}
+			item = it->second[i];
+		}
+	}
+	if(!multiple) return item;
+	switch(type) {
+		case TYPE_VARIABLE: {
+			for(size_t i = 0; i < calc->variables.size(); i++) {
+				if(name_index_match(calc->variables[i], name, type, active, composite, exclude)) return calc->variables[i];
+			}
+			break;
+		}
+		case TYPE_FUNCTION: {
+			for(size_t i = 0; i < calc->functions.size(); i++) {
+				if(name_index_match(calc->functions[i], name, type, active, composite, exclude)) return calc->functions[i];
+			}
+			break;
+		}
+		case TYPE_UNIT: {
+			for(size_t i = 0; i < calc->units.size(); i++) {
+				if(name_index_match(calc->units[i], name, type, active, composite, exclude)) return calc->units[i];
+			}
+			break;
+		}
+	}
+	return item;
+}
 
 Calculator::Calculator() {	
 
@@ -285,6 +709,12 @@ Calculator::Calculator() {
 #endif
 
 	priv = new Calculator_p;
+	priv->default_context = new CalculationContext(DEFAULT_PRECISION);
+	priv->parse_generation = 0;
+	priv->parse_cache_size = 0;
+	g_mutex_init(&priv->parse_cache_mutex);
+	priv->ufv_nodes.push_back(UFVNode());
+	priv->ufv_seq = 0;
 
 	setlocale(LC_ALL, "");
 
@@ -388,8 +818,6 @@ Calculator::Calculator() {
 	string str = _(" to ");
 	local_to = (str != " to ");
 	
-	priv->ids_i = 0;
-	
 	decimal_null_prefix = new DecimalPrefix(0, "", "");
 	binary_null_prefix = new BinaryPrefix(0, "", "");
 	m_undefined.setUndefined();
@@ -424,7 +852,6 @@ Calculator::Calculator() {
 	ILLEGAL_IN_NAMES_MINUS_SPACE_STR = DOT_S + RESERVED OPERATORS PARENTHESISS VECTOR_WRAPS;
 	ILLEGAL_IN_UNITNAMES = ILLEGAL_IN_NAMES + NUMBERS;
 	b_argument_errors = true;
-	current_stage = MESSAGE_STAGE_UNSET;
 	calculator = this;
 	srand48(time(0));
 	
@@ -432,8 +859,12 @@ Calculator::Calculator() {
 	addBuiltinFunctions();
 	addBuiltinUnits();
 
-	disable_errors_ref = 0;
-	b_busy = false;
+	priv->current_job = NULL;
+	priv->last_job = NULL;
+	priv->profiling = false;
+	priv->definitions_cache = true;
+	priv->lazy_definitions = true;
+	priv->deferred_fulfilled_translation = 0;
 	b_gnuplot_open = false;
 	gnuplot_pipe = NULL;
 
@@ -441,6 +872,11 @@ Calculator::Calculator() {
 }
 Calculator::~Calculator() {
 	closeGnuplot();
+	clearParseCache();
+	g_mutex_clear(&priv->parse_cache_mutex);
+	for(size_t i = 0; i < priv->job_queue.size(); i++) priv->job_queue[i]->unref();
+	if(priv->last_job) priv->last_job->unref();
+	delete priv->default_context;
 	delete priv;
 	delete calculate_thread;
 }
@@ -490,22 +926,27 @@ bool Calculator::showArgumentErrors() const {
 	return b_argument_errors;
 }
 void Calculator::beginTemporaryStopMessages() {
-	disable_errors_ref++;
-	stopped_errors_count.push_back(0);
-	stopped_warnings_count.push_back(0);
-	stopped_messages_count.push_back(0);
+	CalculationContext_p *ctx = priv->context();
+	ctx->disable_errors_ref++;
+	ctx->stopped_errors_count.push_back(0);
+	ctx->stopped_warnings_count.push_back(0);
+	ctx->stopped_messages_count.push_back(0);
 }
 int Calculator::endTemporaryStopMessages(int *message_count, int *warning_count) {
-	if(disable_errors_ref <= 0) return -1;
-	disable_errors_ref--;
-	int ret = stopped_errors_count[disable_errors_ref];
-	if(message_count) *message_count = stopped_messages_count[disable_errors_ref];
-	if(warning_count) *warning_count = stopped_warnings_count[disable_errors_ref];
-	stopped_errors_count.pop_back();
-	stopped_warnings_count.pop_back();
-	stopped_messages_count.pop_back();
+	CalculationContext_p *ctx = priv->context();
+	if(ctx->disable_errors_ref <= 0) return -1;
+	ctx->disable_errors_ref--;
+	int ret = ctx->stopped_errors_count[ctx->disable_errors_ref];
+	if(message_count) *message_count = ctx->stopped_messages_count[ctx->disable_errors_ref];
+	if(warning_count) *warning_count = ctx->stopped_warnings_count[ctx->disable_errors_ref];
+	ctx->stopped_errors_count.pop_back();
+	ctx->stopped_warnings_count.pop_back();
+	ctx->stopped_messages_count.pop_back();
 	return ret;
 }
+size_t Calculator::messageCount() {
+	return priv->context()->message_count;
+}
 Variable *Calculator::getVariable(size_t index) const {
 	if(index < variables.size()) {
 		return variables[index];
@@ -570,41 +1011,17 @@ ExpressionItem *Calculator::getActiveExpressionItem(ExpressionItem *item) {
 }
 ExpressionItem *Calculator::getActiveExpressionItem(string name, ExpressionItem *item) {
 	if(name.empty()) return NULL;
-	for(size_t index = 0; index < variables.size(); index++) {
-		if(variables[index] != item && variables[index]->isActive() && variables[index]->hasName(name)) {
-			return variables[index];
-		}
-	}
-	for(size_t index = 0; index < functions.size(); index++) {
-		if(functions[index] != item && functions[index]->isActive() && functions[index]->hasName(name)) {
-			return functions[index];
-		}
-	}
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i] != item && units[i]->isActive() && units[i]->hasName(name)) {
-			return units[i];
-		}
-	}
-	return NULL;
+	ExpressionItem *item2 = priv->findName(this, name, TYPE_VARIABLE, 1, -1, item);
+	if(!item2) item2 = priv->findName(this, name, TYPE_FUNCTION, 1, -1, item);
+	if(!item2) item2 = priv->findName(this, name, TYPE_UNIT, 1, -1, item);
+	return item2;
 }
 ExpressionItem *Calculator::getInactiveExpressionItem(string name, ExpressionItem *item) {
 	if(name.empty()) return NULL;
-	for(size_t index = 0; index < variables.size(); index++) {
-		if(variables[index] != item && !variables[index]->isActive() && variables[index]->hasName(name)) {
-			return variables[index];
-		}
-	}
-	for(size_t index = 0; index < functions.size(); index++) {
-		if(functions[index] != item && !functions[index]->isActive() && functions[index]->hasName(name)) {
-			return functions[index];
-		}
-	}
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i] != item && !units[i]->isActive() && units[i]->hasName(name)) {
-			return units[i];
-		}
-	}
-	return NULL;
+	ExpressionItem *item2 = priv->findName(this, name, TYPE_VARIABLE, 0, -1, item);
+	if(!item2) item2 = priv->findName(this, name, TYPE_FUNCTION, 0, -1, item);
+	if(!item2) item2 = priv->findName(this, name, TYPE_UNIT, 0, -1, item);
+	return item2;
 }
 ExpressionItem *Calculator::getExpressionItem(string name, ExpressionItem *item) {
 	if(name.empty()) return NULL;
@@ -956,6 +1373,7 @@ Prefix *Calculator::addPrefix(Prefix *p) {
 	return p;	
 }
 void Calculator::prefixNameChanged(Prefix *p, bool new_item) {
+	priv->parse_generation++;
 	size_t l2;
 	if(!new_item) delPrefixUFV(p);
 	if(!p->longName(false).empty()) {
@@ -992,9 +1410,7 @@ void Calculator::prefixNameChanged(Prefix *p, bool new_item) {
 				i++;
 			}
 		} else if(l2 > 0) {
-			l2--;
-			ufv[0][l2].push_back((void*) p);
-			ufv_i[0][l2].push_back(1);
+			priv->addUFV((void*) p, 0, 1, p->longName(false), false);
 		}
 	}
 	if(!p->shortName(false).empty()) {
@@ -1031,9 +1447,7 @@ void Calculator::prefixNameChanged(Prefix *p, bool new_item) {
 				i++;
 			}
 		} else if(l2 > 0) {
-			l2--;
-			ufv[0][l2].push_back((void*) p);
-			ufv_i[0][l2].push_back(2);
+			priv->addUFV((void*) p, 0, 2, p->shortName(false), true);
 		}
 	}
 	if(!p->unicodeName(false).empty()) {
@@ -1070,26 +1484,52 @@ void Calculator::prefixNameChanged(Prefix *p, bool new_item) {
 				i++;
 			}
 		} else if(l2 > 0) {
-			l2--;
-			ufv[0][l2].push_back((void*) p);
-			ufv_i[0][l2].push_back(3);
+			priv->addUFV((void*) p, 0, 3, p->unicodeName(false), true);
 		}
 	}
 }
 
+cln::float_format_t precision_float_format(int precision, bool hardware_float);
+void set_default_float_format(int precision, bool hardware_float) {
+	cln::default_float_format = precision_float_format(precision, hardware_float);
+}
+
 void Calculator::setPrecision(int precision) {
 	if(precision <= 0) precision = DEFAULT_PRECISION;
-/*	if(precision < 10) {
-		cln::default_float_format = float_format(precision + (10 - precision) + 5);	*/
-	if(precision < cln::float_format_lfloat_min) {
-		cln::default_float_format = cln::float_format(cln::float_format_lfloat_min + 5);
-	} else {
-		cln::default_float_format = cln::float_format(precision + 5);	
+	CalculationContext *context = (CalculationContext*) g_private_get(&current_calculation_context);
+	if(context) {
+		// the default float format of CLN is shared by all threads
+		context->setPrecision(precision);
+		return;
 	}
-	i_precision = precision;
+	priv->default_context->setPrecision(precision);
+	set_default_float_format(precision, priv->default_context->usesHardwareFloat());
 }
 int Calculator::getPrecision() const {
-	return i_precision;
+	return priv->context()->precision;
+}
+void Calculator::useHardwareFloat(bool use_hardware_float) {
+	CalculationContext *context = (CalculationContext*) g_private_get(&current_calculation_context);
+	if(context) {
+		context->useHardwareFloat(use_hardware_float);
+		return;
+	}
+	priv->default_context->useHardwareFloat(use_hardware_float);
+	set_default_float_format(priv->default_context->getPrecision(), use_hardware_float);
+}
+bool Calculator::usesHardwareFloat() const {
+	return priv->context()->hardware_float;
+}
+void Calculator::setCalculationContext(CalculationContext *context) {
+	g_private_set(&current_calculation_context, context == priv->default_context ? NULL : context);
+}
+CalculationContext *Calculator::calculationContext() const {
+	CalculationContext *context = (CalculationContext*) g_private_get(&current_calculation_context);
+	if(!context) return priv->default_context;
+	return context;
+}
+CalculationContext *Calculator::defaultCalculationContext() const {
+	return priv->default_context;
 }
 
 const string &Calculator::getDecimalPoint() const {return DOT_STR;}
@@ -1098,6 +1538,7 @@ string Calculator::localToString() const {
 	return _(" to ");
 }
 void Calculator::setLocale() {
+	priv->parse_generation++;
 	if(saved_locale) setlocale(LC_NUMERIC, saved_locale);
 	lconv *locale = localeconv();
 	if(strcmp(locale->decimal_point, ",") == 0) {
@@ -1114,12 +1555,14 @@ void Calculator::setLocale() {
 	setlocale(LC_NUMERIC, "C");
 }
 void Calculator::useDecimalComma() {
+	priv->parse_generation++;
 	DOT_STR = ",";
 	DOT_S = ".,";
 	COMMA_STR = ";";
 	COMMA_S = ";";
 }
 void Calculator::useDecimalPoint(bool use_comma_as_separator) {
+	priv->parse_generation++;
 	DOT_STR = ".";
 	DOT_S = ".";
 	if(use_comma_as_separator) {
@@ -1131,6 +1574,7 @@ void Calculator::useDecimalPoint(bool use_comma_as_separator) {
 	}
 }
 void Calculator::unsetLocale() {
+	priv->parse_generation++;
 	COMMA_STR = ",";
 	COMMA_S = ",;";
 	DOT_STR = ".";
@@ -1138,70 +1582,75 @@ void Calculator::unsetLocale() {
 }
 
 size_t Calculator::addId(MathStructure *mstruct, bool persistent) {
+	CalculationContext_p *ctx = priv->context();
 	size_t id = 0;
-	if(priv->freed_ids.size() > 0) {
-		id = priv->freed_ids.back();
-		priv->freed_ids.pop_back();
+	if(ctx->freed_ids.size() > 0) {
+		id = ctx->freed_ids.back();
+		ctx->freed_ids.pop_back();
 	} else {
-		priv->ids_i++;
-		id = priv->ids_i;
+		ctx->ids_i++;
+		id = ctx->ids_i;
 	}
-	priv->ids_p[id] = persistent;
-	priv->id_structs[id] = mstruct;
+	ctx->ids_p[id] = persistent;
+	ctx->id_structs[id] = mstruct;
 	return id;
 }
 size_t Calculator::parseAddId(MathFunction *f, const string &str, const ParseOptions &po, bool persistent) {
+	CalculationContext_p *ctx = priv->context();
 	size_t id = 0;
-	if(priv->freed_ids.size() > 0) {
-		id = priv->freed_ids.back();
-		priv->freed_ids.pop_back();
+	if(ctx->freed_ids.size() > 0) {
+		id = ctx->freed_ids.back();
+		ctx->freed_ids.pop_back();
 	} else {
-		priv->ids_i++;
-		id = priv->ids_i;
+		ctx->ids_i++;
+		id = ctx->ids_i;
 	}
-	priv->ids_p[id] = persistent;
-	priv->id_structs[id] = new MathStructure();
-	f->parse(*priv->id_structs[id], str, po);
+	ctx->ids_p[id] = persistent;
+	ctx->id_structs[id] = new MathStructure();
+	f->parse(*ctx->id_structs[id], str, po);
 	return id;
 }
 size_t Calculator::parseAddIdAppend(MathFunction *f, const MathStructure &append_mstruct, const string &str, const ParseOptions &po, bool persistent) {
+	CalculationContext_p *ctx = priv->context();
 	size_t id = 0;
-	if(priv->freed_ids.size() > 0) {
-		id = priv->freed_ids.back();
-		priv->freed_ids.pop_back();
+	if(ctx->freed_ids.size() > 0) {
+		id = ctx->freed_ids.back();
+		ctx->freed_ids.pop_back();
 	} else {
-		priv->ids_i++;
-		id = priv->ids_i;
+		ctx->ids_i++;
+		id = ctx->ids_i;
 	}
-	priv->ids_p[id] = persistent;
-	priv->id_structs[id] = new MathStructure();
-	f->parse(*priv->id_structs[id], str, po);
-	priv->id_structs[id]->addChild(append_mstruct);
+	ctx->ids_p[id] = persistent;
+	ctx->id_structs[id] = new MathStructure();
+	f->parse(*ctx->id_structs[id], str, po);
+	ctx->id_structs[id]->addChild(append_mstruct);
 	return id;
 }
 size_t Calculator::parseAddVectorId(const string &str, const ParseOptions &po, bool persistent) {
+	CalculationContext_p *ctx = priv->context();
 	size_t id = 0;
-	if(priv->freed_ids.size() > 0) {
-		id = priv->freed_ids.back();
-		priv->freed_ids.pop_back();
+	if(ctx->freed_ids.size() > 0) {
+		id = ctx->freed_ids.back();
+		ctx->freed_ids.pop_back();
 	} else {
-		priv->ids_i++;
-		id = priv->ids_i;
+		ctx->ids_i++;
+		id = ctx->ids_i;
 	}
-	priv->ids_p[id] = persistent;
-	priv->id_structs[id] = new MathStructure();
-	f_vector->args(str, *priv->id_structs[id], po);
+	ctx->ids_p[id] = persistent;
+	ctx->id_structs[id] = new MathStructure();
+	f_vector->args(str, *ctx->id_structs[id], po);
 	return id;
 }
 MathStructure *Calculator::getId(size_t id) {
-	if(priv->id_structs.find(id) != priv->id_structs.end()) {
-		if(priv->ids_p[id]) {
-			return new MathStructure(*priv->id_structs[id]);
+	CalculationContext_p *ctx = priv->context();
+	if(ctx->id_structs.find(id) != ctx->id_structs.end()) {
+		if(ctx->ids_p[id]) {
+			return new MathStructure(*ctx->id_structs[id]);
 		} else {
-			MathStructure *mstruct = priv->id_structs[id];
-			priv->freed_ids.push_back(id);
-			priv->id_structs.erase(id);
-			priv->ids_p.erase(id);
+			MathStructure *mstruct = ctx->id_structs[id];
+			ctx->freed_ids.push_back(id);
+			ctx->id_structs.erase(id);
+			ctx->ids_p.erase(id);
 			return mstruct;
 		}
 	}
@@ -1209,23 +1658,65 @@ MathStructure *Calculator::getId(size_t id) {
 }
 
 void Calculator::delId(size_t id) {
-	if(priv->ids_p.find(id) != priv->ids_p.end()) {	
-		priv->freed_ids.push_back(id);
-		priv->id_structs[id]->unref();
-		priv->id_structs.erase(id);
-		priv->ids_p.erase(id);
+	CalculationContext_p *ctx = priv->context();
+	if(ctx->ids_p.find(id) != ctx->ids_p.end()) {	
+		ctx->freed_ids.push_back(id);
+		ctx->id_structs[id]->unref();
+		ctx->id_structs.erase(id);
+		ctx->ids_p.erase(id);
+	}
+}
+const MathStructure *Calculator::getContextValue(KnownVariable *v, int precision, size_t version) const {
+	CalculationContext_p *ctx = priv->context();
+	map<pair<KnownVariable*, int>, ContextValue>::const_iterator it = ctx->variable_values.find(pair<KnownVariable*, int>(v, precision));
+	if(it == ctx->variable_values.end() || it->second.version != version) return NULL;
+	return it->second.mstruct;
+}
+const MathStructure &Calculator::setContextValue(KnownVariable *v, int precision, size_t version, const MathStructure &value) {
+	CalculationContext_p *ctx = priv->context();
+	MathStructure *mstruct = new MathStructure(value);
+	mstruct->unshare();
+	pair<map<pair<KnownVariable*, int>, ContextValue>::iterator, bool> ret = ctx->variable_values.insert(pair<pair<KnownVariable*, int>, ContextValue>(pair<KnownVariable*, int>(v, precision), ContextValue()));
+	if(ret.second) {
+		// the variable is kept until the context is deleted
+		v->ref();
+	} else {
+		ret.first->second.mstruct->unref();
 	}
+	ret.first->second.version = version;
+	ret.first->second.mstruct = mstruct;
+	return *mstruct;
+}
+size_t Calculator::parseGeneration() const {
+	return priv->parse_generation;
+}
+void Calculator::parseDefinitionsChanged() {
+	priv->parse_generation++;
 }
 
+// the names of the removed items must not be found by later lookups
 void Calculator::resetVariables() {
+	for(size_t i = 0; i < variables.size(); i++) {
+		priv->removeFromNameIndex(variables[i]);
+		delUFV(variables[i]);
+	}
 	variables.clear();
 	addBuiltinVariables();
 }
 void Calculator::resetFunctions() {
+	for(size_t i = 0; i < functions.size(); i++) {
+		priv->removeFromNameIndex(functions[i]);
+		delUFV(functions[i]);
+	}
 	functions.clear();
+	data_sets.clear();
 	addBuiltinFunctions();
 }
 void Calculator::resetUnits() {
+	for(size_t i = 0; i < units.size(); i++) {
+		priv->removeFromNameIndex(units[i]);
+		delUFV(units[i]);
+	}
 	units.clear();
 	addBuiltinUnits();
 }
@@ -1399,6 +1890,8 @@ void Calculator::addBuiltinFunctions() {
 	f_csum = addFunction(new CustomSumFunction());
 	f_function = addFunction(new FunctionFunction());
 	f_select = addFunction(new SelectFunction());
+	f_datacolumn = addFunction(new DataColumnFunction());
+	f_dataselect = addFunction(new DataSelectFunction());
 	f_title = addFunction(new TitleFunction());
 	f_if = addFunction(new IFFunction());
 	f_is_number = addFunction(new IsNumberFunction());
@@ -1475,12 +1968,14 @@ void Calculator::message(MessageType mtype, const char *TEMPLATE, ...) {
 	va_end(ap);
 }
 void Calculator::message(MessageType mtype, int message_category, const char *TEMPLATE, va_list ap) {
-	if(disable_errors_ref > 0) {
-		stopped_messages_count[disable_errors_ref - 1]++;
+	CalculationContext_p *ctx = priv->context();
+	ctx->message_count++;
+	if(ctx->disable_errors_ref > 0) {
+		ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
 		if(mtype == MESSAGE_ERROR) {
-			stopped_errors_count[disable_errors_ref - 1]++;
+			ctx->stopped_errors_count[ctx->disable_errors_ref - 1]++;
 		} else if(mtype == MESSAGE_WARNING) {
-			stopped_warnings_count[disable_errors_ref - 1]++;
+			ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 		}
 		return;
 	}
@@ -1515,27 +2010,29 @@ void Calculator::message(MessageType mtype, int message_category, const char *TE
 		}
 	}
 	bool dup_error = false;
-	for(i = 0; i < messages.size(); i++) {
-		if(error_str == messages[i].message()) {
+	for(i = 0; i < ctx->messages.size(); i++) {
+		if(error_str == ctx->messages[i].message()) {
 			dup_error = true;
 			break;
 		}
 	}
 	if(!dup_error) {
-		messages.push_back(CalculatorMessage(error_str, mtype, message_category, current_stage));
+		ctx->messages.push_back(CalculatorMessage(error_str, mtype, message_category, ctx->current_stage));
 	}
 }
 CalculatorMessage* Calculator::message() {
-	if(!messages.empty()) {
-		return &messages[0];
+	CalculationContext_p *ctx = priv->context();
+	if(!ctx->messages.empty()) {
+		return &ctx->messages[0];
 	}
 	return NULL;
 }
 CalculatorMessage* Calculator::nextMessage() {
-	if(!messages.empty()) {
-		messages.erase(messages.begin());
-		if(!messages.empty()) {
-			return &messages[0];
+	CalculationContext_p *ctx = priv->context();
+	if(!ctx->messages.empty()) {
+		ctx->messages.erase(ctx->messages.begin());
+		if(!ctx->messages.empty()) {
+			return &ctx->messages[0];
 		}
 	}
 	return NULL;
@@ -1578,51 +2075,153 @@ void Calculator::saveState() {
 void Calculator::restoreState() {
 }
 void Calculator::clearBuffers() {
-	for(unordered_map<size_t, bool>::iterator it = priv->ids_p.begin(); it != priv->ids_p.end(); ++it) {
+	CalculationContext_p *ctx = priv->context();
+	for(unordered_map<size_t, bool>::iterator it = ctx->ids_p.begin(); it != ctx->ids_p.end(); ++it) {
 		if(!it->second) {
-			priv->freed_ids.push_back(it->first);
-			priv->id_structs.erase(it->first);
-			priv->ids_p.erase(it);
+			ctx->freed_ids.push_back(it->first);
+			ctx->id_structs.erase(it->first);
+			ctx->ids_p.erase(it);
+		}
+	}
+}
+// must be called with calculation_job_mutex locked
+void Calculator_p::finishAbortedJob(CalculationJob *job) {
+	CalculationJob_p *j = job->priv;
+	// structures for RPN commands are owned by the job
+	if(j->proc_command != PROC_NO_COMMAND && j->mstruct) j->mstruct->unref();
+	j->mstruct = NULL;
+	j->b_aborted = true;
+	j->b_finished = true;
+	g_cond_broadcast(&calculation_job_cond);
+}
+void Calculator_p::requestAbort(CalculationContext *context) {
+	g_atomic_int_set(&context->priv->i_aborted, 1);
+}
+void Calculator_p::resetAbortedContext(CalculationContext_p *ctx) {
+	ctx->stopped_messages_count.clear();
+	ctx->stopped_warnings_count.clear();
+	ctx->stopped_errors_count.clear();
+	ctx->disable_errors_ref = 0;
+	// stages left by a cancelled calculation
+	for(size_t i = 0; i < ctx->profile_stages.size(); i++) ctx->profile_stages[i].depth = 0;
+	for(map<MathFunction*, ProfileStage>::iterator it = ctx->profile_functions.begin(); it != ctx->profile_functions.end(); ++it) it->second.depth = 0;
+}
+void Calculator::startJob(CalculationJob *job) {
+	saveState();
+	g_mutex_lock(&calculation_job_mutex);
+	// one reference for the queue (released by the calculation thread) and one for lastCalculation()
+	priv->job_queue.push_back(job);
+	job->ref();
+	job->ref();
+	if(priv->last_job) priv->last_job->unref();
+	priv->last_job = job;
+	if(!calculate_thread->isRunning()) {
+		calculate_thread->start();
+	}
+	g_cond_broadcast(&calculation_job_cond);
+	g_mutex_unlock(&calculation_job_mutex);
+}
+bool Calculator::waitForJob(CalculationJob *job, int msecs) {
+	if(msecs <= 0) return true;
+	if(!job->wait(msecs)) {
+		abortJob(job);
+		return false;
+	}
+	return true;
+}
+void Calculator::abortJob(CalculationJob *job) {
+	g_mutex_lock(&calculation_job_mutex);
+	if(job->priv->b_finished) {
+		g_mutex_unlock(&calculation_job_mutex);
+		return;
+	}
+	if(job != priv->current_job) {
+		// not started
+		for(deque<CalculationJob*>::iterator it = priv->job_queue.begin(); it != priv->job_queue.end(); ++it) {
+			if(*it == job) {
+				priv->job_queue.erase(it);
+				break;
+			}
 		}
+		if(job->priv->mstruct && job->priv->proc_command == PROC_NO_COMMAND) job->priv->mstruct->setAborted();
+		priv->finishAbortedJob(job);
+		g_mutex_unlock(&calculation_job_mutex);
+		job->unref();
+		return;
+	}
+	// ask the calculation to stop at the next safe point, where it unwinds and finishes the job as aborted
+	priv->requestAbort(job->priv->context);
+	g_mutex_unlock(&calculation_job_mutex);
+	if(job->wait(ABORT_GRACE_PERIOD)) return;
+	g_mutex_lock(&calculation_job_mutex);
+	if(job->priv->b_finished) {
+		g_mutex_unlock(&calculation_job_mutex);
+		return;
 	}
+	// the calculation is stuck in an operation without safe points; cancel the thread as a last resort
+	// the calculation thread never holds calculation_job_mutex while a job is in progress, and other process-wide locks are held with cancellation disabled (see thread_disable_cancel())
+	// cancel() waits until the thread has stopped, so that it cannot interfere with the restarted thread
+	g_atomic_int_inc(&abort_location_counts[ABORT_LOCATION_FORCED]);
+	calculate_thread->cancel();
+	restoreState();
+	// reset the context used by the calculation thread
+	CalculationContext *context = calculationContext();
+	setCalculationContext(job->priv->context);
+	CalculationContext_p *ctx = priv->context();
+	priv->resetAbortedContext(ctx);
+	ctx->b_controlled = false;
+	ctx->i_aborted = 0;
+	clearBuffers();
+	setCalculationContext(context);
+	priv->current_job = NULL;
+	priv->finishAbortedJob(job);
+	calculate_thread->start();
+	g_mutex_unlock(&calculation_job_mutex);
+	job->unref();
 }
 void Calculator::abort() {
-	if(!calculate_thread->running) {
-		b_busy = false;
-	} else {
-		calculate_thread->cancel();
-		restoreState();
-		stopped_messages_count.clear();
-		stopped_warnings_count.clear();
-		stopped_errors_count.clear();
-		disable_errors_ref = 0;
-		clearBuffers();
-		if(tmp_rpn_mstruct) tmp_rpn_mstruct->unref();
-		tmp_rpn_mstruct = NULL;
-		b_busy = false;
-		calculate_thread->start();
+	g_mutex_lock(&calculation_job_mutex);
+	CalculationJob *job = priv->current_job;
+	if(job) job->ref();
+	g_mutex_unlock(&calculation_job_mutex);
+	if(job) {
+		abortJob(job);
+		job->unref();
 	}
 }
 void Calculator::abort_this() {
+	CalculationContext_p *ctx = priv->context();
 	restoreState();
-	stopped_messages_count.clear();
-	stopped_warnings_count.clear();
-	stopped_errors_count.clear();
-	disable_errors_ref = 0;
+	priv->resetAbortedContext(ctx);
 	clearBuffers();
-	if(tmp_rpn_mstruct) tmp_rpn_mstruct->unref();
-	tmp_rpn_mstruct = NULL;
-	b_busy = false;
+	g_mutex_lock(&calculation_job_mutex);
+	CalculationJob *job = priv->current_job;
+	if(job) {
+		priv->current_job = NULL;
+		priv->finishAbortedJob(job);
+	}
+	g_mutex_unlock(&calculation_job_mutex);
+	if(job) job->unref();
 	pthread_exit(/* Solaris 2.6 needs a cast */ (void*) PTHREAD_CANCELED);
 }
 bool Calculator::busy() {
-	return b_busy;
+	g_mutex_lock(&calculation_job_mutex);
+	bool b = priv->current_job || !priv->job_queue.empty();
+	g_mutex_unlock(&calculation_job_mutex);
+	return b;
 }
 void Calculator::terminateThreads() {
-	if(calculate_thread->running) {
+	if(calculate_thread->isRunning()) {
 		calculate_thread->cancel();
 	}
 }
+CalculationJob *Calculator::lastCalculation() {
+	g_mutex_lock(&calculation_job_mutex);
+	CalculationJob *job = priv->last_job;
+	if(job) job->ref();
+	g_mutex_unlock(&calculation_job_mutex);
+	return job;
+}
 
 string Calculator::localizeExpression(string str) const {
 	if(DOT_STR == DOT && COMMA_STR == COMMA) return str;
@@ -1775,61 +2374,36 @@ bool Calculator::calculateRPNRegister(size_t index, int msecs, const EvaluationO
 }
 
 bool Calculator::calculateRPN(MathStructure *mstruct, int command, size_t index, int msecs, const EvaluationOptions &eo) {
-	saveState();
-	b_busy = true;
-	if(!calculate_thread->running) {
-		calculate_thread->start();
-	}
-	bool had_msecs = msecs > 0;
-	tmp_evaluationoptions = eo;
-	tmp_proc_command = command;
-	tmp_rpnindex = index;
-	tmp_rpn_mstruct = mstruct;
-	calculate_thread->write(false);
-	calculate_thread->write((void*) mstruct);
-	struct timespec rtime;
-	rtime.tv_sec = 0;
-	rtime.tv_nsec = 1000000;
-	while(msecs > 0 && b_busy) {
-		nanosleep(&rtime, NULL);
-		msecs -= 1;
-	}	
-	if(had_msecs && b_busy) {
-		abort();
-		return false;
-	}
-	return true;
+	CalculationJob *job = new CalculationJob();
+	CalculationJob_p *j = job->priv;
+	j->b_parse = false;
+	j->mstruct = mstruct;
+	j->eo = eo;
+	j->context = calculationContext();
+	j->proc_command = command;
+	j->rpn_index = index;
+	startJob(job);
+	bool b = waitForJob(job, msecs);
+	job->unref();
+	return b;
 }
 bool Calculator::calculateRPN(string str, int command, size_t index, int msecs, const EvaluationOptions &eo, MathStructure *parsed_struct, MathStructure *to_struct, bool make_to_division) {
-	MathStructure *mstruct = new MathStructure();
-	saveState();
-	b_busy = true;
-	if(!calculate_thread->running) {
-		calculate_thread->start();
-	}
-	bool had_msecs = msecs > 0;
-	expression_to_calculate = str;
-	tmp_evaluationoptions = eo;
-	tmp_proc_command = command;
-	tmp_rpnindex = index;
-	tmp_rpn_mstruct = mstruct;
-	tmp_parsedstruct = parsed_struct;
-	tmp_tostruct = to_struct;
-	tmp_maketodivision = make_to_division;
-	calculate_thread->write(true);
-	calculate_thread->write((void*) mstruct);
-	struct timespec rtime;
-	rtime.tv_sec = 0;
-	rtime.tv_nsec = 1000000;
-	while(msecs > 0 && b_busy) {
-		nanosleep(&rtime, NULL);
-		msecs -= 1;
-	}	
-	if(had_msecs && b_busy) {
-		abort();
-		return false;
-	}
-	return true;
+	CalculationJob *job = new CalculationJob();
+	CalculationJob_p *j = job->priv;
+	j->b_parse = true;
+	j->expression = str;
+	j->mstruct = new MathStructure();
+	j->eo = eo;
+	j->context = calculationContext();
+	j->proc_command = command;
+	j->rpn_index = index;
+	j->parsed_struct = parsed_struct;
+	j->to_struct = to_struct;
+	j->make_to_division = make_to_division;
+	startJob(job);
+	bool b = waitForJob(job, msecs);
+	job->unref();
+	return b;
 }
 
 bool Calculator::calculateRPN(MathOperation op, int msecs, const EvaluationOptions &eo, MathStructure *parsed_struct) {
@@ -2162,35 +2736,26 @@ void Calculator::moveRPNRegisterDown(size_t index) {
 }
 
 bool Calculator::calculate(MathStructure *mstruct, string str, int msecs, const EvaluationOptions &eo, MathStructure *parsed_struct, MathStructure *to_struct, bool make_to_division) {
+	CalculationJob *job = calculateAsync(mstruct, str, eo, parsed_struct, to_struct, make_to_division);
+	bool b = waitForJob(job, msecs);
+	job->unref();
+	if(!b) mstruct->setAborted();
+	return b;
+}
+CalculationJob *Calculator::calculateAsync(MathStructure *mstruct, string str, const EvaluationOptions &eo, MathStructure *parsed_struct, MathStructure *to_struct, bool make_to_division) {
 	mstruct->set(string(_("calculating...")));
-	saveState();
-	b_busy = true;
-	if(!calculate_thread->running) {
-		calculate_thread->start();
-	}
-	bool had_msecs = msecs > 0;
-	expression_to_calculate = str;
-	tmp_evaluationoptions = eo;
-	tmp_proc_command = PROC_NO_COMMAND;
-	tmp_rpn_mstruct = NULL;
-	tmp_parsedstruct = parsed_struct;
-	tmp_tostruct = to_struct;
-	tmp_maketodivision = make_to_division;
-	calculate_thread->write(true);
-	calculate_thread->write((void*) mstruct);
-	struct timespec rtime;
-	rtime.tv_sec = 0;
-	rtime.tv_nsec = 1000000;
-	while(msecs > 0 && b_busy) {
-		nanosleep(&rtime, NULL);
-		msecs -= 1;
-	}	
-	if(had_msecs && b_busy) {
-		abort();
-		mstruct->setAborted();
-		return false;
-	}
-	return true;
+	CalculationJob *job = new CalculationJob();
+	CalculationJob_p *j = job->priv;
+	j->b_parse = true;
+	j->expression = str;
+	j->mstruct = mstruct;
+	j->eo = eo;
+	j->context = calculationContext();
+	j->parsed_struct = parsed_struct;
+	j->to_struct = to_struct;
+	j->make_to_division = make_to_division;
+	startJob(job);
+	return job;
 }
 bool Calculator::hasToExpression(const string &str) const {
 	return str.rfind(_(" to ")) != string::npos || str.rfind(" to ") != string::npos;
@@ -2222,6 +2787,8 @@ bool Calculator::separateToExpression(string &str, string &to_str, const Evaluat
 	return false;
 }
 MathStructure Calculator::calculate(string str, const EvaluationOptions &eo, MathStructure *parsed_struct, MathStructure *to_struct, bool make_to_division) {
+	CalculationContext_p *ctx = priv->context();
+	EvaluationStageTimer timer(EVALUATION_STAGE_TOTAL);
 
 	string str2;
 	separateToExpression(str, str2, eo, true);
@@ -2240,7 +2807,7 @@ MathStructure Calculator::calculate(string str, const EvaluationOptions &eo, Mat
 	}
 	
 	MathStructure mstruct;
-	current_stage = MESSAGE_STAGE_PARSING;
+	ctx->current_stage = MESSAGE_STAGE_PARSING;
 	parse(&mstruct, str, eo.parse_options);
 	if(parsed_struct) {
 		beginTemporaryStopMessages();
@@ -2249,10 +2816,10 @@ MathStructure Calculator::calculate(string str, const EvaluationOptions &eo, Mat
 		parse(parsed_struct, str, po);
 		endTemporaryStopMessages();
 	}
-	current_stage = MESSAGE_STAGE_CALCULATION;
+	ctx->current_stage = MESSAGE_STAGE_CALCULATION;
 	mstruct.eval(eo);
 	
-	current_stage = MESSAGE_STAGE_CONVERSION;
+	ctx->current_stage = MESSAGE_STAGE_CONVERSION;
 	if(!str2.empty() || u) {
 		if(!u) u = getUnit(str2);
 		EvaluationOptions eo2 = eo;
@@ -2264,7 +2831,7 @@ MathStructure Calculator::calculate(string str, const EvaluationOptions &eo, Mat
 			str2 = str2.substr(1, str2.length() - 1);
 			remove_blank_ends(str2);
 			if(str2.empty()) {
-				current_stage = MESSAGE_STAGE_UNSET;
+				ctx->current_stage = MESSAGE_STAGE_UNSET;
 				return convertToMixedUnits(mstruct, eo);
 			}
 		}
@@ -2282,9 +2849,9 @@ MathStructure Calculator::calculate(string str, const EvaluationOptions &eo, Mat
 				if(to_struct) to_struct->set(u);
 				mstruct.set(convert(mstruct, u, eo2, false, false));
 			} else {
-				current_stage = MESSAGE_STAGE_CONVERSION_PARSING;
+				ctx->current_stage = MESSAGE_STAGE_CONVERSION_PARSING;
 				CompositeUnit cu("", "temporary_composite_convert", "", str2);
-				current_stage = MESSAGE_STAGE_CONVERSION;
+				ctx->current_stage = MESSAGE_STAGE_CONVERSION;
 				if(to_struct) to_struct->set(cu.generateMathStructure(make_to_division));
 				if(cu.countUnits() > 0) {
 					mstruct.set(convert(mstruct, &cu, eo2, false, false));
@@ -2296,18 +2863,18 @@ MathStructure Calculator::calculate(string str, const EvaluationOptions &eo, Mat
 		switch(eo.auto_post_conversion) {
 			case POST_CONVERSION_BEST: {
 				mstruct.set(convertToBestUnit(mstruct, eo));
-				current_stage = MESSAGE_STAGE_UNSET;
+				ctx->current_stage = MESSAGE_STAGE_UNSET;
 				return mstruct;
 			}
 			case POST_CONVERSION_BASE: {
 				mstruct.set(convertToBaseUnits(mstruct, eo));
-				current_stage = MESSAGE_STAGE_UNSET;
+				ctx->current_stage = MESSAGE_STAGE_UNSET;
 				return mstruct;
 			}
 			default: {}
 		}
 	}
-	current_stage = MESSAGE_STAGE_UNSET;
+	ctx->current_stage = MESSAGE_STAGE_UNSET;
 	return convertToMixedUnits(mstruct, eo);
 }
 string Calculator::printMathStructureTimeOut(const MathStructure &mstruct, int msecs, const PrintOptions &po) {
@@ -2440,44 +3007,32 @@ MathStructure Calculator::convertTimeOut(string str, Unit *from_unit, Unit *to_u
 	MathStructure mstruct;
 	parse(&mstruct, str, eo.parse_options);
 	mstruct *= from_unit;
-	saveState();
-	b_busy = true;
-	if(!calculate_thread->running) {
-		calculate_thread->start();
-	}
-	bool had_msecs = msecs > 0;
-	tmp_evaluationoptions = eo;
-	tmp_proc_command = PROC_NO_COMMAND;
-	bool b_parse = false;
-	calculate_thread->write(b_parse);
-	void *x = (void*) &mstruct;
-	calculate_thread->write(x);
-	struct timespec rtime;
-	rtime.tv_sec = 0;
-	rtime.tv_nsec = 1000000;
-	while(msecs > 0 && b_busy) {
-		nanosleep(&rtime, NULL);
-		msecs -= 1;
-	}	
-	if(had_msecs && b_busy) {
-		abort();
-		mstruct.setAborted();
-		return mstruct;
-	}
-	mstruct.convert(to_unit, true);
-	mstruct.divide(to_unit, true);
-	saveState();
-	b_busy = true;
-	calculate_thread->write(b_parse);
-	x = (void*) &mstruct;
-	calculate_thread->write(x);
-	while(msecs > 0 && b_busy) {
-		nanosleep(&rtime, NULL);
-		msecs -= 1;
-	}	
-	if(had_msecs && b_busy) {
-		abort();
-		mstruct.setAborted();
+	gint64 end_time = g_get_monotonic_time() + (gint64) msecs * 1000;
+	for(size_t i = 0; i < 2; i++) {
+		if(i == 1) {
+			mstruct.convert(to_unit, true);
+			mstruct.divide(to_unit, true);
+		}
+		CalculationJob *job = new CalculationJob();
+		CalculationJob_p *j = job->priv;
+		j->b_parse = false;
+		j->mstruct = &mstruct;
+		j->eo = eo;
+		j->context = calculationContext();
+		startJob(job);
+		// the result is returned, so always wait for the calculation to finish
+		bool b = true;
+		if(msecs > 0) {
+			gint64 remaining = (end_time - g_get_monotonic_time()) / 1000;
+			b = waitForJob(job, remaining > 0 ? (int) remaining : 1);
+		} else {
+			job->wait();
+		}
+		job->unref();
+		if(!b) {
+			mstruct.setAborted();
+			break;
+		}
 	}
 	return mstruct;
 }
@@ -3053,6 +3608,7 @@ MathStructure Calculator::convert(const MathStructure &mstruct, string composite
 	return convertToMixedUnits(convert(mstruct, &cu, eo2, false), eo2);
 }
 Unit* Calculator::addUnit(Unit *u, bool force, bool check_names) {
+	priv->parse_generation++;
 	if(check_names) {
 		for(size_t i = 1; i <= u->countNames(); i++) {
 			u->setName(getName(u->getName(i).name, u, force), i);
@@ -3075,6 +3631,7 @@ Unit* Calculator::addUnit(Unit *u, bool force, bool check_names) {
 	return u;
 }
 void Calculator::delPrefixUFV(Prefix *object) {
+	priv->parse_generation++;
 	int i = 0;
 	for(vector<void*>::iterator it = ufvl.begin(); ; ++it) {
 		del_ufvl:
@@ -3090,24 +3647,10 @@ void Calculator::delPrefixUFV(Prefix *object) {
 		}
 		i++;
 	}
-	for(size_t i2 = 0; i2 < UFV_LENGTHS; i2++) {
-		i = 0;
-		for(vector<void*>::iterator it = ufv[0][i2].begin(); ; ++it) {
-			del_ufv:
-			if(it == ufv[0][i2].end()) {
-				break;
-			}
-			if(*it == object) {
-				it = ufv[0][i2].erase(it);
-				ufv_i[0][i2].erase(ufv_i[0][i2].begin() + i);
-				if(it == ufv[0][i2].end()) break;
-				goto del_ufv;
-			}
-			i++;
-		}
-	}
+	priv->removeUFV((void*) object);
 }
 void Calculator::delUFV(ExpressionItem *object) {
+	priv->parse_generation++;
 	int i = 0;
 	for(vector<void*>::iterator it = ufvl.begin(); ; ++it) {
 		del_ufvl:
@@ -3123,58 +3666,20 @@ void Calculator::delUFV(ExpressionItem *object) {
 		}
 		i++;
 	}
-	int i3 = 0;
-	switch(object->type()) {
-		case TYPE_FUNCTION: {i3 = 1; break;}
-		case TYPE_UNIT: {i3 = 2; break;}
-		case TYPE_VARIABLE: {i3 = 3; break;}
-	}
-	for(size_t i2 = 0; i2 < UFV_LENGTHS; i2++) {
-		i = 0;
-		for(vector<void*>::iterator it = ufv[i3][i2].begin(); ; ++it) {
-			del_ufv:
-			if(it == ufv[i3][i2].end()) {
-				break;
-			}
-			if(*it == object) {
-				it = ufv[i3][i2].erase(it);
-				ufv_i[i3][i2].erase(ufv_i[i3][i2].begin() + i);
-				if(it == ufv[i3][i2].end()) break;
-				goto del_ufv;
-			}
-			i++;
-		}
-	}
+	priv->removeUFV((void*) object);
 }
 Unit* Calculator::getUnit(string name_) {
-	if(name_.empty()) return NULL;
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i]->subtype() != SUBTYPE_COMPOSITE_UNIT && (units[i]->hasName(name_))) {
-			return units[i];
-		}
-	}
-	return NULL;
+	return (Unit*) priv->findName(this, name_, TYPE_UNIT, -1, 0);
 }
 Unit* Calculator::getActiveUnit(string name_) {
-	if(name_.empty()) return NULL;
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i]->isActive() && units[i]->subtype() != SUBTYPE_COMPOSITE_UNIT && units[i]->hasName(name_)) {
-			return units[i];
-		}
-	}
-	return NULL;
+	return (Unit*) priv->findName(this, name_, TYPE_UNIT, 1, 0);
 }
 Unit* Calculator::getCompositeUnit(string internal_name_) {
-	if(internal_name_.empty()) return NULL;
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i]->subtype() == SUBTYPE_COMPOSITE_UNIT && units[i]->hasName(internal_name_)) {
-			return units[i];
-		}
-	}
-	return NULL;
+	return (Unit*) priv->findName(this, internal_name_, TYPE_UNIT, -1, 1);
 }
 
 Variable* Calculator::addVariable(Variable *v, bool force, bool check_names) {
+	priv->parse_generation++;
 	if(check_names) {
 		for(size_t i = 1; i <= v->countNames(); i++) {
 			v->setName(getName(v->getName(i).name, v, force), i);
@@ -3216,6 +3721,7 @@ void Calculator::expressionItemDeleted(ExpressionItem *item) {
 					break;
 				}
 			}
+			if(((Variable*) item)->isKnown()) priv->removeContextValues((KnownVariable*) item);
 			break;
 		}
 		case TYPE_FUNCTION: {
@@ -3247,9 +3753,15 @@ void Calculator::expressionItemDeleted(ExpressionItem *item) {
 			break;
 		}		
 	}
+	priv->removeFromNameIndex(item);
 	delUFV(item);
 }
 void Calculator::nameChanged(ExpressionItem *item, bool new_item) {
+	priv->parse_generation++;
+	if(new_item || priv->name_index_keys.find(item) != priv->name_index_keys.end()) {
+		priv->removeFromNameIndex(item);
+		priv->addToNameIndex(item);
+	}
 	if(!item->isActive() || item->countNames() == 0) return;
 	if(item->type() == TYPE_UNIT && ((Unit*) item)->subtype() == SUBTYPE_COMPOSITE_UNIT) {
 		return;
@@ -3303,21 +3815,17 @@ void Calculator::nameChanged(ExpressionItem *item, bool new_item) {
 				i++;
 			}
 		} else if(l2 > 0) {
-			l2--;
 			switch(item->type()) {			
 				case TYPE_VARIABLE: {
-					ufv[3][l2].push_back((void*) item);
-					ufv_i[3][l2].push_back(i2);
+					priv->addUFV((void*) item, 3, i2, item->getName(i2).name, item->getName(i2).case_sensitive);
 					break;
 				}
 				case TYPE_FUNCTION:  {
-					ufv[1][l2].push_back((void*) item);
-					ufv_i[1][l2].push_back(i2);
+					priv->addUFV((void*) item, 1, i2, item->getName(i2).name, item->getName(i2).case_sensitive);
 					break;
 				}
 				case TYPE_UNIT:  {
-					ufv[2][l2].push_back((void*) item);
-					ufv_i[2][l2].push_back(i2);
+					priv->addUFV((void*) item, 2, i2, item->getName(i2).name, item->getName(i2).case_sensitive);
 					break;
 				}
 			}			
@@ -3335,22 +3843,10 @@ void Calculator::unitNameChanged(Unit *u, bool new_item) {
 }
 
 Variable* Calculator::getVariable(string name_) {
-	if(name_.empty()) return NULL;
-	for(size_t i = 0; i < variables.size(); i++) {
-		if(variables[i]->hasName(name_)) {
-			return variables[i];
-		}
-	}
-	return NULL;
+	return (Variable*) priv->findName(this, name_, TYPE_VARIABLE);
 }
 Variable* Calculator::getActiveVariable(string name_) {
-	if(name_.empty()) return NULL;
-	for(size_t i = 0; i < variables.size(); i++) {
-		if(variables[i]->isActive() && variables[i]->hasName(name_)) {
-			return variables[i];
-		}
-	}
-	return NULL;
+	return (Variable*) priv->findName(this, name_, TYPE_VARIABLE, 1);
 }
 ExpressionItem* Calculator::addExpressionItem(ExpressionItem *item, bool force) {
 	switch(item->type()) {
@@ -3368,6 +3864,7 @@ ExpressionItem* Calculator::addExpressionItem(ExpressionItem *item, bool force)
 	return NULL;
 }
 MathFunction* Calculator::addFunction(MathFunction *f, bool force, bool check_names) {
+	priv->parse_generation++;
 	if(check_names) {
 		for(size_t i = 1; i <= f->countNames(); i++) {
 			f->setName(getName(f->getName(i).name, f, force), i);
@@ -3410,22 +3907,10 @@ DataSet* Calculator::getDataSet(string name) {
 	return NULL;
 }
 MathFunction* Calculator::getFunction(string name_) {
-	if(name_.empty()) return NULL;
-	for(size_t i = 0; i < functions.size(); i++) {
-		if(functions[i]->hasName(name_)) {
-			return functions[i];
-		}
-	}
-	return NULL;
+	return (MathFunction*) priv->findName(this, name_, TYPE_FUNCTION);
 }
 MathFunction* Calculator::getActiveFunction(string name_) {
-	if(name_.empty()) return NULL;
-	for(size_t i = 0; i < functions.size(); i++) {
-		if(functions[i]->isActive() && functions[i]->hasName(name_)) {
-			return functions[i];
-		}
-	}
-	return NULL;
+	return (MathFunction*) priv->findName(this, name_, TYPE_FUNCTION, 1);
 }
 bool Calculator::variableNameIsValid(const string &name_) {
 	return !name_.empty() && name_.find_first_of(ILLEGAL_IN_NAMES) == string::npos && is_not_in(NUMBERS, name_[0]);
@@ -3560,24 +4045,14 @@ bool Calculator::nameTaken(string name, ExpressionItem *object) {
 		switch(object->type()) {
 			case TYPE_VARIABLE: {}
 			case TYPE_UNIT: {
-				for(size_t index = 0; index < variables.size(); index++) {
-					if(variables[index]->isActive() && variables[index]->hasName(name)) {
-						return variables[index] != object;
-					}
-				}
-				for(size_t i = 0; i < units.size(); i++) {
-					if(units[i]->isActive() && units[i]->hasName(name)) {
-						return units[i] != object;
-					}
-				}
+				ExpressionItem *item = priv->findName(this, name, TYPE_VARIABLE, 1);
+				if(!item) item = priv->findName(this, name, TYPE_UNIT, 1);
+				if(item) return item != object;
 				break;
 			}
 			case TYPE_FUNCTION: {
-				for(size_t index = 0; index < functions.size(); index++) {
-					if(functions[index]->isActive() && functions[index]->hasName(name)) {
-						return functions[index] != object;
-					}
-				}
+				ExpressionItem *item = priv->findName(this, name, TYPE_FUNCTION, 1);
+				if(item) return item != object;
 				break;
 			}
 		}
@@ -3588,41 +4063,21 @@ bool Calculator::nameTaken(string name, ExpressionItem *object) {
 }
 bool Calculator::variableNameTaken(string name, Variable *object) {
 	if(name.empty()) return false;
-	for(size_t index = 0; index < variables.size(); index++) {
-		if(variables[index]->isActive() && variables[index]->hasName(name)) {
-			return variables[index] != object;
-		}
-	}
-	
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i]->isActive() && units[i]->hasName(name)) {
-			return true;
-		}
-	}
-	return false;
+	ExpressionItem *item = priv->findName(this, name, TYPE_VARIABLE, 1);
+	if(item) return item != object;
+	return priv->findName(this, name, TYPE_UNIT, 1) != NULL;
 }
 bool Calculator::unitNameTaken(string name, Unit *object) {
 	if(name.empty()) return false;
-	for(size_t index = 0; index < variables.size(); index++) {
-		if(variables[index]->isActive() && variables[index]->hasName(name)) {
-			return true;
-		}
-	}
-	
-	for(size_t i = 0; i < units.size(); i++) {
-		if(units[i]->isActive() && units[i]->hasName(name)) {
-			return units[i] == object;
-		}
-	}
+	if(priv->findName(this, name, TYPE_VARIABLE, 1)) return true;
+	ExpressionItem *item = priv->findName(this, name, TYPE_UNIT, 1);
+	if(item) return item == object;
 	return false;
 }
 bool Calculator::functionNameTaken(string name, MathFunction *object) {
 	if(name.empty()) return false;
-	for(size_t index = 0; index < functions.size(); index++) {
-		if(functions[index]->isActive() && functions[index]->hasName(name)) {
-			return functions[index] != object;
-		}
-	}
+	ExpressionItem *item = priv->findName(this, name, TYPE_FUNCTION, 1);
+	if(item) return item != object;
 	return false;
 }
 bool Calculator::unitIsUsedByOtherUnits(const Unit *u) const {
@@ -3740,8 +4195,104 @@ MathStructure Calculator::parse(string str, const ParseOptions &po) {
 	
 }
 
+void Calculator::setParseCacheSize(size_t max_entries) {
+	int cancel_state = thread_disable_cancel();
+	g_mutex_lock(&priv->parse_cache_mutex);
+	priv->parse_cache_size = max_entries;
+	while(priv->parse_cache.size() > priv->parse_cache_size) {
+		priv->parse_cache_index.erase(priv->parse_cache.back().key);
+		priv->parse_cache.back().mstruct->unref();
+		priv->parse_cache.pop_back();
+	}
+	g_mutex_unlock(&priv->parse_cache_mutex);
+	thread_restore_cancel(cancel_state);
+}
+size_t Calculator::parseCacheSize() const {
+	return priv->parse_cache_size;
+}
+void Calculator::clearParseCache() {
+	int cancel_state = thread_disable_cancel();
+	g_mutex_lock(&priv->parse_cache_mutex);
+	for(list<ParseCacheEntry>::iterator it = priv->parse_cache.begin(); it != priv->parse_cache.end(); ++it) {
+		it->mstruct->unref();
+	}
+	priv->parse_cache.clear();
+	priv->parse_cache_index.clear();
+	g_mutex_unlock(&priv->parse_cache_mutex);
+	thread_restore_cancel(cancel_state);
+}
+
 void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &parseoptions) {
 
+	CalculationContext_p *ctx = priv->context();
+	EvaluationStageTimer timer(EVALUATION_STAGE_PARSE);
+	if(priv->parse_cache_size > 0 && ctx->parse_depth == 0 && !parseoptions.unended_function && str.find(ID_WRAP_LEFT_CH) == string::npos) {
+		string key = str;
+		key += '\n';
+		key += i2s((parseoptions.variables_enabled ? 1 : 0) | (parseoptions.functions_enabled ? 2 : 0) | (parseoptions.unknowns_enabled ? 4 : 0) | (parseoptions.units_enabled ? 8 : 0) | (parseoptions.rpn ? 16 : 0) | (parseoptions.limit_implicit_multiplication ? 32 : 0) | (parseoptions.dot_as_separator ? 64 : 0) | (parseoptions.comma_as_separator ? 128 : 0) | (parseoptions.brackets_as_parentheses ? 256 : 0) | (parseoptions.preserve_format ? 512 : 0) | (parseoptions.convert_temperature_units ? 1024 : 0));
+		key += ' ';
+		key += i2s(parseoptions.base);
+		key += ' ';
+		key += i2s(parseoptions.read_precision);
+		key += ' ';
+		key += i2s(parseoptions.angle_unit);
+		key += ' ';
+		key += i2s(parseoptions.parsing_mode);
+		key += ' ';
+		key += i2s((unsigned long int) parseoptions.default_dataset);
+		key += ' ';
+		key += i2s(getPrecision());
+		int cancel_state = thread_disable_cancel();
+		g_mutex_lock(&priv->parse_cache_mutex);
+		map<string, list<ParseCacheEntry>::iterator>::iterator it = priv->parse_cache_index.find(key);
+		if(it != priv->parse_cache_index.end()) {
+			if(it->second->generation == priv->parse_generation) {
+				priv->parse_cache.splice(priv->parse_cache.begin(), priv->parse_cache, it->second);
+				mstruct->set(*priv->parse_cache.front().mstruct);
+				// cached expressions are shared by calculation contexts
+				mstruct->unshare();
+				g_mutex_unlock(&priv->parse_cache_mutex);
+				thread_restore_cancel(cancel_state);
+				return;
+			}
+			it->second->mstruct->unref();
+			priv->parse_cache.erase(it->second);
+			priv->parse_cache_index.erase(it);
+		}
+		g_mutex_unlock(&priv->parse_cache_mutex);
+		thread_restore_cancel(cancel_state);
+		size_t message_count = ctx->message_count;
+		size_t generation = priv->parse_generation;
+		ctx->parse_depth++;
+		parse(mstruct, str, parseoptions);
+		ctx->parse_depth--;
+		// do not cache expressions that resulted in errors or warnings, or changed definitions
+		if(message_count != ctx->message_count || generation != priv->parse_generation) return;
+		ParseCacheEntry entry;
+		entry.key = key;
+		entry.mstruct = new MathStructure(*mstruct);
+		entry.mstruct->unshare();
+		entry.generation = generation;
+		cancel_state = thread_disable_cancel();
+		g_mutex_lock(&priv->parse_cache_mutex);
+		it = priv->parse_cache_index.find(key);
+		if(it != priv->parse_cache_index.end()) {
+			it->second->mstruct->unref();
+			priv->parse_cache.erase(it->second);
+			priv->parse_cache_index.erase(it);
+		}
+		priv->parse_cache.push_front(entry);
+		priv->parse_cache_index[key] = priv->parse_cache.begin();
+		if(priv->parse_cache.size() > priv->parse_cache_size) {
+			priv->parse_cache_index.erase(priv->parse_cache.back().key);
+			priv->parse_cache.back().mstruct->unref();
+			priv->parse_cache.pop_back();
+		}
+		g_mutex_unlock(&priv->parse_cache_mutex);
+		thread_restore_cancel(cancel_state);
+		return;
+	}
+
 	ParseOptions po = parseoptions;
 	MathStructure *unended_function = po.unended_function;
 	po.unended_function = NULL;
@@ -4038,6 +4589,8 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 			size_t last_unit_char = str.find_last_not_of(NUMBERS, last_name_char);
 			size_t name_chars_left = last_name_char - str_index + 1;
 			size_t unit_chars_left = last_unit_char - str_index + 1;
+			UFVMatches ufv_m;
+			priv->findUFV(str, str_index, name_chars_left < UFV_LENGTHS ? name_chars_left : UFV_LENGTHS, ufv_m);
 			if(name_chars_left <= UFV_LENGTHS) {
 				ufv_index = name_chars_left - 1;
 				vt2 = 0;
@@ -4148,9 +4701,9 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 						}
 					}
 					case 0: {
-						if(po.units_enabled && ufv_index < unit_chars_left - 1 && vt3 < ufv[vt2][ufv_index].size()) {
-							object = ufv[vt2][ufv_index][vt3];
-							switch(ufv_i[vt2][ufv_index][vt3]) {
+						if(po.units_enabled && ufv_index < unit_chars_left - 1 && vt3 < ufv_m.v[vt2][ufv_index].size()) {
+							object = ufv_m.v[vt2][ufv_index][vt3].object;
+							switch(ufv_m.v[vt2][ufv_index][vt3].index) {
 								case 1: {
 									ufvt = 'P';
 									name = &((Prefix*) object)->longName();
@@ -4180,12 +4733,12 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 						vt3 = 0;
 					}
 					case 1: {
-						if(!found_function_name && po.functions_enabled && !p_mode && (!po.limit_implicit_multiplication || ufv_index + 1 == unit_chars_left || ufv_index + 1 == name_chars_left) && vt3 < ufv[vt2][ufv_index].size()) {
-							object = ufv[vt2][ufv_index][vt3];
+						if(!found_function_name && po.functions_enabled && !p_mode && (!po.limit_implicit_multiplication || ufv_index + 1 == unit_chars_left || ufv_index + 1 == name_chars_left) && vt3 < ufv_m.v[vt2][ufv_index].size()) {
+							object = ufv_m.v[vt2][ufv_index][vt3].object;
 							ufvt = 'f';
-							name = &((MathFunction*) object)->getName(ufv_i[vt2][ufv_index][vt3]).name;
+							name = &((MathFunction*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).name;
 							name_length = name->length();
-							case_sensitive = ((MathFunction*) object)->getName(ufv_i[vt2][ufv_index][vt3]).case_sensitive;
+							case_sensitive = ((MathFunction*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).case_sensitive;
 							vt3++;
 							break;
 						}
@@ -4193,13 +4746,13 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 						vt3 = 0;
 					}
 					case 2: {
-						if(po.units_enabled && !p_mode && (!po.limit_implicit_multiplication || ufv_index + 1 == unit_chars_left) && ufv_index < unit_chars_left && vt3 < ufv[vt2][ufv_index].size()) {							
-							object = ufv[vt2][ufv_index][vt3];
-							if(ufv_index + 1 == unit_chars_left || !((Unit*) object)->getName(ufv_i[vt2][ufv_index][vt3]).plural) {
+						if(po.units_enabled && !p_mode && (!po.limit_implicit_multiplication || ufv_index + 1 == unit_chars_left) && ufv_index < unit_chars_left && vt3 < ufv_m.v[vt2][ufv_index].size()) {							
+							object = ufv_m.v[vt2][ufv_index][vt3].object;
+							if(ufv_index + 1 == unit_chars_left || !((Unit*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).plural) {
 								ufvt = 'u';					
-								name = &((Unit*) object)->getName(ufv_i[vt2][ufv_index][vt3]).name;
+								name = &((Unit*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).name;
 								name_length = name->length();
-								case_sensitive = ((Unit*) object)->getName(ufv_i[vt2][ufv_index][vt3]).case_sensitive;
+								case_sensitive = ((Unit*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).case_sensitive;
 							}
 							vt3++;
 							break;
@@ -4208,12 +4761,12 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 						vt3 = 0;
 					}
 					case 3: {
-						if(po.variables_enabled && !p_mode && (!po.limit_implicit_multiplication || ufv_index + 1 == unit_chars_left || ufv_index + 1 == name_chars_left) && vt3 < ufv[vt2][ufv_index].size()) {
-							object = ufv[vt2][ufv_index][vt3];
+						if(po.variables_enabled && !p_mode && (!po.limit_implicit_multiplication || ufv_index + 1 == unit_chars_left || ufv_index + 1 == name_chars_left) && vt3 < ufv_m.v[vt2][ufv_index].size()) {
+							object = ufv_m.v[vt2][ufv_index][vt3].object;
 							ufvt = 'v';
-							name = &((Variable*) object)->getName(ufv_i[vt2][ufv_index][vt3]).name;
+							name = &((Variable*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).name;
 							name_length = name->length();
-							case_sensitive = ((Variable*) object)->getName(ufv_i[vt2][ufv_index][vt3]).case_sensitive;
+							case_sensitive = ((Variable*) object)->getName(ufv_m.v[vt2][ufv_index][vt3].index).case_sensitive;
 							vt3++;
 							break;
 						}						
@@ -4451,7 +5004,7 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 										if(i7 != string::npos) {
 											int id = s2i(str.substr(i7 + 1, i6 - i7 - 1));
 											MathStructure *m_temp = NULL;
-											if(priv->id_structs.find(id) != priv->id_structs.end()) m_temp = priv->id_structs[id];
+											m_temp = priv->idStruct(id);
 											if(m_temp && m_temp->isUnit()) {
 												if(i_depth == 0) break;
 												if(b_nonspace == 1 && str[i6 + 1] == RIGHT_PARENTHESIS_CH) {
@@ -4545,6 +5098,8 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 							p = (Prefix*) object;
 							str_index += name_length;
 							unit_chars_left = last_unit_char - str_index + 1;
+							UFVMatches unit_m;
+							priv->findUFV(str, str_index, unit_chars_left < UFV_LENGTHS ? unit_chars_left : UFV_LENGTHS, unit_m, 2);
 							size_t name_length_old = name_length;
 							int index = 0; 
 							if(unit_chars_left > UFV_LENGTHS) {
@@ -4591,16 +5146,16 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 								index = UFV_LENGTHS - 1;
 							}
 							for(; index >= 0; index--) {
-								for(size_t ufv_index2 = 0; ufv_index2 < ufv[2][index].size(); ufv_index2++) {
-									name = &((Unit*) ufv[2][index][ufv_index2])->getName(ufv_i[2][index][ufv_index2]).name;
-									case_sensitive = ((Unit*) ufv[2][index][ufv_index2])->getName(ufv_i[2][index][ufv_index2]).case_sensitive;
+								for(size_t ufv_index2 = 0; ufv_index2 < unit_m.v[2][index].size(); ufv_index2++) {
+									name = &((Unit*) unit_m.v[2][index][ufv_index2].object)->getName(unit_m.v[2][index][ufv_index2].index).name;
+									case_sensitive = ((Unit*) unit_m.v[2][index][ufv_index2].object)->getName(unit_m.v[2][index][ufv_index2].index).case_sensitive;
 									name_length = name->length();
-									if(index + 1 == (int) unit_chars_left || !((Unit*) ufv[2][index][ufv_index2])->getName(ufv_i[2][index][ufv_index2]).plural) {
+									if(index + 1 == (int) unit_chars_left || !((Unit*) unit_m.v[2][index][ufv_index2].object)->getName(unit_m.v[2][index][ufv_index2].index).plural) {
 										if(name_length <= unit_chars_left && ((case_sensitive && compare_name(*name, str, name_length, str_index)) || (!case_sensitive && compare_name_no_case(*name, str, name_length, str_index)))) {
-											if((!p_mode && name_length_old > 1) || (p_mode && (name_length + name_length_old > best_pl || ((ufvt != 'P' || !((Unit*) ufv[2][index][ufv_index2])->getName(ufv_i[2][index][ufv_index2]).abbreviation) && name_length + name_length_old == best_pl)))) {
+											if((!p_mode && name_length_old > 1) || (p_mode && (name_length + name_length_old > best_pl || ((ufvt != 'P' || !((Unit*) unit_m.v[2][index][ufv_index2].object)->getName(unit_m.v[2][index][ufv_index2].index).abbreviation) && name_length + name_length_old == best_pl)))) {
 												p_mode = true;
 												best_p = p;
-												best_p_object = ufv[2][index][ufv_index2];
+												best_p_object = unit_m.v[2][index][ufv_index2].object;
 												best_pl = name_length + name_length_old;
 												best_pnl = name_length_old;
 												index = -1;
@@ -4608,7 +5163,7 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 											if(!p_mode) {
 												str.erase(str_index - name_length_old, name_length_old);
 												str_index -= name_length_old;
-												object = ufv[2][index][ufv_index2];
+												object = unit_m.v[2][index][ufv_index2].object;
 												goto replace_text_by_unit_place;
 											}
 										}
@@ -4748,12 +5303,13 @@ void Calculator::parse(MathStructure *mstruct, string str, const ParseOptions &p
 }
 
 bool Calculator::parseNumber(MathStructure *mstruct, string str, const ParseOptions &po) {
+	CalculationContext_p *ctx = priv->context();
 	mstruct->clear();
 	if(str.empty()) return false;
 	if(str.find_first_not_of(OPERATORS SPACE) == string::npos) {
-		if(disable_errors_ref > 0) {
-			stopped_messages_count[disable_errors_ref - 1]++;
-			stopped_warnings_count[disable_errors_ref - 1]++;
+		if(ctx->disable_errors_ref > 0) {
+			ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+			ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 		} else {
 			error(false, _("Misplaced operator(s) \"%s\" ignored"), str.c_str(), NULL);
 		}
@@ -4775,9 +5331,9 @@ bool Calculator::parseNumber(MathStructure *mstruct, string str, const ParseOpti
 		} else if(str[i] == COMMA_CH && DOT_S == ".") {
 			str.erase(i, 1);
 		} else if(is_in(OPERATORS, str[i])) {
-			if(disable_errors_ref > 0) {
-				stopped_messages_count[disable_errors_ref - 1]++;
-				stopped_warnings_count[disable_errors_ref - 1]++;
+			if(ctx->disable_errors_ref > 0) {
+				ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+				ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 			} else {
 				error(false, _("Misplaced '%c' ignored"), str[i], NULL);
 			}
@@ -4927,6 +5483,7 @@ bool Calculator::parseAdd(string &str, MathStructure *mstruct, const ParseOption
 }
 
 bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseOptions &po) {
+	CalculationContext_p *ctx = priv->context();
 	string save_str = str;
 	mstruct->clear();
 	size_t i = 0, i2 = 0, i3 = 0;
@@ -5411,7 +5968,7 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 					m_temp = NULL;
 					if(i2 != string::npos) {
 						int id = s2i(str.substr(i2 + 1, (i4 - 1) - (i2 + 1)));
-						if(priv->id_structs.find(id) != priv->id_structs.end()) m_temp = priv->id_structs[id];
+						m_temp = priv->idStruct(id);
 					}
 					if(!m_temp || !m_temp->isUnit()) break;
 					had_unit = true;
@@ -5425,7 +5982,7 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 					m_temp2 = NULL;
 					if(i3 != string::npos) {
 						int id = s2i(str.substr(i4 + 2, (i3 - 1) - (i4 + 1)));
-						if(priv->id_structs.find(id) != priv->id_structs.end()) m_temp2 = priv->id_structs[id];
+						m_temp2 = priv->idStruct(id);
 					}
 					if(!m_temp2 || !m_temp2->isUnit()) {
 						b = false;
@@ -5514,9 +6071,9 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 		while(i != string::npos && i + 1 != str.length()) {
 			if(i < 1) {
 				if(i < 1 && str.find_first_not_of(MULTIPLICATION_2 OPERATORS EXPS) == string::npos) {
-					if(disable_errors_ref > 0) {
-						stopped_messages_count[disable_errors_ref - 1]++;
-						stopped_warnings_count[disable_errors_ref - 1]++;
+					if(ctx->disable_errors_ref > 0) {
+						ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+						ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 					} else {
 						error(false, _("Misplaced operator(s) \"%s\" ignored"), str.c_str(), NULL);
 					}
@@ -5526,9 +6083,9 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 				while(i < str.length() && is_in(MULTIPLICATION DIVISION, str[i])) {
 					i++;
 				}
-				if(disable_errors_ref > 0) {
-					stopped_messages_count[disable_errors_ref - 1]++;
-					stopped_warnings_count[disable_errors_ref - 1]++;
+				if(ctx->disable_errors_ref > 0) {
+					ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+					ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 				} else {
 					error(false, _("Misplaced operator(s) \"%s\" ignored"), str.substr(0, i).c_str(), NULL);
 				}
@@ -5551,9 +6108,9 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 					while(i2 + i + 1 != str.length() && is_in(MULTIPLICATION DIVISION, str[i2 + i + 1])) {
 						i2++;
 					}
-					if(disable_errors_ref > 0) {
-						stopped_messages_count[disable_errors_ref - 1]++;
-						stopped_warnings_count[disable_errors_ref - 1]++;
+					if(ctx->disable_errors_ref > 0) {
+						ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+						ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 					} else {
 						error(false, _("Misplaced operator(s) \"%s\" ignored"), str.substr(i, i2).c_str(), NULL);
 					}
@@ -5577,9 +6134,9 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 
 	if(str.empty()) return false;
 	if(str.find_first_not_of(OPERATORS SPACE) == string::npos) {
-		if(disable_errors_ref > 0) {
-			stopped_messages_count[disable_errors_ref - 1]++;
-			stopped_warnings_count[disable_errors_ref - 1]++;
+		if(ctx->disable_errors_ref > 0) {
+			ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+			ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 		} else {
 			error(false, _("Misplaced operator(s) \"%s\" ignored"), str.c_str(), NULL);
 		}
@@ -5601,9 +6158,9 @@ bool Calculator::parseOperators(MathStructure *mstruct, string str, const ParseO
 		} else if(str[i] == SPACE_CH) {
 			str.erase(i, 1);
 		} else if(is_in(OPERATORS, str[i])) {
-			if(disable_errors_ref > 0) {
-				stopped_messages_count[disable_errors_ref - 1]++;
-				stopped_warnings_count[disable_errors_ref - 1]++;
+			if(ctx->disable_errors_ref > 0) {
+				ctx->stopped_messages_count[ctx->disable_errors_ref - 1]++;
+				ctx->stopped_warnings_count[ctx->disable_errors_ref - 1]++;
 			} else {
 				error(false, _("Misplaced '%c' ignored"), str[i], NULL);
 			}
@@ -6412,6 +6969,411 @@ bool Calculator::loadLocalDefinitions() {
 						}\
 					}					
 
+/*
+	Snapshot of a global definitions file, for faster loading.
+	The document tree is stored in pre-order, with translations that cannot be used in the current locale removed:
+	header: "QALCDEFS", format version (uint32), key (uint64)
+	element: SNAPSHOT_ELEMENT, name, number of attributes (uint32), attribute names and values, child nodes, SNAPSHOT_END
+	text: SNAPSHOT_TEXT, content
+	Strings are stored as length (uint32), followed by the characters and a terminating null character.
+*/
+#define DEFINITIONS_SNAPSHOT_MAGIC "QALCDEFS"
+#define DEFINITIONS_SNAPSHOT_VERSION 1
+#define DEFINITIONS_SNAPSHOT_HEADER_SIZE 20
+
+enum {
+	SNAPSHOT_END,
+	SNAPSHOT_ELEMENT,
+	SNAPSHOT_TEXT
+};
+
+void snapshot_append_uint32(string &out, guint32 i) {
+	out.append((const char*) &i, sizeof(guint32));
+}
+void snapshot_append_string(string &out, const char *str) {
+	size_t len = (str ? strlen(str) : 0);
+	snapshot_append_uint32(out, len);
+	if(len > 0) out.append(str, len);
+	out += '\0';
+}
+
+bool snapshot_is_blank(const xmlChar *str) {
+	if(!str) return true;
+	for(; *str; str++) {
+		if(*str != ' ' && *str != '\t' && *str != '\n' && *str != '\r') return false;
+	}
+	return true;
+}
+
+// Returns true if the element is a translation that will never be used in the current locale (if an untranslated alternative exists, see XML_GET_LOCALE_STRING_FROM_TEXT and ITEM_READ_NAME)
+bool snapshot_unused_translation(xmlNodePtr node, const string &locale, const string &localebase) {
+	xmlChar *lang = xmlGetNsProp(node, (const xmlChar*) "lang", XML_XML_NAMESPACE);
+	if(!lang) return false;
+	bool b_unused = (locale.empty() || (locale != (char*) lang && (xmlStrlen(lang) < 2 || lang[0] != localebase[0] || lang[1] != localebase[1])));
+	xmlFree(lang);
+	if(!b_unused) return false;
+	for(xmlNodePtr sibling = node->parent->xmlChildrenNode; sibling != NULL; sibling = sibling->next) {
+		if(sibling != node && sibling->type == XML_ELEMENT_NODE && !xmlStrcmp(sibling->name, node->name) && !xmlHasNsProp(sibling, (const xmlChar*) "lang", XML_XML_NAMESPACE)) return true;
+	}
+	return false;
+}
+
+bool snapshot_write_element(xmlNodePtr node, string &out, const string &locale, const string &localebase) {
+	out += (char) SNAPSHOT_ELEMENT;
+	snapshot_append_string(out, (const char*) node->name);
+	guint32 n_attrs = 0;
+	for(xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) n_attrs++;
+	snapshot_append_uint32(out, n_attrs);
+	for(xmlAttrPtr attr = node->properties; attr != NULL; attr = attr->next) {
+		if(attr->ns && attr->ns->prefix) {
+			if(xmlStrcmp(attr->ns->prefix, (const xmlChar*) "xml")) return false;
+			string name = "xml:";
+			name += (const char*) attr->name;
+			snapshot_append_string(out, name.c_str());
+		} else {
+			snapshot_append_string(out, (const char*) attr->name);
+		}
+		xmlChar *value = xmlNodeGetContent((xmlNodePtr) attr);
+		snapshot_append_string(out, (const char*) value);
+		if(value) xmlFree(value);
+	}
+	bool has_elements = false;
+	for(xmlNodePtr child = node->xmlChildrenNode; child != NULL; child = child->next) {
+		if(child->type == XML_ELEMENT_NODE) {
+			has_elements = true;
+			break;
+		}
+	}
+	for(xmlNodePtr child = node->xmlChildrenNode; child != NULL; child = child->next) {
+		switch(child->type) {
+			case XML_ELEMENT_NODE: {
+				if(snapshot_unused_translation(child, locale, localebase)) break;
+				if(!snapshot_write_element(child, out, locale, localebase)) return false;
+				break;
+			}
+			case XML_TEXT_NODE: {}
+			case XML_CDATA_SECTION_NODE: {
+				// indentation between elements
+				if(has_elements && snapshot_is_blank(child->content)) break;
+				out += (char) SNAPSHOT_TEXT;
+				snapshot_append_string(out, (const char*) child->content);
+				break;
+			}
+			case XML_COMMENT_NODE: {}
+			case XML_PI_NODE: {
+				break;
+			}
+			default: {
+				// entity references and other nodes are not supported
+				return false;
+			}
+		}
+	}
+	out += (char) SNAPSHOT_END;
+	return true;
+}
+
+class DefinitionsSnapshotReader {
+  protected:
+	const char *p, *end;
+	xmlDocPtr doc;
+	bool readUInt32(guint32 &i) {
+		if(end - p < (long int) sizeof(guint32)) return false;
+		memcpy(&i, p, sizeof(guint32));
+		p += sizeof(guint32);
+		return true;
+	}
+	const xmlChar *readString(guint32 &len) {
+		if(!readUInt32(len) || (size_t) (end - p) <= len || p[len] != '\0') return NULL;
+		const xmlChar *str = (const xmlChar*) p;
+		p += len + 1;
+		return str;
+	}
+	xmlNodePtr readElement(int depth) {
+		guint32 len = 0, n_attrs = 0;
+		const xmlChar *name = readString(len);
+		if(!name || len == 0 || !readUInt32(n_attrs)) return NULL;
+		xmlNodePtr node = xmlNewDocNode(doc, NULL, name, NULL);
+		for(guint32 i = 0; i < n_attrs; i++) {
+			const xmlChar *attr_name = readString(len);
+			const xmlChar *attr_value = (attr_name ? readString(len) : NULL);
+			if(!attr_value) {
+				xmlFreeNode(node);
+				return NULL;
+			}
+			if(!xmlStrcmp(attr_name, (const xmlChar*) "xml:lang")) xmlNodeSetLang(node, attr_value);
+			else if(!xmlStrncmp(attr_name, (const xmlChar*) "xml:", 4)) xmlSetNsProp(node, xmlSearchNsByHref(doc, node, XML_XML_NAMESPACE), attr_name + 4, attr_value);
+			else xmlNewProp(node, attr_name, attr_value);
+		}
+		while(p < end) {
+			char c = *p;
+			p++;
+			if(c == SNAPSHOT_END) return node;
+			xmlNodePtr child = NULL;
+			if(c == SNAPSHOT_ELEMENT && depth < 100) {
+				child = readElement(depth + 1);
+			} else if(c == SNAPSHOT_TEXT) {
+				const xmlChar *str = readString(len);
+				if(str) child = xmlNewDocTextLen(doc, str, len);
+			}
+			if(!child) break;
+			xmlAddChild(node, child);
+		}
+		xmlFreeNode(node);
+		return NULL;
+	}
+  public:
+	DefinitionsSnapshotReader(const char *data, size_t len) : p(data), end(data + len), doc(NULL) {}
+	xmlDocPtr read(guint64 key) {
+		if(end - p < DEFINITIONS_SNAPSHOT_HEADER_SIZE || memcmp(p, DEFINITIONS_SNAPSHOT_MAGIC, 8) != 0) return NULL;
+		p += 8;
+		guint32 version = 0;
+		guint64 snapshot_key = 0;
+		readUInt32(version);
+		memcpy(&snapshot_key, p, sizeof(guint64));
+		p += sizeof(guint64);
+		if(version != DEFINITIONS_SNAPSHOT_VERSION || snapshot_key != key) return NULL;
+		if(p >= end || *p != SNAPSHOT_ELEMENT) return NULL;
+		p++;
+		doc = xmlNewDoc((const xmlChar*) "1.0");
+		xmlNodePtr root = readElement(0);
+		if(!root || p != end) {
+			if(root) xmlFreeNode(root);
+			xmlFreeDoc(doc);
+			return NULL;
+		}
+		xmlDocSetRootElement(doc, root);
+		return doc;
+	}
+};
+
+string definitions_snapshot_file(const char *file_name) {
+	gchar *basename = g_path_get_basename(file_name);
+	string cache_name = basename;
+	cache_name += ".cache";
+	g_free(basename);
+	gchar *gstr = g_build_filename(getLocalCacheDir().c_str(), "definitions", cache_name.c_str(), NULL);
+	string snapshot_file = gstr;
+	g_free(gstr);
+	return snapshot_file;
+}
+
+// Loads a global definitions file from the snapshot in the cache directory, if it is up to date, otherwise parses the file and writes a new snapshot
+xmlDocPtr load_definitions_document(const char *file_name, const string &locale, const string &localebase) {
+	gchar *contents = NULL;
+	gsize contents_len = 0;
+	if(!g_file_get_contents(file_name, &contents, &contents_len, NULL)) return NULL;
+	// the snapshot is valid for the same definitions file, locale and library version
+	guint64 key = fnv1a_hash(contents, contents_len);
+	key = fnv1a_hash(locale.c_str(), locale.length() + 1, key);
+	key = fnv1a_hash(VERSION, strlen(VERSION) + 1, key);
+	string snapshot_file = definitions_snapshot_file(file_name);
+	xmlDocPtr doc = NULL;
+#ifndef _WIN32
+	int fd = open(snapshot_file.c_str(), O_RDONLY);
+	if(fd >= 0) {
+		struct stat st;
+		if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > DEFINITIONS_SNAPSHOT_HEADER_SIZE) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(map != MAP_FAILED) {
+				DefinitionsSnapshotReader reader((const char*) map, st.st_size);
+				doc = reader.read(key);
+				munmap(map, st.st_size);
+			}
+		}
+		close(fd);
+	}
+#else
+	gchar *snapshot = NULL;
+	gsize snapshot_len = 0;
+	if(g_file_get_contents(snapshot_file.c_str(), &snapshot, &snapshot_len, NULL)) {
+		DefinitionsSnapshotReader reader(snapshot, snapshot_len);
+		doc = reader.read(key);
+		g_free(snapshot);
+	}
+#endif
+	if(doc) {
+		g_free(contents);
+		return doc;
+	}
+	// missing or stale snapshot
+	doc = xmlReadMemory(contents, contents_len, file_name, NULL, 0);
+	g_free(contents);
+	if(!doc) return NULL;
+	xmlNodePtr root = xmlDocGetRootElement(doc);
+	if(!root) return doc;
+	string out = DEFINITIONS_SNAPSHOT_MAGIC;
+	snapshot_append_uint32(out, DEFINITIONS_SNAPSHOT_VERSION);
+	out.append((const char*) &key, sizeof(guint64));
+	if(snapshot_write_element(root, out, locale, localebase)) {
+		gchar *cachedir = g_build_filename(getLocalCacheDir().c_str(), "definitions", NULL);
+		g_mkdir_with_parents(cachedir, S_IRWXU);
+		g_free(cachedir);
+		// written to a temporary file and renamed, so that other processes never see an incomplete snapshot
+		g_file_set_contents(snapshot_file.c_str(), out.data(), out.length(), NULL);
+	}
+	return doc;
+}
+
+void Calculator::setDefinitionsCacheEnabled(bool enable) {
+	priv->definitions_cache = enable;
+}
+bool Calculator::definitionsCacheEnabled() const {
+	return priv->definitions_cache;
+}
+
+bool function_definition_element(xmlNodePtr node) {
+	return !xmlStrcmp(node->name, (const xmlChar*) "expression") || !xmlStrcmp(node->name, (const xmlChar*) "condition") || !xmlStrcmp(node->name, (const xmlChar*) "subfunction") || !xmlStrcmp(node->name, (const xmlChar*) "argument");
+}
+
+// Reads the formula, condition, a subfunction or an argument definition of a function. Returns false if child is not one of these elements.
+bool read_function_definition_element(MathFunction *f, xmlDocPtr doc, xmlNodePtr child, const string &locale, const string &localebase, int fulfilled_translation) {
+	xmlNodePtr child2;
+	xmlChar *value, *lang;
+	string type, stmp, argname;
+	bool b, best_argname, next_best_argname;
+	int prec, itmp;
+	Number nr;
+	Argument *arg;
+	IntegerArgument *iarg;
+	NumberArgument *farg;
+	if(!xmlStrcmp(child->name, (const xmlChar*) "expression")) {
+		XML_DO_FROM_TEXT(child, ((UserFunction*) f)->setFormula);
+		XML_GET_PREC_FROM_PROP(child, prec)
+		f->setPrecision(prec);
+		XML_GET_APPROX_FROM_PROP(child, b)
+		f->setApproximate(b);
+	} else if(!xmlStrcmp(child->name, (const xmlChar*) "condition")) {
+		XML_DO_FROM_TEXT(child, f->setCondition);
+	} else if(!xmlStrcmp(child->name, (const xmlChar*) "subfunction")) {
+		XML_GET_FALSE_FROM_PROP(child, "precalculate", b);
+		value = xmlNodeListGetString(doc, child->xmlChildrenNode, 1); 
+		if(value) ((UserFunction*) f)->addSubfunction((char*) value, b); 
+		else ((UserFunction*) f)->addSubfunction("", true); 
+		if(value) xmlFree(value);
+	} else if(!xmlStrcmp(child->name, (const xmlChar*) "argument")) {
+		farg = NULL; iarg = NULL;
+		XML_GET_STRING_FROM_PROP(child, "type", type);
+		if(type == "text") {
+			arg = new TextArgument();
+		} else if(type == "symbol") {
+			arg = new SymbolicArgument();
+		} else if(type == "date") {
+			arg = new DateArgument();
+		} else if(type == "integer") {
+			iarg = new IntegerArgument();
+			arg = iarg;
+		} else if(type == "number") {
+			farg = new NumberArgument();
+			arg = farg;
+		} else if(type == "vector") {
+			arg = new VectorArgument();
+		} else if(type == "matrix") {
+			arg = new MatrixArgument();
+		} else if(type == "boolean") {
+			arg = new BooleanArgument();
+		} else if(type == "function") {
+			arg = new FunctionArgument();
+		} else if(type == "unit") {
+			arg = new UnitArgument();
+		} else if(type == "variable") {
+			arg = new VariableArgument();
+		} else if(type == "object") {
+			arg = new ExpressionItemArgument();
+		} else if(type == "angle") {
+			arg = new AngleArgument();
+		} else if(type == "data-object") {
+			arg = new DataObjectArgument(NULL, "");
+		} else if(type == "data-property") {
+			arg = new DataPropertyArgument(NULL, "");
+		} else {
+			arg = new Argument();
+		}
+		child2 = child->xmlChildrenNode;
+		argname = ""; best_argname = false; next_best_argname = false;
+		while(child2 != NULL) {
+			if(!xmlStrcmp(child2->name, (const xmlChar*) "title")) {
+				XML_GET_LOCALE_STRING_FROM_TEXT(child2, argname, best_argname, next_best_argname)
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "min")) {
+				if(farg) {
+					XML_DO_FROM_TEXT(child2, nr.set);
+					farg->setMin(&nr);
+					XML_GET_FALSE_FROM_PROP(child, "include_equals", b)
+					farg->setIncludeEqualsMin(b);
+				} else if(iarg) {
+					XML_GET_STRING_FROM_TEXT(child2, stmp);
+					Number integ(stmp);
+					iarg->setMin(&integ);
+				}
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "max")) {
+				if(farg) {
+					XML_DO_FROM_TEXT(child2, nr.set);
+					farg->setMax(&nr);
+					XML_GET_FALSE_FROM_PROP(child, "include_equals", b)
+					farg->setIncludeEqualsMax(b);
+				} else if(iarg) {
+					XML_GET_STRING_FROM_TEXT(child2, stmp);
+					Number integ(stmp);
+					iarg->setMax(&integ);
+				}
+			} else if(farg && !xmlStrcmp(child2->name, (const xmlChar*) "complex_allowed")) {
+				XML_GET_FALSE_FROM_TEXT(child2, b);
+				farg->setComplexAllowed(b);
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "condition")) {
+				XML_DO_FROM_TEXT(child2, arg->setCustomCondition);	
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "matrix_allowed")) {
+				XML_GET_TRUE_FROM_TEXT(child2, b);
+				arg->setMatrixAllowed(b);
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "zero_forbidden")) {
+				XML_GET_TRUE_FROM_TEXT(child2, b);
+				arg->setZeroForbidden(b);
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "test")) {
+				XML_GET_FALSE_FROM_TEXT(child2, b);
+				arg->setTests(b);
+			} else if(!xmlStrcmp(child2->name, (const xmlChar*) "alert")) {
+				XML_GET_FALSE_FROM_TEXT(child2, b);
+				arg->setAlerts(b);
+			}
+			child2 = child2->next;
+		}
+		if(!argname.empty() && argname[0] == '!') {
+			size_t i = argname.find('!', 1);
+			if(i == string::npos) {
+				arg->setName(argname);
+			} else if(i + 1 < argname.length()) {
+				arg->setName(argname.substr(i + 1, argname.length() - (i + 1)));
+			}
+		} else {
+			arg->setName(argname);
+		}
+		itmp = 1;
+		XML_GET_INT_FROM_PROP(child, "index", itmp);
+		f->setArgumentDefinition(itmp, arg);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool Calculator::loadFunctionDefinition(MathFunction *f, const string &definition) {
+	xmlDocPtr doc = xmlReadMemory(definition.c_str(), definition.length(), NULL, NULL, 0);
+	if(!doc) return false;
+	xmlNodePtr cur = xmlDocGetRootElement(doc);
+	if(cur) {
+		for(xmlNodePtr child = cur->xmlChildrenNode; child != NULL; child = child->next) {
+			read_function_definition_element(f, doc, child, priv->deferred_locale, priv->deferred_localebase, priv->deferred_fulfilled_translation);
+		}
+	}
+	xmlFreeDoc(doc);
+	return true;
+}
+void Calculator::setLazyDefinitionsEnabled(bool enable) {
+	priv->lazy_definitions = enable;
+}
+bool Calculator::lazyDefinitionsEnabled() const {
+	return priv->lazy_definitions;
+}
+
 int Calculator::loadDefinitions(const char* file_name, bool is_user_defs) {
 
 	xmlDocPtr doc;
@@ -6483,7 +7445,8 @@ int Calculator::loadDefinitions(const char* file_name, bool is_user_defs) {
 	xmlChar *value, *lang, *value2;
 	int in_unfinished = 0;
 	bool done_something = false;
-	doc = xmlParseFile(file_name);
+	if(!is_user_defs && priv->definitions_cache) doc = load_definitions_document(file_name, locale, localebase);
+	else doc = xmlParseFile(file_name);
 	if(doc == NULL) {
 		return false;
 	}
@@ -6511,6 +7474,15 @@ int Calculator::loadDefinitions(const char* file_name, bool is_user_defs) {
 	
 	ParseOptions po;
 
+	// the definitions of global functions are saved as xml and loaded when first needed
+	xmlBufferPtr deferred_buffer = NULL;
+	if(!is_user_defs && priv->lazy_definitions) {
+		deferred_buffer = xmlBufferCreate();
+		priv->deferred_locale = locale;
+		priv->deferred_localebase = localebase;
+		priv->deferred_fulfilled_translation = fulfilled_translation;
+	}
+
 	vector<xmlNodePtr> unfinished_nodes;
 	vector<string> unfinished_cats;
 	queue<xmlNodePtr> sub_items;
@@ -6580,118 +7552,18 @@ int Calculator::loadDefinitions(const char* file_name, bool is_user_defs) {
 				ITEM_INIT_DTH
 				ITEM_INIT_NAME
 				while(child != NULL) {
-					if(!xmlStrcmp(child->name, (const xmlChar*) "expression")) {
-						XML_DO_FROM_TEXT(child, ((UserFunction*) f)->setFormula);
-						XML_GET_PREC_FROM_PROP(child, prec)
-						f->setPrecision(prec);
-						XML_GET_APPROX_FROM_PROP(child, b)
-						f->setApproximate(b);
-					} else if(!xmlStrcmp(child->name, (const xmlChar*) "condition")) {
-						XML_DO_FROM_TEXT(child, f->setCondition);
-					} else if(!xmlStrcmp(child->name, (const xmlChar*) "subfunction")) {
-						XML_GET_FALSE_FROM_PROP(child, "precalculate", b);
-						value = xmlNodeListGetString(doc, child->xmlChildrenNode, 1); 
-						if(value) ((UserFunction*) f)->addSubfunction((char*) value, b); 
-						else ((UserFunction*) f)->addSubfunction("", true); 
-						if(value) xmlFree(value);
-					} else if(!xmlStrcmp(child->name, (const xmlChar*) "argument")) {
-						farg = NULL; iarg = NULL;
-						XML_GET_STRING_FROM_PROP(child, "type", type);
-						if(type == "text") {
-							arg = new TextArgument();
-						} else if(type == "symbol") {
-							arg = new SymbolicArgument();
-						} else if(type == "date") {
-							arg = new DateArgument();
-						} else if(type == "integer") {
-							iarg = new IntegerArgument();
-							arg = iarg;
-						} else if(type == "number") {
-							farg = new NumberArgument();
-							arg = farg;
-						} else if(type == "vector") {
-							arg = new VectorArgument();
-						} else if(type == "matrix") {
-							arg = new MatrixArgument();
-						} else if(type == "boolean") {
-							arg = new BooleanArgument();
-						} else if(type == "function") {
-							arg = new FunctionArgument();
-						} else if(type == "unit") {
-							arg = new UnitArgument();
-						} else if(type == "variable") {
-							arg = new VariableArgument();
-						} else if(type == "object") {
-							arg = new ExpressionItemArgument();
-						} else if(type == "angle") {
-							arg = new AngleArgument();
-						} else if(type == "data-object") {
-							arg = new DataObjectArgument(NULL, "");
-						} else if(type == "data-property") {
-							arg = new DataPropertyArgument(NULL, "");
-						} else {
-							arg = new Argument();
-						}
-						child2 = child->xmlChildrenNode;
-						argname = ""; best_argname = false; next_best_argname = false;
-						while(child2 != NULL) {
-							if(!xmlStrcmp(child2->name, (const xmlChar*) "title")) {
-								XML_GET_LOCALE_STRING_FROM_TEXT(child2, argname, best_argname, next_best_argname)
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "min")) {
-								if(farg) {
-									XML_DO_FROM_TEXT(child2, nr.set);
-									farg->setMin(&nr);
-									XML_GET_FALSE_FROM_PROP(child, "include_equals", b)
-									farg->setIncludeEqualsMin(b);
-								} else if(iarg) {
-									XML_GET_STRING_FROM_TEXT(child2, stmp);
-									Number integ(stmp);
-									iarg->setMin(&integ);
-								}
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "max")) {
-								if(farg) {
-									XML_DO_FROM_TEXT(child2, nr.set);
-									farg->setMax(&nr);
-									XML_GET_FALSE_FROM_PROP(child, "include_equals", b)
-									farg->setIncludeEqualsMax(b);
-								} else if(iarg) {
-									XML_GET_STRING_FROM_TEXT(child2, stmp);
-									Number integ(stmp);
-									iarg->setMax(&integ);
-								}
-							} else if(farg && !xmlStrcmp(child2->name, (const xmlChar*) "complex_allowed")) {
-								XML_GET_FALSE_FROM_TEXT(child2, b);
-								farg->setComplexAllowed(b);
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "condition")) {
-								XML_DO_FROM_TEXT(child2, arg->setCustomCondition);	
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "matrix_allowed")) {
-								XML_GET_TRUE_FROM_TEXT(child2, b);
-								arg->setMatrixAllowed(b);
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "zero_forbidden")) {
-								XML_GET_TRUE_FROM_TEXT(child2, b);
-								arg->setZeroForbidden(b);
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "test")) {
-								XML_GET_FALSE_FROM_TEXT(child2, b);
-								arg->setTests(b);
-							} else if(!xmlStrcmp(child2->name, (const xmlChar*) "alert")) {
-								XML_GET_FALSE_FROM_TEXT(child2, b);
-								arg->setAlerts(b);
-							}
-							child2 = child2->next;
-						}
-						if(!argname.empty() && argname[0] == '!') {
-							size_t i = argname.find('!', 1);
-							if(i == string::npos) {
-								arg->setName(argname);
-							} else if(i + 1 < argname.length()) {
-								arg->setName(argname.substr(i + 1, argname.length() - (i + 1)));
+					if(function_definition_element(child)) {
+						if(deferred_buffer) {
+							xmlNodeDump(deferred_buffer, doc, child, 0, 0);
+							if(!xmlStrcmp(child->name, (const xmlChar*) "expression")) {
+								XML_GET_PREC_FROM_PROP(child, prec)
+								f->setPrecision(prec);
+								XML_GET_APPROX_FROM_PROP(child, b)
+								f->setApproximate(b);
 							}
 						} else {
-							arg->setName(argname);
+							read_function_definition_element(f, doc, child, locale, localebase, fulfilled_translation);
 						}
-						itmp = 1;
-						XML_GET_INT_FROM_PROP(child, "index", itmp);
-						f->setArgumentDefinition(itmp, arg); 
 					} else ITEM_READ_NAME(functionNameIsValid)
 					 else ITEM_READ_DTH
 					 else {
@@ -6712,9 +7584,16 @@ int Calculator::loadDefinitions(const char* file_name, bool is_user_defs) {
 					f->destroy();
 					f = NULL;
 				} else {
+					if(deferred_buffer && xmlBufferLength(deferred_buffer) > 0) {
+						string definition = "<function>";
+						definition += (const char*) xmlBufferContent(deferred_buffer);
+						definition += "</function>";
+						f->setDeferredDefinition(definition);
+					}
 					f->setChanged(false);
 					addFunction(f, true, is_user_defs);
 				}
+				if(deferred_buffer) xmlBufferEmpty(deferred_buffer);
 			} else if(!xmlStrcmp(cur->name, (const xmlChar*) "dataset") || !xmlStrcmp(cur->name, (const xmlChar*) "builtin_dataset")) {
 				bool builtin = !xmlStrcmp(cur->name, (const xmlChar*) "builtin_dataset");
 				XML_GET_FALSE_FROM_PROP(cur, "active", active)
@@ -7740,6 +8619,7 @@ int Calculator::loadDefinitions(const char* file_name, bool is_user_defs) {
 			break;
 		} 
 	}
+	if(deferred_buffer) xmlBufferFree(deferred_buffer);
 	xmlFreeDoc(doc);
 	return true;
 }
@@ -8613,85 +9493,262 @@ int Calculator::saveDataSets(const char* file_name, bool save_global) {
 	return returnvalue;
 }
 
-bool Calculator::importCSV(MathStructure &mstruct, const char *file_name, int first_row, string delimiter, vector<string> *headers) {
-	FILE *file = fopen(file_name, "r");
-	if(file == NULL) {
-		return false;
+// Reads rows of delimiter-separated values. The file is mapped into memory when possible.
+class CSVReader {
+  protected:
+	const char *data;
+	size_t len, pos;
+	string buffer;
+#ifndef _WIN32
+	void *map;
+	size_t map_len;
+#endif
+  public:
+	CSVReader() : data(NULL), len(0), pos(0) {
+#ifndef _WIN32
+		map = NULL;
+		map_len = 0;
+#endif
 	}
-	if(first_row < 1) {
-		first_row = 1;
+	~CSVReader() {
+#ifndef _WIN32
+		if(map) munmap(map, map_len);
+#endif
 	}
-	char line[10000];
-	string stmp, str1, str2;
-	int row = 0, rows = 1;
-	int columns = 1;
-	int column;
-	mstruct = m_empty_matrix;
-	size_t is, is_n;
-	bool v_added = false;
-	while(fgets(line, 10000, file)) {
-		row++;
-		if(row >= first_row) {	
-			stmp = line;
-			remove_blank_ends(stmp);
-			if(row == first_row) {
-				if(stmp.empty()) {
-					row--;
-				} else {
-					is = 0;
-					while((is_n = stmp.find(delimiter, is)) != string::npos) {		
-						columns++;
-						if(headers) {
-							str1 = stmp.substr(is, is_n - is);
-							remove_blank_ends(str1);
-							headers->push_back(str1);
-						}
-						is = is_n + delimiter.length();
-					}
-					if(headers) {
-						str1 = stmp.substr(is, stmp.length() - is);
-						remove_blank_ends(str1);
-						headers->push_back(str1);
-					}
-					mstruct.resizeMatrix(1, columns, m_undefined);
-				}
+	bool open(const char *file_name) {
+#ifndef _WIN32
+		int fd = ::open(file_name, O_RDONLY);
+		if(fd < 0) return false;
+		struct stat st;
+		if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(p != MAP_FAILED) {
+#	ifdef MADV_SEQUENTIAL
+				madvise(p, st.st_size, MADV_SEQUENTIAL);
+#	endif
+				map = p;
+				map_len = st.st_size;
+				data = (const char*) p;
+				len = map_len;
+				::close(fd);
+				return true;
 			}
-			if((!headers || row > first_row) && !stmp.empty()) {
-				is = 0;
-				column = 1;
-				if(v_added) {
-					mstruct.addRow(m_undefined);
-					rows++;
+		}
+		::close(fd);
+#endif
+		// not a regular file, or mapping failed
+		FILE *file = fopen(file_name, "rb");
+		if(!file) return false;
+		char tmp[65536];
+		size_t n;
+		while((n = fread(tmp, 1, sizeof(tmp), file)) > 0) buffer.append(tmp, n);
+		fclose(file);
+		data = buffer.data();
+		len = buffer.length();
+		return true;
+	}
+	size_t size() const {return len;}
+	size_t position() const {return pos;}
+	size_t lineCount() const {
+		size_t n = 0;
+		const char *p = data, *end = data + len;
+		while(p < end && (p = (const char*) memchr(p, '\n', end - p)) != NULL) {
+			n++;
+			p++;
+		}
+		return n + 1;
+	}
+	bool blanksToLineEnd(size_t p) const {
+		while(p < len && (data[p] == ' ' || data[p] == '\t')) p++;
+		return p >= len || data[p] == '\n' || data[p] == '\r';
+	}
+	// Reads the fields of the next row (which may span several lines if a quoted field contains line breaks). Returns false at the end of the file.
+	bool readRow(vector<string> &fields, vector<bool> &quoted, const string &delimiter) {
+		fields.clear();
+		quoted.clear();
+		if(pos >= len) return false;
+		string field;
+		bool in_quotes = false, was_quoted = false;
+		char delim_c = (delimiter.empty() ? '\n' : delimiter[0]);
+		while(pos < len) {
+			char c = data[pos];
+			if(in_quotes) {
+				const char *q = (const char*) memchr(data + pos, '\"', len - pos);
+				if(!q) {
+					field.append(data + pos, len - pos);
+					pos = len;
+					break;
 				}
-				while(column <= columns) {
-					is_n = stmp.find(delimiter, is);
-					if(is_n == string::npos) {
-						str1 = stmp.substr(is, stmp.length() - is);
-					} else {
-						str1 = stmp.substr(is, is_n - is);
-						is = is_n + delimiter.length();
-					}
-					CALCULATOR->parse(&mstruct[rows - 1][column - 1], str1);
-					column++;
-					if(is_n == string::npos) {
-						break;
-					}
+				field.append(data + pos, q - (data + pos));
+				pos = q - data + 1;
+				if(pos < len && data[pos] == '\"') {
+					field += '\"';
+					pos++;
+				} else {
+					in_quotes = false;
 				}
-				v_added = true;
+			} else if(c == '\n' || c == '\r') {
+				pos++;
+				if(c == '\r' && pos < len && data[pos] == '\n') pos++;
+				break;
+			} else if((c == ' ' || c == '\t') && blanksToLineEnd(pos)) {
+				// trailing blanks are ignored, also when the delimiter is a blank character
+				while(pos < len && (data[pos] == ' ' || data[pos] == '\t')) pos++;
+			} else if(c == delim_c && len - pos >= delimiter.length() && delimiter.compare(0, delimiter.length(), data + pos, delimiter.length()) == 0) {
+				if(!was_quoted) remove_blank_ends(field);
+				fields.push_back(field);
+				quoted.push_back(was_quoted);
+				field.clear();
+				was_quoted = false;
+				pos += delimiter.length();
+			} else if(c == '\"' && !was_quoted && field.find_first_not_of(SPACES) == string::npos) {
+				in_quotes = true;
+				was_quoted = true;
+				field.clear();
+				pos++;
+			} else {
+				// copy up to the next character that needs attention
+				size_t pos2 = pos + 1;
+				while(pos2 < len && data[pos2] != '\n' && data[pos2] != '\r' && data[pos2] != delim_c && data[pos2] != '\"') pos2++;
+				field.append(data + pos, pos2 - pos);
+				pos = pos2;
 			}
 		}
+		if(!was_quoted) remove_blank_ends(field);
+		fields.push_back(field);
+		quoted.push_back(was_quoted);
+		return true;
+	}
+};
+
+// Reads a plain decimal number (e.g. -12, 3.25, 1.5E-3) without the expression parser
+bool read_csv_number(const string &str, Number &nr) {
+	size_t i = 0, n = str.length();
+	if(n == 0) return false;
+	bool neg = false;
+	if(str[i] == '-' || str[i] == '+') {
+		neg = (str[i] == '-');
+		i++;
 	}
+	long int mantissa = 0;
+	int digits = 0, decimals = 0;
+	bool has_digits = false, has_point = false;
+	for(; i < n; i++) {
+		char c = str[i];
+		if(c >= '0' && c <= '9') {
+			has_digits = true;
+			if(has_point) decimals++;
+			if(digits > 0 || c != '0') digits++;
+			if(digits <= 9) mantissa = mantissa * 10 + (c - '0');
+		} else if(c == '.' && !has_point) {
+			has_point = true;
+		} else {
+			break;
+		}
+	}
+	if(!has_digits) return false;
+	size_t mantissa_end = i;
+	long int exp10 = 0;
+	if(i < n && (str[i] == 'e' || str[i] == 'E')) {
+		i++;
+		bool exp_neg = false;
+		if(i < n && (str[i] == '-' || str[i] == '+')) {
+			exp_neg = (str[i] == '-');
+			i++;
+		}
+		if(i == n) return false;
+		for(; i < n; i++) {
+			if(str[i] < '0' || str[i] > '9' || exp10 > 100000) return false;
+			exp10 = exp10 * 10 + (str[i] - '0');
+		}
+		if(exp_neg) exp10 = -exp10;
+	}
+	if(i < n) return false;
+	if(digits > 9) {
+		// too many digits for a long int: the digits are read as an integer, and scaled by the exponent and the number of decimals
+		string sdigits;
+		for(size_t i2 = 0; i2 < mantissa_end; i2++) {
+			if(str[i2] >= '0' && str[i2] <= '9') sdigits += str[i2];
+		}
+		nr.set(sdigits);
+		if(exp10 != decimals) nr.exp10(Number((int) (exp10 - decimals), 1));
+		if(neg) nr.negate();
+		return true;
+	}
+	nr.set((int) (neg ? -mantissa : mantissa), 1, (int) (exp10 - decimals));
 	return true;
 }
 
-bool Calculator::importCSV(const char *file_name, int first_row, bool headers, string delimiter, bool to_matrix, string name, string title, string category) {
-	FILE *file = fopen(file_name, "r");
-	if(file == NULL) {
+// rows between progress reports and checks for abort
+#define CSV_PROGRESS_INTERVAL 1000
+
+bool Calculator::importCSV(MathStructure &mstruct, const char *file_name, int first_row, string delimiter, vector<string> *headers, ProgressFunction progress, void *progress_data) {
+	CSVReader reader;
+	if(!reader.open(file_name)) {
 		return false;
 	}
 	if(first_row < 1) {
 		first_row = 1;
 	}
+	vector<string> fields;
+	vector<bool> quoted;
+	int row = 0;
+	size_t columns = 0, rows = 0;
+	Number nr;
+	mstruct.clearMatrix();
+	// the number of lines is an upper limit of the number of rows
+	mstruct.reserveChildren(reader.lineCount());
+	while(reader.readRow(fields, quoted, delimiter)) {
+		row++;
+		if(row < first_row) continue;
+		bool empty = (fields.size() == 1 && fields[0].empty() && !quoted[0]);
+		if(columns == 0) {
+			if(empty) {
+				row--;
+				continue;
+			}
+			columns = fields.size();
+			if(headers) {
+				for(size_t i = 0; i < fields.size(); i++) headers->push_back(fields[i]);
+				continue;
+			}
+		}
+		if(empty) continue;
+		MathStructure *mrow = new MathStructure();
+		mrow->clearVector();
+		mrow->reserveChildren(columns);
+		for(size_t i = 0; i < columns; i++) {
+			if(i >= fields.size()) {
+				mrow->addChild(m_undefined);
+			} else if(read_csv_number(fields[i], nr)) {
+				mrow->addChild_nocopy(new MathStructure(nr));
+			} else if(quoted[i]) {
+				mrow->addChild_nocopy(new MathStructure(fields[i]));
+			} else {
+				MathStructure *mcell = new MathStructure();
+				parse(mcell, fields[i]);
+				mrow->addChild_nocopy(mcell);
+			}
+		}
+		mstruct.addChild_nocopy(mrow);
+		rows++;
+		if(rows % CSV_PROGRESS_INTERVAL == 0) {
+			if(aborted() || (progress && !progress(reader.position(), reader.size(), progress_data))) {
+				mstruct = m_empty_matrix;
+				return false;
+			}
+		}
+	}
+	if(progress) progress(reader.size(), reader.size(), progress_data);
+	return true;
+}
+
+bool Calculator::importCSV(const char *file_name, int first_row, bool headers, string delimiter, bool to_matrix, string name, string title, string category, ProgressFunction progress, void *progress_data) {
+	vector<string> header;
+	MathStructure mstruct;
+	if(!importCSV(mstruct, file_name, first_row, delimiter, headers ? &header : NULL, progress, progress_data)) {
+		return false;
+	}
 	string filestr = file_name;
 	size_t i = filestr.find_last_of("/");
 	if(i != string::npos) {
@@ -8701,90 +9758,23 @@ bool Calculator::importCSV(const char *file_name, int first_row, bool headers, s
 		i = filestr.find_last_of(".");
 		name = filestr.substr(0, i);
 	}
-	char line[10000];
-	string stmp, str1, str2;
-	int row = 0;
-	int columns = 1, rows = 1;
-	int column;
-	vector<string> header;
-	vector<MathStructure> vectors;
-	MathStructure mstruct = m_empty_matrix;
-	size_t is, is_n;
-	bool v_added = false;
-	while(fgets(line, 10000, file)) {
-		row++;
-		if(row >= first_row) {	
-			stmp = line;
-			remove_blank_ends(stmp);
-			if(row == first_row) {
-				if(stmp.empty()) {
-					row--;
-				} else {
-					is = 0;
-					while((is_n = stmp.find(delimiter, is)) != string::npos) {		
-						columns++;
-						if(headers) {
-							str1 = stmp.substr(is, is_n - is);
-							remove_blank_ends(str1);
-							header.push_back(str1);
-						}
-						if(!to_matrix) {
-							vectors.push_back(m_empty_vector);
-						}
-						is = is_n + delimiter.length();
-					}
-					if(headers) {
-						str1 = stmp.substr(is, stmp.length() - is);
-						remove_blank_ends(str1);
-						header.push_back(str1);
-					}
-					if(to_matrix) {
-						mstruct.resizeMatrix(1, columns, m_undefined);
-					} else {
-						vectors.push_back(m_empty_vector);
-					}
-				}
-			}
-			if((!headers || row > first_row) && !stmp.empty()) {
-				if(to_matrix && v_added) {
-					mstruct.addRow(m_undefined);
-					rows++;
-				}
-				is = 0;
-				column = 1;
-				while(column <= columns) {
-					is_n = stmp.find(delimiter, is);
-					if(is_n == string::npos) {
-						str1 = stmp.substr(is, stmp.length() - is);
-					} else {
-						str1 = stmp.substr(is, is_n - is);
-						is = is_n + delimiter.length();
-					}
-					if(to_matrix) {
-						CALCULATOR->parse(&mstruct[rows - 1][column - 1], str1);
-					} else {
-						vectors[column - 1].addChild(CALCULATOR->parse(str1));
-					}
-					column++;
-					if(is_n == string::npos) {
-						break;
-					}
-				}
-				for(; column <= columns; column++) {
-					if(!to_matrix) {
-						vectors[column - 1].addChild(m_undefined);
-					}				
-				}
-				v_added = true;
-			}
-		}
-	}
+	string str1, str2;
 	if(to_matrix) {
 		addVariable(new KnownVariable(category, name, mstruct, title));
 	} else {
+		size_t columns = (mstruct.size() > 0 ? mstruct[0].size() : header.size());
+		vector<MathStructure> vectors(columns, m_empty_vector);
+		for(size_t c = 0; c < columns; c++) {
+			vectors[c].reserveChildren(mstruct.size());
+			for(size_t r = 0; r < mstruct.size(); r++) {
+				// share the cells of the matrix
+				mstruct[r][c].ref();
+				vectors[c].addChild_nocopy(&mstruct[r][c]);
+			}
+		}
 		if(vectors.size() > 1) {
 			if(!category.empty()) {
-				category += "/";	
+				category += "/";
 			}
 			category += name;
 		}
@@ -8800,7 +9790,7 @@ bool Calculator::importCSV(const char *file_name, int first_row, bool headers, s
 				} else {
 					str2 += title;
 					str2 += " ";
-				}		
+				}
 				if(i < header.size()) {
 					str1 += header[i];
 					str2 += header[i];
@@ -8809,9 +9799,9 @@ bool Calculator::importCSV(const char *file_name, int first_row, bool headers, s
 					str1 += "_";
 					str1 += i2s(i + 1);
 					str2 += _("Column ");
-					str2 += i2s(i + 1);				
+					str2 += i2s(i + 1);
 				}
-				gsub(" ", "_", str1);				
+				gsub(" ", "_", str1);
 			} else {
 				str1 = name;
 				str2 = title;
@@ -8826,39 +9816,170 @@ bool Calculator::importCSV(const char *file_name, int first_row, bool headers, s
 	}
 	return true;
 }
-bool Calculator::exportCSV(const MathStructure &mstruct, const char *file_name, string delimiter) {
+// Prints a number for CSV export without format() and print(). Returns false if the number needs the full formatting.
+bool print_csv_number(const Number &nr, CSVNumberFormat number_format, int precision, char *buffer, size_t buffer_size, string &str) {
+	switch(number_format) {
+		case CSV_NUMBER_FORMAT_EXACT: {
+			if(!nr.isRational()) return false;
+			bool overflow = false;
+			if(nr.isInteger()) {
+				int i = nr.intValue(&overflow);
+				if(!overflow) {
+					snprintf(buffer, buffer_size, "%i", i);
+					str = buffer;
+				} else {
+					str = nr.printNumerator();
+				}
+			} else {
+				str = nr.printNumerator();
+				str += "/";
+				str += nr.printDenominator();
+			}
+			return true;
+		}
+		case CSV_NUMBER_FORMAT_DECIMAL: {
+			if(!nr.isReal() || precision > DBL_DIG) return false;
+			double d = nr.floatValue();
+			if(!std::isfinite(d) || (d == 0.0 && !nr.isZero())) return false;
+			snprintf(buffer, buffer_size, "%.*G", precision, d);
+			str = buffer;
+			return true;
+		}
+		case CSV_NUMBER_FORMAT_DEFAULT: {
+			// small exact integers are printed the same way by print()
+			if(nr.isApproximate() || !nr.isInteger()) return false;
+			bool overflow = false;
+			int i = nr.intValue(&overflow);
+			if(overflow) return false;
+			// print() uses exponential notation for integers with more digits than the precision
+			int digits = 1;
+			for(int i2 = i / 10; i2 != 0; i2 /= 10) digits++;
+			if(digits > PRECISION) return false;
+			snprintf(buffer, buffer_size, "%i", i);
+			str = buffer;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Calculator::exportCSV(const MathStructure &mstruct, const char *file_name, string delimiter, CSVNumberFormat number_format, int precision) {
 	FILE *file = fopen(file_name, "w+");
 	if(file == NULL) {
 		return false;
 	}
-	MathStructure mcsv(mstruct);
+	setvbuf(file, NULL, _IOFBF, 65536);
+	if(precision < 1) precision = PRECISION;
+	// numbers which cannot be printed with machine doubles are formatted using the requested precision
+	int precision_was = PRECISION;
+	if(number_format == CSV_NUMBER_FORMAT_DECIMAL && precision != precision_was) setPrecision(precision);
 	PrintOptions po;
 	po.number_fraction_format = FRACTION_DECIMAL;
 	po.decimalpoint_sign = ".";
 	po.comma_sign = ",";
-	if(mcsv.isMatrix()) {
-		for(size_t i = 0; i < mcsv.size(); i++) {
-			for(size_t i2 = 0; i2 < mcsv[i].size(); i2++) {
-				if(i2 > 0) fputs(delimiter.c_str(), file);
-				mcsv[i][i2].format(po);
-				fputs(mcsv[i][i2].print(po).c_str(), file);
-			}
-			fputs("\n", file);
-		}
-	} else if(mcsv.isVector()) {
-		for(size_t i = 0; i < mcsv.size(); i++) {
-			mcsv[i].format(po);
-			fputs(mcsv[i].print(po).c_str(), file);
-			fputs("\n", file);
+	char buffer[64];
+	string str;
+	size_t rows = 1, columns = 1;
+	if(mstruct.isMatrix()) {
+		rows = mstruct.size();
+		columns = (rows > 0 ? mstruct[0].size() : 0);
+	} else if(mstruct.isVector()) {
+		rows = mstruct.size();
+	}
+	for(size_t r = 0; r < rows; r++) {
+		for(size_t c = 0; c < columns; c++) {
+			const MathStructure *m;
+			if(mstruct.isMatrix()) m = &mstruct[r][c];
+			else if(mstruct.isVector()) m = &mstruct[r];
+			else m = &mstruct;
+			if(c > 0) fwrite(delimiter.c_str(), 1, delimiter.length(), file);
+			if(!m->isNumber() || !print_csv_number(m->number(), number_format, precision, buffer, sizeof(buffer), str)) {
+				MathStructure mcell(*m);
+				mcell.format(po);
+				str = mcell.print(po);
+			}
+			fwrite(str.c_str(), 1, str.length(), file);
+		}
+		fputc('\n', file);
+		if(r % 1000 == 999 && aborted()) {
+			if(PRECISION != precision_was) setPrecision(precision_was);
+			fclose(file);
+			return false;
 		}
-	} else {
-		mcsv.format(po);
-		fputs(mcsv.print(po).c_str(), file);
-		fputs("\n", file);
 	}
-	fclose(file);
-	return true;
+	if(PRECISION != precision_was) setPrecision(precision_was);
+	return fclose(file) == 0;
 }
+struct BatchCalculation {
+	const vector<string> *expressions;
+	vector<MathStructure> *results;
+	vector<vector<CalculatorMessage> > *messages;
+	const EvaluationOptions *eo;
+	int msecs;
+	int precision;
+	volatile gint next_index;
+	volatile gint timed_out;
+};
+
+gpointer calculate_batch_items(gpointer data) {
+	BatchCalculation *batch = (BatchCalculation*) data;
+	CalculationContext context(batch->precision);
+	CalculationContext *context_was = CALCULATOR->calculationContext();
+	CALCULATOR->setCalculationContext(&context);
+	while(true) {
+		// items are handed out one at a time, so that threads that finish early take over remaining work
+		gint i = g_atomic_int_add(&batch->next_index, 1);
+		if(i < 0 || (size_t) i >= batch->expressions->size()) break;
+		CALCULATOR->startControl(batch->msecs);
+		(*batch->results)[i] = CALCULATOR->calculate((*batch->expressions)[i], *batch->eo);
+		if(CALCULATOR->aborted()) {
+			(*batch->results)[i].setAborted();
+			CALCULATOR->error(true, _("Calculation timed out."), NULL);
+			g_atomic_int_set(&batch->timed_out, 1);
+		}
+		CALCULATOR->stopControl();
+		CalculatorMessage *msg = CALCULATOR->message();
+		while(msg) {
+			if(batch->messages) (*batch->messages)[i].push_back(*msg);
+			msg = CALCULATOR->nextMessage();
+		}
+	}
+	CALCULATOR->setCalculationContext(context_was);
+	return NULL;
+}
+
+bool Calculator::calculateBatch(const vector<string> &expressions, vector<MathStructure> &results, const EvaluationOptions &eo, int threads, int msecs_per_item, vector<vector<CalculatorMessage> > *messages) {
+	results.clear();
+	results.resize(expressions.size());
+	if(messages) {
+		messages->clear();
+		messages->resize(expressions.size());
+	}
+	if(expressions.empty()) return true;
+	if(threads < 1) threads = g_get_num_processors();
+	if((size_t) threads > expressions.size()) threads = expressions.size();
+	BatchCalculation batch;
+	batch.expressions = &expressions;
+	batch.results = &results;
+	batch.messages = messages;
+	batch.eo = &eo;
+	batch.msecs = msecs_per_item;
+	batch.precision = getPrecision();
+	batch.next_index = 0;
+	batch.timed_out = 0;
+	vector<GThread*> workers;
+	for(int i = 1; i < threads; i++) {
+		GThread *thread = g_thread_try_new("calculate", calculate_batch_items, &batch, NULL);
+		if(!thread) break;
+		workers.push_back(thread);
+	}
+	calculate_batch_items(&batch);
+	for(size_t i = 0; i < workers.size(); i++) {
+		g_thread_join(workers[i]);
+	}
+	return g_atomic_int_get(&batch.timed_out) == 0;
+}
+
 int Calculator::testCondition(string expression) {
 	MathStructure mstruct = calculate(expression);
 	if(mstruct.isNumber()) {
@@ -8905,6 +10026,114 @@ string Calculator::printingAbortedMessage() const {
 string Calculator::timedOutString() const {
 	return _("timed out");
 }
+void Calculator::startControl(int milli_timeout) {
+	CalculationContext_p *ctx = priv->context();
+	ctx->b_controlled = true;
+	ctx->abort_recorded = false;
+	g_atomic_int_set(&ctx->i_aborted, 0);
+	ctx->i_timeout = milli_timeout;
+	if(ctx->i_timeout > 0) {
+		gettimeofday(&ctx->t_end, NULL);
+		long int usecs = ctx->t_end.tv_usec + (long int) milli_timeout * 1000;
+		ctx->t_end.tv_usec = usecs % 1000000;
+		ctx->t_end.tv_sec += usecs / 1000000;
+	}
+}
+void Calculator::stopControl() {
+	CalculationContext_p *ctx = priv->context();
+	ctx->b_controlled = false;
+	g_atomic_int_set(&ctx->i_aborted, 0);
+	ctx->i_timeout = 0;
+}
+bool Calculator::aborted(AbortLocation location) {
+	CalculationContext_p *ctx = priv->context();
+	if(!ctx->b_controlled) return false;
+	if(g_atomic_int_get(&ctx->i_aborted) <= 0) {
+		if(ctx->i_timeout <= 0) return false;
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		if(tv.tv_sec < ctx->t_end.tv_sec || (tv.tv_sec == ctx->t_end.tv_sec && tv.tv_usec <= ctx->t_end.tv_usec)) return false;
+		g_atomic_int_set(&ctx->i_aborted, 2);
+	}
+	if(!ctx->abort_recorded) {
+		ctx->abort_recorded = true;
+		g_atomic_int_inc(&abort_location_counts[location]);
+	}
+	return true;
+}
+size_t Calculator::abortCount(AbortLocation location) const {
+	return g_atomic_int_get(&abort_location_counts[location]);
+}
+void Calculator::resetAbortCounts() {
+	for(int i = 0; i <= ABORT_LOCATION_FORCED; i++) g_atomic_int_set(&abort_location_counts[i], 0);
+}
+
+void Calculator_p::beginProfileStage(EvaluationStage stage, MathFunction *f) {
+	CalculationContext_p *ctx = context();
+	if(stage == EVALUATION_STAGE_TOTAL && ctx->profile_stages[EVALUATION_STAGE_TOTAL].depth == 0) {
+		// a new calculation
+		for(size_t i = 0; i < ctx->profile_stages.size(); i++) ctx->profile_stages[i] = ProfileStage();
+		ctx->profile_functions.clear();
+	}
+	ProfileStage &ps = (f ? ctx->profile_functions[f] : ctx->profile_stages[stage]);
+	if(ps.depth == 0) {
+		ps.calls++;
+		ps.start = g_get_monotonic_time();
+		if(f && ps.name.empty()) ps.name = f->name();
+	}
+	ps.depth++;
+}
+void Calculator_p::endProfileStage(EvaluationStage stage, MathFunction *f) {
+	CalculationContext_p *ctx = context();
+	ProfileStage &ps = (f ? ctx->profile_functions[f] : ctx->profile_stages[stage]);
+	if(ps.depth == 0) return;
+	ps.depth--;
+	if(ps.depth == 0) ps.usecs += g_get_monotonic_time() - ps.start;
+}
+EvaluationStageTimer::EvaluationStageTimer(EvaluationStage stage_, MathFunction *f) : stage(stage_), function(f) {
+	b_active = CALCULATOR->priv->profiling;
+	if(b_active) CALCULATOR->priv->beginProfileStage(stage, function);
+}
+EvaluationStageTimer::~EvaluationStageTimer() {
+	if(b_active) CALCULATOR->priv->endProfileStage(stage, function);
+}
+void Calculator::setProfilingEnabled(bool enable) {
+	priv->profiling = enable;
+}
+bool Calculator::profilingEnabled() const {
+	return priv->profiling;
+}
+bool compare_profile_entries(const EvaluationProfileEntry &e1, const EvaluationProfileEntry &e2) {
+	return e1.seconds > e2.seconds;
+}
+vector<EvaluationProfileEntry> Calculator::lastEvaluationProfile() const {
+	CalculationContext_p *ctx = priv->context();
+	vector<EvaluationProfileEntry> entries;
+	for(size_t i = 0; i < ctx->profile_stages.size(); i++) {
+		if(i == EVALUATION_STAGE_FUNCTION) {
+			// functions, the slowest first
+			size_t i_first = entries.size();
+			for(map<MathFunction*, ProfileStage>::const_iterator it = ctx->profile_functions.begin(); it != ctx->profile_functions.end(); ++it) {
+				EvaluationProfileEntry entry;
+				entry.stage = EVALUATION_STAGE_FUNCTION;
+				entry.function = it->second.name;
+				entry.calls = it->second.calls;
+				entry.seconds = it->second.usecs / 1000000.0;
+				entries.push_back(entry);
+			}
+			sort(entries.begin() + i_first, entries.end(), compare_profile_entries);
+			continue;
+		}
+		const ProfileStage &ps = ctx->profile_stages[i];
+		if(ps.calls == 0) continue;
+		EvaluationProfileEntry entry;
+		entry.stage = (EvaluationStage) i;
+		entry.calls = ps.calls;
+		entry.seconds = ps.usecs / 1000000.0;
+		entries.push_back(entry);
+	}
+	return entries;
+}
 bool Calculator::printingControlled() {
 	return b_printing_controlled;
 }
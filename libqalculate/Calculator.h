@@ -190,6 +190,104 @@ struct Element {
 
 class Calculate_p;
 
+/// State of calculations in a thread.
+/**
+* A calculation context holds the state that is changed during parsing and evaluation of expressions: messages, precision and temporary storage of parsed values.
+* By default all calculations use the same context, owned by the calculator.
+* By activating a separate context in each thread, with Calculator::setCalculationContext(), expressions can be parsed and evaluated in several threads at the same time, using the same loaded definitions.
+*
+* Definitions (functions, variables, units and prefixes) must not be added, removed or changed, and the RPN stack must not be used, while other threads are calculating.
+* The default float format of CLN is set only by the precision of the default context.
+* CLN numbers are reference counted without synchronization, so values of variables and cached parse results are copied for each context, without shared numbers (see Calculator::setContextValue()).
+*
+* \code
+* CalculationContext context;
+* CALCULATOR->setCalculationContext(&context);
+* MathStructure result = CALCULATOR->calculate("1 + 1");
+* CALCULATOR->setCalculationContext(NULL);\endcode
+*/
+class CalculationContext {
+  protected:
+	class CalculationContext_p *priv;
+	friend class Calculator_p;
+  public:
+	/** Create a new calculation context.
+	*
+	* @param precision Precision for approximate calculations. If less than one, the precision of the current context is used.
+	*/
+	CalculationContext(int precision = -1);
+	~CalculationContext();
+	/** Set precision for approximate calculations in this context. */
+	void setPrecision(int precision = DEFAULT_PRECISION);
+	/** Returns precision for approximate calculations in this context. */
+	int getPrecision() const;
+	/** Set if floating point calculations in this context will use machine doubles (see Calculator::useHardwareFloat()). */
+	void useHardwareFloat(bool use_hardware_float = true);
+	/** Returns true if floating point calculations in this context will use machine doubles. */
+	bool usesHardwareFloat() const;
+};
+
+/// Handle of an asynchronous calculation.
+/**
+* Asynchronous calculations are queued and performed, one at a time, in the calculation thread of the calculator.
+* A handle is returned by Calculator::calculateAsync() and Calculator::lastCalculation() and can be used to poll or wait for the calculation to finish.
+* The handle is reference counted. Call unref() when it is no longer needed.
+*
+* \code
+* MathStructure result;
+* CalculationJob *job = CALCULATOR->calculateAsync(&result, "1 + 1");
+* if(!job->wait(2000)) CALCULATOR->abort();
+* job->unref();\endcode
+*/
+class CalculationJob {
+  protected:
+	class CalculationJob_p *priv;
+	friend class Calculator;
+	friend class Calculator_p;
+	friend class CalculateThread;
+	CalculationJob();
+	~CalculationJob();
+  public:
+	/** Waits for the calculation to finish.
+	*
+	* @param msecs The maximum time to wait in milliseconds. If msecs < 0 the time will be unlimited.
+	* @returns true if the calculation has finished (or was aborted).
+	*/
+	bool wait(int msecs = -1);
+	/** Returns true if the calculation has finished (or was aborted). Does not block. */
+	bool isFinished() const;
+	/** Returns true if the calculation was aborted. */
+	bool isAborted() const;
+	void ref();
+	void unref();
+};
+
+/// Reports progress of a long operation (e.g. import of a large file). Return false to cancel the operation.
+typedef bool (*ProgressFunction)(size_t done, size_t total, void *data);
+
+/// Wall time and number of calls of a stage of a calculation. See Calculator::lastEvaluationProfile().
+struct EvaluationProfileEntry {
+	/// Stage of the calculation
+	EvaluationStage stage;
+	/// Name of the function for EVALUATION_STAGE_FUNCTION, otherwise empty
+	string function;
+	/// Number of calls (nested calls of the same stage or function are not counted)
+	size_t calls;
+	/// Total wall time in seconds, including time spent in stages called from this stage
+	double seconds;
+};
+
+/// Records the time spent in a stage of a calculation, from construction to destruction, if profiling is enabled. Mainly for internal use.
+class EvaluationStageTimer {
+  protected:
+	EvaluationStage stage;
+	MathFunction *function;
+	bool b_active;
+  public:
+	EvaluationStageTimer(EvaluationStage stage_, MathFunction *f = NULL);
+	~EvaluationStageTimer();
+};
+
 /// The almighty calculator class.
 /** The calculator class is responsible for loading functions, variables and units, and keeping track of them, as well as parsing expressions and much more. A calculator object must be created before any other Qalculate! class is used. There should never be more than one calculator object, accessed with CALCULATOR. 
 *
@@ -203,16 +301,11 @@ class Calculator {
 
   protected:
 
-	vector<CalculatorMessage> messages;
-
 	int ianglemode;
-	int i_precision;
 	char vbuffer[200];
 	vector<void*> ufvl;
 	vector<char> ufvl_t;
 	vector<size_t> ufvl_i;
-	vector<void*> ufv[4][UFV_LENGTHS];
-	vector<size_t> ufv_i[4][UFV_LENGTHS];
 	
 	vector<DataSet*> data_sets;
 	
@@ -223,16 +316,11 @@ class Calculator {
 	vector<string> default_signs;	
 	vector<string> default_real_signs;	
 	char *saved_locale;
-	int disable_errors_ref;
-	vector<int> stopped_errors_count;
-	vector<int> stopped_warnings_count;
-	vector<int> stopped_messages_count;
 	Thread *calculate_thread;
 	bool b_functions_was, b_variables_was, b_units_was, b_unknown_was, b_calcvars_was, b_rpn_was;
 	string NAME_NUMBER_PRE_S, NAME_NUMBER_PRE_STR, DOT_STR, DOT_S, COMMA_S, COMMA_STR, ILLEGAL_IN_NAMES, ILLEGAL_IN_UNITNAMES, ILLEGAL_IN_NAMES_MINUS_SPACE_STR;
 
 	bool b_argument_errors;
-	int current_stage;
 
 	time_t exchange_rates_time, exchange_rates_check_time;
 	bool b_exchange_rates_used, b_exchange_rates_warning_enabled;
@@ -263,8 +351,14 @@ class Calculator {
 
 	vector<MathStructure*> rpn_stack;
 
+	friend class CalculateThread;
+	friend class EvaluationStageTimer;
+
 	bool calculateRPN(MathStructure *mstruct, int command, size_t index, int msecs, const EvaluationOptions &eo);
 	bool calculateRPN(string str, int command, size_t index, int msecs, const EvaluationOptions &eo, MathStructure *parsed_struct, MathStructure *to_struct, bool make_to_division);
+	void startJob(CalculationJob *job);
+	bool waitForJob(CalculationJob *job, int msecs);
+	void abortJob(CalculationJob *job);
 	
   public:
 
@@ -289,7 +383,7 @@ class Calculator {
 	MathFunction *f_ascii, *f_char;
 	MathFunction *f_length, *f_concatenate;
 	MathFunction *f_replace, *f_stripunits;
-	MathFunction *f_genvector, *f_for, *f_sum, *f_product, *f_process, *f_process_matrix, *f_csum, *f_if, *f_is_number, *f_is_real, *f_is_rational, *f_is_integer, *f_represents_number, *f_represents_real, *f_represents_rational, *f_represents_integer, *f_function, *f_select;
+	MathFunction *f_genvector, *f_for, *f_sum, *f_product, *f_process, *f_process_matrix, *f_csum, *f_if, *f_is_number, *f_is_real, *f_is_rational, *f_is_integer, *f_represents_number, *f_represents_real, *f_represents_rational, *f_represents_integer, *f_function, *f_select, *f_datacolumn, *f_dataselect;
 	MathFunction *f_diff, *f_integrate, *f_solve, *f_multisolve;
 	MathFunction *f_error, *f_warning, *f_message, *f_save, *f_load, *f_export, *f_title;
 	MathFunction *f_register, *f_stack;
@@ -304,16 +398,6 @@ class Calculator {
 	bool place_currency_code_before_negative, place_currency_sign_before_negative;
 	bool default_dot_as_separator;
   
-  	bool b_busy;
-	string expression_to_calculate;
-	EvaluationOptions tmp_evaluationoptions;
-	MathStructure *tmp_parsedstruct;
-	MathStructure *tmp_tostruct;
-	MathStructure *tmp_rpn_mstruct;
-	bool tmp_maketodivision;
-	int tmp_proc_command;
-	size_t tmp_rpnindex;
-	
 	PrintOptions save_printoptions;	
   
 	vector<Variable*> variables;
@@ -355,9 +439,75 @@ class Calculator {
 	* @returns The result of the calculation.
 	*/
 	MathStructure calculate(string str, const EvaluationOptions &eo = default_evaluation_options, MathStructure *parsed_struct = NULL, MathStructure *to_struct = NULL, bool make_to_division = true);
+	/** Starts a calculation of an expression in the calculation thread and returns immediately. The expression should be unlocalized first with unlocalizeExpression().
+	* The calculation uses the calculation context of the current thread. mstruct, parsed_struct and to_struct must not be used or deleted until the calculation has finished.
+	*
+	* @param[out] mstruct Math structure to fill with the result.
+	* @param str Expression.
+	* @param eo Options for the evaluation and parsing of the expression.
+	* @param[out] parsed_struct NULL or a math structure to fill with the result of the parsing of the expression.
+	* @param[out] to_struct NULL or a math structure to fill with unit expression parsed after "to".
+	* @param make_to_division If true, the expression after "to" will be interpreted as a unit epxression to convert the result to.
+	* @returns A handle for the calculation. Use CalculationJob::unref() when it is no longer needed.
+	*/
+	CalculationJob *calculateAsync(MathStructure *mstruct, string str, const EvaluationOptions &eo = default_evaluation_options, MathStructure *parsed_struct = NULL, MathStructure *to_struct = NULL, bool make_to_division = true);
+	/** Returns a handle for the most recently started calculation in the calculation thread (for example by calculate() with msecs <= 0 or by the RPN functions with a time limit), or NULL.
+	* Use CalculationJob::unref() when the handle is no longer needed.
+	*/
+	CalculationJob *lastCalculation();
+	/** Calculates several independent expressions in parallel. Each worker thread uses a separate calculation context (see CalculationContext).
+	* Definitions must not be changed until the function has returned.
+	*
+	* @param expressions Expressions to calculate. The expressions should be unlocalized first with unlocalizeExpression().
+	* @param[out] results Results of the calculations, in the same order as the expressions. The results of calculations that timed out are set with MathStructure::setAborted().
+	* @param eo Options for the evaluation and parsing of the expressions.
+	* @param threads Number of threads to use (including the calling thread). If less than one, the number of processors is used.
+	* @param msecs_per_item The maximum time for each calculation in milliseconds. If msecs_per_item <= 0 the time will be unlimited.
+	* @param[out] messages NULL or a vector to fill with the messages of each calculation, in the same order as the expressions.
+	* @returns false if any calculation timed out.
+	*/
+	bool calculateBatch(const vector<string> &expressions, vector<MathStructure> &results, const EvaluationOptions &eo = default_evaluation_options, int threads = 0, int msecs_per_item = 0, vector<vector<CalculatorMessage> > *messages = NULL);
 	int testCondition(string expression);
 	//@}
 
+	/** @name Functions for calculations with a time limit in the current thread. */
+	//@{
+	/** Called before a calculation in the current thread to be able to abort the calculation when a time limit has been reached.
+	* The calculation is interrupted between evaluation steps, so a single very demanding operation might still exceed the time limit. Always use Calculator::stopControl() after finishing.
+	*
+	* @param milli_timeout The maximum time for the calculation in milliseconds. If milli_timeout <= 0 the time will be unlimited.
+	*/
+	void startControl(int milli_timeout = 0);
+	/** Always call this function after Calculator::startControl() after the calculation has finished.
+	*/
+	void stopControl(void);
+	/** Returns true if the calculation in the current thread has timed out or has been aborted (after startControl() has been called). Mainly for internal use.
+	* Long running operations call this at safe points and unwind when it returns true.
+	*
+	* @param location Where the check is made. The first check that notices an abort is counted (see abortCount()).
+	*/
+	bool aborted(AbortLocation location = ABORT_LOCATION_OTHER);
+	/** Returns the number of aborts and time outs that have been noticed at the specified location.
+	* ABORT_LOCATION_FORCED counts calculations that did not reach a safe point in time and were stopped by cancelling the calculation thread.
+	*/
+	size_t abortCount(AbortLocation location) const;
+	/** Resets the counters returned by abortCount(). */
+	void resetAbortCounts();
+	//@}
+
+	/** @name Functions for profiling of calculations. */
+	//@{
+	/** Enables or disables recording of the time spent in each stage of calculations. Profiling is disabled by default.
+	*/
+	void setProfilingEnabled(bool enable = true);
+	bool profilingEnabled() const;
+	/** Returns the time spent in each stage of the last calculation in the current thread (or current calculation context), in the order of EvaluationStage, with one entry for each calculated function after EVALUATION_STAGE_CALCULATE_FUNCTIONS. Stages that were not entered are left out.
+	* A new profile is started by Calculator::calculate() and by MathStructure::eval() (when not called from another calculation). Formatting and printing after the calculation are added to the profile of the calculation.
+	* Profiling must be enabled with setProfilingEnabled().
+	*/
+	vector<EvaluationProfileEntry> lastEvaluationProfile() const;
+	//@}
+
 	/** @name Functions for printing expressions with the option to set a timeout or abort. */
 	//@{
 	/** Calls MathStructure::format(po) and MathStructure::print(po). The process is aborted after msecs milliseconds.
@@ -384,11 +534,13 @@ class Calculator {
 
 	/** @name Functions for handling of threaded calculations */
 	//@{
-	/** Aborts the current calculation. */
+	/** Aborts the current calculation.
+	* The calculation is asked to stop at the next safe point. The calculation thread is only cancelled if the calculation does not stop within a short grace period.
+	*/
 	void abort();
 	/** Aborts the current calculation. Used from within the calculation thread. */
 	void abort_this();
-	/** Returns true if the calculate or print thread is busy. */
+	/** Returns true if a calculation in the calculation thread is in progress or queued. */
 	bool busy();
 	/** Saves the state of the calculator. Used internally to be able to restore the state after aborted calculation. */
 	void saveState();
@@ -578,6 +730,17 @@ class Calculator {
 	*/
 	MathStructure parse(string str, const ParseOptions &po = default_parse_options);
 	void parse(MathStructure *mstruct, string str, const ParseOptions &po = default_parse_options);
+	/** Enables caching of parse results. The most recently used parse results are stored, with the expression and parse options as key,
+	* and reused for identical expressions as long as the parse generation (see parseGeneration()) is unchanged.
+	* Expressions that result in errors or warnings are not cached.
+	*
+	* @param max_entries Maximum number of stored parse results. 0 disables the cache (default).
+	*/
+	void setParseCacheSize(size_t max_entries);
+	/** Returns the maximum number of stored parse results.*/
+	size_t parseCacheSize() const;
+	/** Removes all stored parse results. */
+	void clearParseCache();
 	bool parseNumber(MathStructure *mstruct, string str, const ParseOptions &po = default_parse_options);
 	bool parseOperators(MathStructure *mstruct, string str, const ParseOptions &po = default_parse_options);
 	bool parseAdd(string &str, MathStructure *mstruct, const ParseOptions &po, MathOperation s);
@@ -875,6 +1038,10 @@ class Calculator {
 	bool showArgumentErrors() const;
 	void beginTemporaryStopMessages();
 	int endTemporaryStopMessages(int *message_count = NULL, int *warning_count = NULL);	
+	/** Returns the total number of messages, including temporarily stopped messages, that has been issued in the current calculation context.
+	* Can be used to detect if a calculation produced any messages.
+	*/
+	size_t messageCount();
 	//@}
 
 	/** @name Functions for loading and saving definitions (variables, functions, units, etc.). */
@@ -884,6 +1051,32 @@ class Calculator {
 	* @returns true if the definitions were successfully loaded.
 	*/
 	bool loadGlobalDefinitions();
+	/** Enables or disables the cache of global definitions.
+	* Global definition files are stored in a compact binary form (in $XDG_CACHE_HOME/qalculate/definitions), for the current locale, the first time they are loaded, and later loaded from this snapshot, if it is still up to date, instead of being parsed again. Enabled by default.
+	*
+	* @param enable true to use the cache.
+	*/
+	void setDefinitionsCacheEnabled(bool enable = true);
+	/** Returns true if the cache of global definitions is used.
+	*/
+	bool definitionsCacheEnabled() const;
+	/** Enables or disables lazy loading of global functions.
+	* When enabled, only the names, titles and descriptions of functions in the global definitions are loaded up front.
+	* The formula, condition, subfunctions and argument definitions of a function are loaded the first time they are needed, usually when the function name is used in an expression. Enabled by default.
+	*
+	* @param enable true to load function definitions on demand.
+	*/
+	void setLazyDefinitionsEnabled(bool enable = true);
+	/** Returns true if global functions are loaded on demand.
+	*/
+	bool lazyDefinitionsEnabled() const;
+	/** Loads a postponed function definition (see MathFunction::setDeferredDefinition()). Used internally.
+	*
+	* @param f The function.
+	* @param definition Definition elements, inside a function element, in the format of the definitions files.
+	* @returns true if the definition was successfully read.
+	*/
+	bool loadFunctionDefinition(MathFunction *f, const string &definition);
 	/** Load global (system wide) definitions from a file in the global data directory ($PREFIX/share/qalculate).
 	*
 	* @param filename Name of the file in the global data directory.
@@ -949,9 +1142,34 @@ class Calculator {
 
 	/** @name Functions for CSV file import/export. */
 	//@{
-	bool importCSV(MathStructure &mstruct, const char *file_name, int first_row = 1, string delimiter = ",", vector<string> *headers = NULL);
-	bool importCSV(const char *file_name, int first_row = 1, bool headers = true, string delimiter = ",", bool to_matrix = false, string name = "", string title = "", string category = "");
-	bool exportCSV(const MathStructure &mstruct, const char *file_name, string delimiter = ",");
+	/** Reads a file with delimiter-separated values into a matrix.
+	* Fields can be enclosed in double quotes (a quote inside a quoted field is written as two quotes) and lines can be of any length. Fields with plain decimal numbers are read directly, other fields are parsed as expressions.
+	* The number of columns is decided by the first row.
+	*
+	* @param mstruct Matrix to store the result in.
+	* @param file_name File to read.
+	* @param first_row The row (starting with 1) to begin reading at. Preceding rows are skipped.
+	* @param delimiter Separator between fields.
+	* @param headers If not NULL, the first row is read as column headers and stored here.
+	* @param progress If not NULL, called regularly with the number of bytes read and the size of the file. The import is cancelled if it returns false. The import is also cancelled if the calculation is aborted.
+	* @param progress_data Passed to progress.
+	* @returns false if the file could not be read or the import was cancelled.
+	*/
+	bool importCSV(MathStructure &mstruct, const char *file_name, int first_row = 1, string delimiter = ",", vector<string> *headers = NULL, ProgressFunction progress = NULL, void *progress_data = NULL);
+	/** Reads a file with delimiter-separated values into variables, one vector for each column or a single matrix. See the function above for details.
+	*/
+	bool importCSV(const char *file_name, int first_row = 1, bool headers = true, string delimiter = ",", bool to_matrix = false, string name = "", string title = "", string category = "", ProgressFunction progress = NULL, void *progress_data = NULL);
+	/** Writes a vector or matrix (or a single value) to a file with delimiter-separated values, one row per line.
+	* Plain numbers are written directly; other values are formatted and printed as in a displayed result.
+	*
+	* @param mstruct Matrix, vector or value to export.
+	* @param file_name File to write.
+	* @param delimiter Separator between fields.
+	* @param number_format How numbers are written.
+	* @param precision Number of significant digits for CSV_NUMBER_FORMAT_DECIMAL. If precision < 1 the current precision is used. Numbers that cannot be written with the requested precision using machine doubles are formatted as with CSV_NUMBER_FORMAT_DEFAULT, but with the requested precision.
+	* @returns false if the file could not be written.
+	*/
+	bool exportCSV(const MathStructure &mstruct, const char *file_name, string delimiter = ",", CSVNumberFormat number_format = CSV_NUMBER_FORMAT_DEFAULT, int precision = 0);
 	//@}
 	
 	/** @name Functions for exchange rates. */
@@ -1043,14 +1261,38 @@ class Calculator {
 
 	/** @name Functions for global precision */
 	//@{
-	/** Set default precision for approximate calculations.
+	/** Set default precision for approximate calculations. Changes the precision of the calculation context of the current thread.
 	*
 	* @param precision Precision.
 	*/
 	void setPrecision(int precision = DEFAULT_PRECISION);
-	/** Returns default precision for approximate calculations.
+	/** Returns default precision for approximate calculations, in the calculation context of the current thread.
 	*/
 	int getPrecision() const;
+	/** Enables or disables hardware float mode in the calculation context of the current thread.
+	* In hardware float mode, if the precision is not higher than DBL_DIG (15), floating point calculations with real numbers (addition, multiplication, powers, exponentials, logarithms and trigonometric functions)
+	* use machine doubles and the C math library instead of CLN. Calculations with exact numbers, complex numbers, and calculations that overflow or underflow a double still use CLN.
+	* In the default context, CLN also creates new floating point values with double precision. Hardware float mode is disabled by default.
+	*
+	* @param use_hardware_float Enable hardware float mode.
+	*/
+	void useHardwareFloat(bool use_hardware_float = true);
+	/** Returns true if hardware float mode is enabled in the calculation context of the current thread.
+	*/
+	bool usesHardwareFloat() const;
+	//@}
+
+	/** @name Functions for calculation contexts */
+	//@{
+	/** Activates a calculation context for the current thread. Messages, precision and temporary values will from now on be stored in this context, when the calculator is used from the current thread.
+	*
+	* @param context Calculation context, or NULL to use the default context.
+	*/
+	void setCalculationContext(CalculationContext *context);
+	/** Returns the calculation context of the current thread. */
+	CalculationContext *calculationContext() const;
+	/** Returns the default calculation context, used by threads without an activated context. */
+	CalculationContext *defaultCalculationContext() const;
 	//@}
 
 	/** @name Functions for localization */
@@ -1112,6 +1354,30 @@ class Calculator {
 	* @param id Storage id.
 	*/
 	void delId(size_t id);
+	/** Returns the copy of a value of a variable, stored for the current calculation context with setContextValue(), or NULL if there is none. Mainly for internal use.
+	*
+	* @param v The variable.
+	* @param precision Precision of the value (of a dynamic variable) or zero.
+	* @param version Version of the value (see KnownVariable::valueVersion()).
+	*/
+	const MathStructure *getContextValue(KnownVariable *v, int precision, size_t version) const;
+	/** Stores a copy of a value of a variable for the current calculation context, and returns the copy. Mainly for internal use.
+	* CLN numbers are reference counted without synchronization, so each context uses its own copies of the values of the loaded definitions (see MathStructure::unshare()).
+	* No other thread may use the value while it is copied.
+	*
+	* @param v The variable.
+	* @param precision Precision of the value (of a dynamic variable) or zero.
+	* @param version Version of the value (see KnownVariable::valueVersion()).
+	* @param value The value to copy.
+	* @returns The stored copy, valid until the value of the variable is changed or the context is deleted.
+	*/
+	const MathStructure &setContextValue(KnownVariable *v, int precision, size_t version, const MathStructure &value);
+	/** Returns a counter that is incremented whenever names of functions, variables, units or prefixes, string alternatives, or decimal and argument separators change.
+	* Text parsed with the same parse options and the same parse generation will result in the same expression. Used for invalidation of cached parse results.
+	*/
+	size_t parseGeneration() const;
+	/** Increments the parse generation. Should be called if something else than the above changes the result of parse(). Mainly for internal use. */
+	void parseDefinitionsChanged();
 	//@}
 		
 };
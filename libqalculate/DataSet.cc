@@ -25,6 +25,87 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 
+#if HAVE_UNORDERED_MAP
+#	include <unordered_map>
+#elif 	defined(__GNUC__)
+
+#	ifndef __has_include
+#	define __has_include(x) 0
+#	endif
+
+#	if (defined(__clang__) && __has_include(<tr1/unordered_map>)) || (__GNUC__ >= 4 && __GNUC_MINOR__ >= 3)
+#		include <tr1/unordered_map>
+		namespace Sgi = std;
+#		define unordered_map std::tr1::unordered_map
+#	else
+#		if __GNUC__ < 3
+#			include <hash_map.h>
+			namespace Sgi { using ::hash_map; }; // inherit globals
+#		else
+#			include <ext/hash_map>
+#			if __GNUC__ == 3 && __GNUC_MINOR__ == 0
+				namespace Sgi = std;               // GCC 3.0
+#			else
+				namespace Sgi = ::__gnu_cxx;       // GCC 3.1 and later
+#			endif
+#		endif
+#		define unordered_map Sgi::hash_map
+#	endif
+#else      // ...  there are other compilers, right?
+	namespace Sgi = std;
+#	define unordered_map Sgi::hash_map
+#endif
+
+/*
+	Objects are indexed by a hash of the values (localized and nonlocalized) of each key property, in the order of DataSet::objects.
+	Case-insensitive properties use expression_name_hash(). Key properties with numerical values are also indexed by integer value.
+	Different values might have the same hash, so candidates must always be checked.
+*/
+class DataSet_p {
+	public:
+		DataSet_p() : b_key_index(false), b_number_index(false), n_slots(0) {}
+		bool b_key_index, b_number_index;
+		// number of property slots used by objects (slots of removed properties are not reused)
+		size_t n_slots;
+		// one index for each property, in the order of DataSet::properties (empty for non-key properties)
+		vector<unordered_map<size_t, vector<DataObject*> > > key_index;
+		vector<unordered_map<size_t, vector<DataObject*> > > number_index;
+};
+
+size_t data_key_hash(const string &str, bool case_sensitive) {
+	if(!case_sensitive) return expression_name_hash(str);
+	size_t h = 2166136261U;
+	for(size_t i = 0; i < str.length(); i++) {
+		h ^= (unsigned char) str[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+void add_to_data_index(unordered_map<size_t, vector<DataObject*> > &index, size_t key, DataObject *o) {
+	vector<DataObject*> &v = index[key];
+	if(v.empty() || v.back() != o) v.push_back(o);
+}
+// Only integers which fit in an int are indexed. Floating point numbers equal to an integer are indexed by the integer, since they are equal in lookups.
+bool data_number_key(const MathStructure *mstruct, size_t &key) {
+	if(!mstruct || !mstruct->isNumber()) return false;
+	const Number &nr = mstruct->number();
+	bool overflow = false;
+	int i = 0;
+	if(nr.isInteger()) {
+		i = nr.intValue(&overflow);
+	} else {
+		if(!nr.isApproximateType() || !nr.isReal()) return false;
+		Number nr_int(nr);
+		if(!nr_int.round() || !nr_int.equals(nr)) return false;
+		i = nr_int.intValue(&overflow);
+	}
+	if(overflow) return false;
+	key = (size_t) i;
+	return true;
+}
+// the object indexes are built on first use, which might happen in several calculation contexts at the same time
+static GRecMutex data_index_mutex;
+
 #define XML_GET_STRING_FROM_PROP(node, name, str)	value = xmlGetProp(node, (xmlChar*) name); if(value) {str = (char*) value; remove_blank_ends(str); xmlFree(value);} else str = ""; 
 #define XML_GET_STRING_FROM_TEXT(node, str)		value = xmlNodeListGetString(doc, node->xmlChildrenNode, 1); if(value) {str = (char*) value; remove_blank_ends(str); xmlFree(value);} else str = "";
 
@@ -32,101 +113,90 @@ DataObject::DataObject(DataSet *parent_set) {
 	parent = parent_set;
 	b_uchanged = false;
 }
+DataObject::~DataObject() {
+	for(size_t i = 0; i < values.size(); i++) {
+		if(values[i].m_value) values[i].m_value->unref();
+	}
+}
 
 void DataObject::eraseProperty(DataProperty *property) {
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			s_properties.erase(s_properties.begin() + i);
-			a_properties.erase(a_properties.begin() + i);
-			if(m_properties[i]) {
-				m_properties[i]->unref();
-			}
-			m_properties.erase(m_properties.begin() + i);
-			s_nonlocalized_properties.erase(s_nonlocalized_properties.begin() + i);
+	if(parent && property->isKey()) parent->invalidateObjectIndex();
+	size_t i = property->slot();
+	if(i < values.size()) {
+		values[i].s_value.clear();
+		values[i].approximate = -1;
+		if(values[i].m_value) {
+			values[i].m_value->unref();
+			values[i].m_value = NULL;
 		}
 	}
+	if(i < s_nonlocalized_properties.size()) s_nonlocalized_properties[i].clear();
 }
 void DataObject::setProperty(DataProperty *property, string s_value, int is_approximate) {
-	if(s_value.empty()) eraseProperty(property);
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			s_properties[i] = s_value;
-			a_properties[i] = is_approximate;
-			if(m_properties[i]) {
-				m_properties[i]->unref();
-				m_properties[i] = NULL;
-			}
-			return;
-		}
+	if(s_value.empty()) {
+		eraseProperty(property);
+		return;
+	}
+	if(parent && property->isKey()) parent->invalidateObjectIndex();
+	size_t i = property->slot();
+	if(i == (size_t) -1) return;
+	if(i >= values.size()) {
+		// allocate all slots at once
+		if(parent && values.capacity() < parent->dpriv->n_slots) values.reserve(parent->dpriv->n_slots);
+		PropertyValue empty_value = {string(), NULL, -1};
+		values.resize(i + 1, empty_value);
+	}
+	values[i].s_value = s_value;
+	values[i].approximate = is_approximate;
+	if(values[i].m_value) {
+		values[i].m_value->unref();
+		values[i].m_value = NULL;
 	}
-	properties.push_back(property);
-	s_properties.push_back(s_value);
-	m_properties.push_back(NULL);
-	a_properties.push_back(is_approximate);
-	s_nonlocalized_properties.push_back("");
 }
 void DataObject::setNonlocalizedKeyProperty(DataProperty *property, string s_value) {
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			s_nonlocalized_properties[i] = s_value;
-			return;
-		}
+	if(parent && property->isKey()) parent->invalidateObjectIndex();
+	size_t i = property->slot();
+	if(i == (size_t) -1) return;
+	if(i >= s_nonlocalized_properties.size()) {
+		if(s_value.empty()) return;
+		s_nonlocalized_properties.resize(i + 1);
 	}
-	properties.push_back(property);
-	s_properties.push_back("");
-	m_properties.push_back(NULL);
-	a_properties.push_back(-1);
-	s_nonlocalized_properties.push_back(s_value);
+	s_nonlocalized_properties[i] = s_value;
 }
 	
 const string &DataObject::getProperty(DataProperty *property, int *is_approximate) {
 	if(!property) return empty_string;
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			if(is_approximate) *is_approximate = a_properties[i];
-			return s_properties[i];
-		}
-	}
-	return empty_string;
+	size_t i = property->slot();
+	if(i >= values.size()) return empty_string;
+	if(is_approximate) *is_approximate = values[i].approximate;
+	return values[i].s_value;
 }
 const string &DataObject::getNonlocalizedKeyProperty(DataProperty *property) {
 	if(!property) return empty_string;
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			return s_nonlocalized_properties[i];
-		}
-	}
-	return empty_string;
+	size_t i = property->slot();
+	if(i >= s_nonlocalized_properties.size()) return empty_string;
+	return s_nonlocalized_properties[i];
 }
 string DataObject::getPropertyInputString(DataProperty *property) {
 	if(!property) return empty_string;
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			return property->getInputString(s_properties[i]);
-		}
-	}
-	return empty_string;
+	size_t i = property->slot();
+	if(i >= values.size() || values[i].s_value.empty()) return empty_string;
+	return property->getInputString(values[i].s_value);
 }
 string DataObject::getPropertyDisplayString(DataProperty *property) {
 	if(!property) return empty_string;
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			return property->getDisplayString(s_properties[i]);
-		}
-	}
-	return empty_string;
+	size_t i = property->slot();
+	if(i >= values.size() || values[i].s_value.empty()) return empty_string;
+	return property->getDisplayString(values[i].s_value);
 }
 const MathStructure *DataObject::getPropertyStruct(DataProperty *property) {
 	if(!property) return NULL;
-	for(size_t i = 0; i < properties.size(); i++) {
-		if(properties[i] == property) {
-			if(!m_properties[i]) {
-				m_properties[i] = property->generateStruct(s_properties[i], a_properties[i]);
-			}
-			return m_properties[i];
-		}
+	size_t i = property->slot();
+	if(i >= values.size() || values[i].s_value.empty()) return NULL;
+	if(!values[i].m_value) {
+		values[i].m_value = property->generateStruct(values[i].s_value, values[i].approximate);
 	}
-	return NULL;
+	return values[i].m_value;
 }
 
 bool DataObject::isUserModified() const {
@@ -152,9 +222,11 @@ DataProperty::DataProperty(DataSet *parent_set, string s_name, string s_title, s
 	ptype = PROPERTY_EXPRESSION;
 	b_key = false; b_case = false; b_hide = false; b_brackets = false; b_approximate = false;
 	b_uchanged = false;
+	i_slot = (size_t) -1;
 }
 DataProperty::DataProperty(const DataProperty &dp) {
 	m_unit = NULL;
+	i_slot = (size_t) -1;
 	set(dp);
 }
 
@@ -279,6 +351,8 @@ string DataProperty::getDisplayString(const string &valuestr) {
 	}
 	return str;
 }
+static GMutex data_unit_mutex;
+
 MathStructure *DataProperty::generateStruct(const string &valuestr, int is_approximate) {
 	MathStructure *mstruct = NULL;
 	switch(ptype) {
@@ -319,21 +393,37 @@ MathStructure *DataProperty::generateStruct(const string &valuestr, int is_appro
 		}
 	}
 	if(getUnitStruct()) {
-		mstruct->multiply(*getUnitStruct());
+		// the parsed unit is shared by calculation contexts (see DataSet::materializeProperties()); copied under a lock, without shared numbers
+		int cancel_state = thread_disable_cancel();
+		g_mutex_lock(&data_unit_mutex);
+		MathStructure *munit = new MathStructure(*m_unit);
+		munit->unshare();
+		g_mutex_unlock(&data_unit_mutex);
+		thread_restore_cancel(cancel_state);
+		mstruct->multiply_nocopy(munit);
 	}
 	return mstruct;
 }
-void DataProperty::setKey(bool is_key) {b_key = is_key;}
+void DataProperty::setKey(bool is_key) {
+	b_key = is_key;
+	if(parent) parent->invalidateObjectIndex();
+}
 bool DataProperty::isKey() const {return b_key;}
 void DataProperty::setHidden(bool is_hidden) {b_hide = is_hidden;}
 bool DataProperty::isHidden() const {return b_hide;}
-void DataProperty::setCaseSensitive(bool is_case_sensitive) {b_case = is_case_sensitive;}
+void DataProperty::setCaseSensitive(bool is_case_sensitive) {
+	b_case = is_case_sensitive;
+	if(parent) parent->invalidateObjectIndex();
+}
 bool DataProperty::isCaseSensitive() const {return b_case;}
 void DataProperty::setUsesBrackets(bool uses_brackets) {b_brackets = uses_brackets;}
 bool DataProperty::usesBrackets() const {return b_brackets;}
 void DataProperty::setApproximate(bool is_approximate) {b_approximate = is_approximate;}
 bool DataProperty::isApproximate() const {return b_approximate;}
-void DataProperty::setPropertyType(PropertyType property_type) {ptype = property_type;}
+void DataProperty::setPropertyType(PropertyType property_type) {
+	ptype = property_type;
+	if(parent) parent->invalidateObjectIndex();
+}
 PropertyType DataProperty::propertyType() const {return ptype;}
 
 bool DataProperty::isUserModified() const {
@@ -346,8 +436,15 @@ void DataProperty::setUserModified(bool user_modified) {
 DataSet *DataProperty::parentSet() const {
 	return parent;
 }
+size_t DataProperty::slot() const {
+	return i_slot;
+}
+void DataProperty::setSlot(size_t index) {
+	i_slot = index;
+}
 
 DataSet::DataSet(string s_category, string s_name, string s_default_file, string s_title, string s_description, bool is_local) : MathFunction(s_name, 1, 2, s_category, s_title, s_description) {
+	dpriv = new DataSet_p;
 	b_local = is_local;
 	sfile = s_default_file;
 	b_loaded = false;
@@ -357,9 +454,13 @@ DataSet::DataSet(string s_category, string s_name, string s_default_file, string
 	setChanged(false);
 }
 DataSet::DataSet(const DataSet *o) {
+	dpriv = new DataSet_p;
 	b_loaded = false;
 	set(o);
 }
+DataSet::~DataSet() {
+	delete dpriv;
+}
 	
 ExpressionItem *DataSet::copy() const {return new DataSet(this);}
 void DataSet::set(const ExpressionItem *item) {
@@ -727,6 +828,8 @@ bool DataSet::loadObjects(const char *file_name, bool is_user_defs) {
 	}
 	xmlFreeDoc(doc);
 	b_loaded = true;
+	invalidateObjectIndex();
+	buildKeyIndex();
 	if(!scopyright.empty()) {
 		CALCULATOR->message(MESSAGE_INFORMATION, scopyright.c_str(), NULL);
 	}
@@ -826,20 +929,27 @@ void DataSet::setObjectsLoaded(bool objects_loaded) {
 }
 	
 void DataSet::addProperty(DataProperty *dp) {
+	dp->setSlot(dpriv->n_slots);
+	dpriv->n_slots++;
 	properties.push_back(dp);
+	invalidateObjectIndex();
 	setChanged(true);
 }
 void DataSet::delProperty(DataProperty *dp) {
 	for(size_t i = 0; i < properties.size(); i++) {
 		if(properties[i] == dp) {
+			for(size_t i2 = 0; i2 < objects.size(); i2++) objects[i2]->eraseProperty(dp);
 			delete properties[i];
 			properties.erase(properties.begin() + i);
+			invalidateObjectIndex();
 			setChanged(true);
 			break;
 		}
 	}
 }
 void DataSet::delProperty(DataPropertyIter *it) {
+	invalidateObjectIndex();
+	for(size_t i = 0; i < objects.size(); i++) objects[i]->eraseProperty(**it);
 	*it = properties.erase(*it);
 	--(*it);
 }
@@ -877,12 +987,278 @@ const string &DataSet::getNextPropertyName(DataPropertyIter *it) {
 	return empty_string;
 }
 
+void DataSet::invalidateObjectIndex() {
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&data_index_mutex);
+	dpriv->b_key_index = false;
+	dpriv->b_number_index = false;
+	g_rec_mutex_unlock(&data_index_mutex);
+	thread_restore_cancel(cancel_state);
+}
+void DataSet::addToKeyIndex(DataObject *o) {
+	for(size_t i = 0; i < properties.size(); i++) {
+		if(properties[i]->isKey()) {
+			const string &value = o->getProperty(properties[i]);
+			if(!value.empty()) add_to_data_index(dpriv->key_index[i], data_key_hash(value, properties[i]->isCaseSensitive()), o);
+			const string &nonlocalized_value = o->getNonlocalizedKeyProperty(properties[i]);
+			if(!nonlocalized_value.empty()) add_to_data_index(dpriv->key_index[i], data_key_hash(nonlocalized_value, properties[i]->isCaseSensitive()), o);
+		}
+	}
+}
+void DataSet::addToNumberIndex(DataObject *o) {
+	size_t key = 0;
+	for(size_t i = 0; i < properties.size(); i++) {
+		if(properties[i]->isKey() && properties[i]->propertyType() != PROPERTY_STRING && data_number_key(o->getPropertyStruct(properties[i]), key)) {
+			add_to_data_index(dpriv->number_index[i], key, o);
+		}
+	}
+}
+void DataSet::buildKeyIndex() {
+	dpriv->key_index.clear();
+	dpriv->key_index.resize(properties.size());
+	for(size_t i = 0; i < objects.size(); i++) addToKeyIndex(objects[i]);
+	dpriv->b_key_index = true;
+}
+void DataSet::buildNumberIndex() {
+	dpriv->number_index.clear();
+	dpriv->number_index.resize(properties.size());
+	// parses the values of numerical key properties
+	for(size_t i = 0; i < objects.size(); i++) addToNumberIndex(objects[i]);
+	dpriv->b_number_index = true;
+}
+
+/*
+	Cache of parsed values of PROPERTY_NUMBER properties (see DataSet::materializeProperties()), in the definitions directory of the cache directory:
+	header: "QALCDATA", format version (uint32), key (uint64), number of values (uint32)
+	value: object index (uint32), slot (uint32), numerator (int32), denominator (int32), exponent (int32), precision (int32), approximate (uint8)
+	Values are saved as numerator / denominator * 10^exponent. Values that are not rational, or with a too large numerator or denominator, are not saved.
+*/
+#define DATA_VALUES_CACHE_MAGIC "QALCDATA"
+#define DATA_VALUES_CACHE_VERSION 1
+#define DATA_VALUES_CACHE_HEADER_SIZE 24
+#define DATA_VALUES_CACHE_VALUE_SIZE 25
+
+void data_cache_append_int32(string &out, gint32 i) {
+	out.append((const char*) &i, sizeof(gint32));
+}
+gint32 data_cache_read_int32(const char *p) {
+	gint32 i;
+	memcpy(&i, p, sizeof(gint32));
+	return i;
+}
+
+// Splits a number into numerator / denominator * 10^exponent, with numerator and denominator that fit in an int
+bool data_cache_split_number(const Number &nr, gint32 &numerator, gint32 &denominator, gint32 &exp10) {
+	if(!nr.isRational()) return false;
+	Number num(nr.numerator()), den(nr.denominator()), ten(10, 1), q, r;
+	exp10 = 0;
+	while(!num.isZero()) {
+		q = num;
+		if(!q.iquo(ten, r) || !r.isZero()) break;
+		num = q;
+		exp10++;
+	}
+	while(true) {
+		q = den;
+		if(!q.iquo(ten, r) || !r.isZero()) break;
+		den = q;
+		exp10--;
+	}
+	bool overflow = false;
+	numerator = num.intValue(&overflow);
+	if(overflow) return false;
+	denominator = den.intValue(&overflow);
+	return !overflow;
+}
+
+struct DataMaterialization {
+	const vector<DataObject*> *objects;
+	const vector<DataProperty*> *properties;
+	int precision;
+	volatile gint next_index;
+	volatile gint n_values;
+};
+
+gpointer materialize_data_objects(gpointer data) {
+	DataMaterialization *dm = (DataMaterialization*) data;
+	CalculationContext context(dm->precision);
+	CalculationContext *context_was = CALCULATOR->calculationContext();
+	CALCULATOR->setCalculationContext(&context);
+	while(true) {
+		// one object at a time, so that values of an object are only changed by one thread
+		gint i = g_atomic_int_add(&dm->next_index, 1);
+		if(i < 0 || (size_t) i >= dm->objects->size()) break;
+		DataObject *o = (*dm->objects)[i];
+		gint n = 0;
+		for(size_t i2 = 0; i2 < dm->properties->size(); i2++) {
+			if((*dm->properties)[i2]->propertyType() != PROPERTY_STRING && o->getPropertyStruct((*dm->properties)[i2])) n++;
+		}
+		if(n > 0) g_atomic_int_add(&dm->n_values, n);
+		CalculatorMessage *msg = CALCULATOR->message();
+		while(msg) msg = CALCULATOR->nextMessage();
+	}
+	CALCULATOR->setCalculationContext(context_was);
+	return NULL;
+}
+
+// The saved values are valid as long as the unparsed values and the relevant property settings are unchanged
+unsigned long long DataSet::valuesCacheKey() {
+	unsigned long long key = fnv1a_hash(VERSION, strlen(VERSION) + 1);
+	gint32 n = objects.size();
+	key = fnv1a_hash((const char*) &n, sizeof(gint32), key);
+	for(size_t i = 0; i < properties.size(); i++) {
+		if(properties[i]->propertyType() != PROPERTY_NUMBER) continue;
+		gint32 flags[3] = {(gint32) properties[i]->slot(), properties[i]->usesBrackets(), properties[i]->isApproximate()};
+		key = fnv1a_hash((const char*) flags, sizeof(flags), key);
+	}
+	for(size_t i = 0; i < objects.size(); i++) {
+		for(size_t i2 = 0; i2 < properties.size(); i2++) {
+			if(properties[i2]->propertyType() != PROPERTY_NUMBER) continue;
+			int approx = -1;
+			const string &value = objects[i]->getProperty(properties[i2], &approx);
+			key = fnv1a_hash(value.c_str(), value.length() + 1, key);
+			key = fnv1a_hash((const char*) &approx, sizeof(int), key);
+		}
+	}
+	return key;
+}
+string DataSet::valuesCacheFile() const {
+	string cache_name = referenceName();
+	cache_name += ".values.cache";
+	gchar *gstr = g_build_filename(getLocalCacheDir().c_str(), "definitions", cache_name.c_str(), NULL);
+	string cache_file = gstr;
+	g_free(gstr);
+	return cache_file;
+}
+bool DataSet::readValuesCache(unsigned long long key) {
+	gchar *contents = NULL;
+	gsize len = 0;
+	if(!g_file_get_contents(valuesCacheFile().c_str(), &contents, &len, NULL)) return false;
+	bool b_valid = false;
+	guint32 version = 0, n = 0;
+	unsigned long long cache_key = 0;
+	if(len >= DATA_VALUES_CACHE_HEADER_SIZE && memcmp(contents, DATA_VALUES_CACHE_MAGIC, 8) == 0) {
+		memcpy(&version, contents + 8, sizeof(guint32));
+		memcpy(&cache_key, contents + 12, sizeof(unsigned long long));
+		memcpy(&n, contents + 20, sizeof(guint32));
+	}
+	if(version == DATA_VALUES_CACHE_VERSION && cache_key == key && (len - DATA_VALUES_CACHE_HEADER_SIZE) / DATA_VALUES_CACHE_VALUE_SIZE == n) {
+		b_valid = true;
+		const char *p = contents + DATA_VALUES_CACHE_HEADER_SIZE;
+		for(guint32 i = 0; i < n; i++, p += DATA_VALUES_CACHE_VALUE_SIZE) {
+			guint32 i_object = data_cache_read_int32(p), i_slot = data_cache_read_int32(p + 4);
+			gint32 num = data_cache_read_int32(p + 8), den = data_cache_read_int32(p + 12), exp10 = data_cache_read_int32(p + 16), prec = data_cache_read_int32(p + 20);
+			if(i_object >= objects.size() || i_slot >= objects[i_object]->values.size() || den == 0) continue;
+			DataObject::PropertyValue &value = objects[i_object]->values[i_slot];
+			if(value.m_value || value.s_value.empty()) continue;
+			DataProperty *dp = NULL;
+			for(size_t i2 = 0; i2 < properties.size(); i2++) {
+				if(properties[i2]->slot() == i_slot) {
+					dp = properties[i2];
+					break;
+				}
+			}
+			if(!dp || dp->propertyType() != PROPERTY_NUMBER) continue;
+			// same as DataProperty::generateStruct()
+			Number nr(num, den, exp10);
+			if(p[24]) {
+				nr.setApproximate(true);
+				nr.setPrecision(prec);
+			}
+			value.m_value = new MathStructure(nr);
+			if(dp->getUnitStruct()) value.m_value->multiply(*dp->getUnitStruct());
+		}
+	}
+	g_free(contents);
+	return b_valid;
+}
+void DataSet::writeValuesCache(unsigned long long key) {
+	string out = DATA_VALUES_CACHE_MAGIC;
+	data_cache_append_int32(out, DATA_VALUES_CACHE_VERSION);
+	out.append((const char*) &key, sizeof(unsigned long long));
+	data_cache_append_int32(out, 0);
+	guint32 n = 0;
+	gint32 num, den, exp10;
+	for(size_t i = 0; i < objects.size(); i++) {
+		for(size_t i2 = 0; i2 < properties.size(); i2++) {
+			if(properties[i2]->propertyType() != PROPERTY_NUMBER) continue;
+			size_t i_slot = properties[i2]->slot();
+			if(i_slot >= objects[i]->values.size() || !objects[i]->values[i_slot].m_value) continue;
+			const MathStructure *m = objects[i]->values[i_slot].m_value;
+			if(properties[i2]->getUnitStruct()) {
+				if(!m->isMultiplication() || m->size() == 0) continue;
+				m = &(*m)[0];
+			}
+			if(!m->isNumber() || !data_cache_split_number(m->number(), num, den, exp10)) continue;
+			data_cache_append_int32(out, i);
+			data_cache_append_int32(out, i_slot);
+			data_cache_append_int32(out, num);
+			data_cache_append_int32(out, den);
+			data_cache_append_int32(out, exp10);
+			data_cache_append_int32(out, m->number().precision());
+			out += (char) (m->number().isApproximate() ? 1 : 0);
+			n++;
+		}
+	}
+	if(n == 0) return;
+	memcpy(&out[20], &n, sizeof(guint32));
+	gchar *cachedir = g_build_filename(getLocalCacheDir().c_str(), "definitions", NULL);
+	g_mkdir_with_parents(cachedir, S_IRWXU);
+	g_free(cachedir);
+	g_file_set_contents(valuesCacheFile().c_str(), out.data(), out.length(), NULL);
+}
+
+size_t DataSet::materializeProperties(int threads) {
+	if(!objectsLoaded()) loadObjects();
+	if(objects.empty()) return 0;
+	bool b_number = false;
+	for(size_t i = 0; i < properties.size(); i++) {
+		if(properties[i]->propertyType() == PROPERTY_NUMBER) b_number = true;
+		// units are parsed before other threads are started
+		if(properties[i]->propertyType() != PROPERTY_STRING) properties[i]->getUnitStruct();
+	}
+	bool b_cache = b_number && CALCULATOR->definitionsCacheEnabled();
+	unsigned long long key = 0;
+	bool b_cache_valid = false;
+	if(b_cache) {
+		key = valuesCacheKey();
+		b_cache_valid = readValuesCache(key);
+	}
+	if(threads < 1) threads = g_get_num_processors();
+	if((size_t) threads > objects.size()) threads = objects.size();
+	DataMaterialization dm;
+	dm.objects = &objects;
+	dm.properties = &properties;
+	dm.precision = CALCULATOR->getPrecision();
+	dm.next_index = 0;
+	dm.n_values = 0;
+	vector<GThread*> workers;
+	for(int i = 1; i < threads; i++) {
+		GThread *thread = g_thread_try_new("materialize", materialize_data_objects, &dm, NULL);
+		if(!thread) break;
+		workers.push_back(thread);
+	}
+	materialize_data_objects(&dm);
+	for(size_t i = 0; i < workers.size(); i++) {
+		g_thread_join(workers[i]);
+	}
+	if(b_cache && !b_cache_valid) writeValuesCache(key);
+	return g_atomic_int_get(&dm.n_values);
+}
+
 void DataSet::addObject(DataObject *o) {
 	objects.push_back(o);
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&data_index_mutex);
+	if(dpriv->b_key_index) addToKeyIndex(o);
+	if(dpriv->b_number_index) addToNumberIndex(o);
+	g_rec_mutex_unlock(&data_index_mutex);
+	thread_restore_cancel(cancel_state);
 }
 void DataSet::delObject(DataObject *o) {
 	for(size_t i = 0; i < objects.size(); i++) {
 		if(objects[i] == o) {
+			invalidateObjectIndex();
 			delete objects[i];
 			objects.erase(objects.begin() + i);
 			break;
@@ -890,37 +1266,74 @@ void DataSet::delObject(DataObject *o) {
 	}
 }
 void DataSet::delObject(DataObjectIter *it) {
+	invalidateObjectIndex();
 	*it = objects.erase(*it);
 	--(*it);
 }
 DataObject *DataSet::getObject(string object) {
 	if(!objectsLoaded()) loadObjects();
 	if(object.empty()) return NULL;
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&data_index_mutex);
+	if(!dpriv->b_key_index) buildKeyIndex();
+	DataObject *o = NULL;
 	DataProperty *dp;
-	for(size_t i = 0; i < properties.size(); i++) {
+	for(size_t i = 0; !o && i < properties.size(); i++) {
 		if(properties[i]->isKey()) {
 			dp = properties[i];
+			unordered_map<size_t, vector<DataObject*> >::const_iterator it = dpriv->key_index[i].find(data_key_hash(object, dp->isCaseSensitive()));
+			if(it == dpriv->key_index[i].end()) continue;
+			const vector<DataObject*> &candidates = it->second;
 			if(dp->isCaseSensitive()) {
-				for(size_t i2 = 0; i2 < objects.size(); i2++) {
-					if(object == objects[i2]->getProperty(dp) || object == objects[i2]->getNonlocalizedKeyProperty(dp)) {
-						return objects[i2];
+				for(size_t i2 = 0; i2 < candidates.size(); i2++) {
+					if(object == candidates[i2]->getProperty(dp) || object == candidates[i2]->getNonlocalizedKeyProperty(dp)) {
+						o = candidates[i2];
+						break;
 					}
 				}
 			} else {
-				for(size_t i2 = 0; i2 < objects.size(); i2++) {
-					if(equalsIgnoreCase(object, objects[i2]->getProperty(dp)) || equalsIgnoreCase(object, objects[i2]->getNonlocalizedKeyProperty(dp))) {
-						return objects[i2];
+				for(size_t i2 = 0; i2 < candidates.size(); i2++) {
+					if(equalsIgnoreCase(object, candidates[i2]->getProperty(dp)) || equalsIgnoreCase(object, candidates[i2]->getNonlocalizedKeyProperty(dp))) {
+						o = candidates[i2];
+						break;
 					}
 				}
 			}
 		}
 	}
-	return NULL;
+	g_rec_mutex_unlock(&data_index_mutex);
+	thread_restore_cancel(cancel_state);
+	return o;
 }
 DataObject *DataSet::getObject(const MathStructure &object) {
 	if(object.isSymbolic()) return getObject(object.symbol());
 	if(!objectsLoaded()) loadObjects();
 	DataProperty *dp;
+	size_t key = 0;
+	if(data_number_key(&object, key)) {
+		// all objects with a number value equal to an integer are in the index (see data_number_key())
+		DataObject *o = NULL;
+		int cancel_state = thread_disable_cancel();
+		g_rec_mutex_lock(&data_index_mutex);
+		if(!dpriv->b_number_index) buildNumberIndex();
+		for(size_t i = 0; !o && i < properties.size(); i++) {
+			if(properties[i]->isKey() && properties[i]->propertyType() != PROPERTY_STRING) {
+				dp = properties[i];
+				unordered_map<size_t, vector<DataObject*> >::const_iterator it = dpriv->number_index[i].find(key);
+				if(it == dpriv->number_index[i].end()) continue;
+				for(size_t i2 = 0; i2 < it->second.size(); i2++) {
+					const MathStructure *mstruct = it->second[i2]->getPropertyStruct(dp);
+					if(mstruct && object.equals(*mstruct)) {
+						o = it->second[i2];
+						break;
+					}
+				}
+			}
+		}
+		g_rec_mutex_unlock(&data_index_mutex);
+		thread_restore_cancel(cancel_state);
+		return o;
+	}
 	for(size_t i = 0; i < properties.size(); i++) {
 		if(properties[i]->isKey()) {
 			dp = properties[i];
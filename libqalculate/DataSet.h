@@ -25,14 +25,26 @@ class DataObject {
 
   protected:
 
-	vector<DataProperty*> properties;
-	vector<string> s_properties;
+	friend class DataSet;
+
+	/// Value of a property, in the slot of the property (see DataProperty::slot()).
+	struct PropertyValue {
+		string s_value;
+		MathStructure *m_value;
+		int approximate;
+	};
+	vector<PropertyValue> values;
+	/// Untranslated values of key properties, by slot (only as many as needed).
 	vector<string> s_nonlocalized_properties;
-	vector<MathStructure*> m_properties;
-	vector<int> a_properties;
 	DataSet *parent;
 	bool b_uchanged;
 	
+  private:
+
+	// the parsed values are owned by the object; not copyable (not implemented)
+	DataObject(const DataObject&);
+	DataObject &operator=(const DataObject&);
+	
   public:
  
 	/** Create a data object.
@@ -40,6 +52,7 @@ class DataObject {
 	* @param parent_set Data set that the object will belong to.
 	*/
 	DataObject(DataSet *parent_set);
+	~DataObject();
 
 	/** Unset (erase value) a property.
 	*
@@ -131,6 +144,7 @@ class DataProperty {
 	DataSet *parent;
 	PropertyType ptype;
 	bool b_uchanged;
+	size_t i_slot;
 	
   public:
 
@@ -180,6 +194,14 @@ class DataProperty {
 	void setUserModified(bool user_modified = true);
 	
 	DataSet *parentSet() const;
+	/** Returns the index of the values of this property in data objects, assigned when the property is added to the data set.
+	* Values can only be set for properties that have been added to the data set.
+	*
+	* @returns Slot index, or (size_t) -1 if the property has not been added to a data set.
+	*/
+	size_t slot() const;
+	/** Sets the slot index. Used internally by DataSet::addProperty(). */
+	void setSlot(size_t index);
 	
 };
 
@@ -202,11 +224,22 @@ class DataSet : public MathFunction {
 	bool b_loaded;
 	vector<DataProperty*> properties;
 	vector<DataObject*> objects;
+	class DataSet_p *dpriv;
+	friend class DataObject;
+	void addToKeyIndex(DataObject *o);
+	void addToNumberIndex(DataObject *o);
+	void buildKeyIndex();
+	void buildNumberIndex();
+	unsigned long long valuesCacheKey();
+	string valuesCacheFile() const;
+	bool readValuesCache(unsigned long long key);
+	void writeValuesCache(unsigned long long key);
 	
   public:
   
   	DataSet(string s_category = "", string s_name = "", string s_default_file = "", string s_title = "", string s_description = "", bool is_local = true);
 	DataSet(const DataSet *o);
+	virtual ~DataSet();
 	
 	ExpressionItem *copy() const;
 	void set(const ExpressionItem *item);
@@ -242,6 +275,19 @@ class DataSet : public MathFunction {
 	void delObject(DataObjectIter *it);
 	DataObject *getObject(string object);
 	DataObject *getObject(const MathStructure &object);
+	/** Marks the indexes used by getObject() as out of date.
+	* Called automatically when objects are removed, or key properties or their values are changed.
+	*/
+	void invalidateObjectIndex();
+	/** Parses the values of all objects for all properties which are not of type PROPERTY_STRING, so that later calls to DataObject::getPropertyStruct() do not need to parse. Objects are loaded first, if necessary.
+	* The objects are divided between threads, each using a separate calculation context (see CalculationContext). Messages from parsing are discarded.
+	*
+	* Parsed values of PROPERTY_NUMBER properties are saved in the cache directory, if the definitions cache is enabled (see Calculator::setDefinitionsCacheEnabled()), and are read from the cache, instead of parsed, the next time this function is called for the same values.
+	*
+	* @param threads Number of threads to use (including the calling thread). If less than one, the number of processors is used.
+	* @returns Number of parsed values.
+	*/
+	size_t materializeProperties(int threads = 1);
 	DataObject *getFirstObject(DataObjectIter *it);
 	DataObject *getNextObject(DataObjectIter *it);
 	
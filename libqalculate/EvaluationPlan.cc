@@ -0,0 +1,282 @@
+/*
+    Qalculate (library)
+
+    Copyright (C) 2016  Hanna Knutsson (hanna_k@fmgirl.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+#include "support.h"
+
+#include "EvaluationPlan.h"
+#include "Calculator.h"
+#include "MathStructure.h"
+#include "Number.h"
+#include "Function.h"
+#include "Variable.h"
+
+EvaluationPlan::EvaluationPlan() {
+	i_result = 0;
+	i_constants = 0;
+	b_valid = false;
+}
+EvaluationPlan::EvaluationPlan(const MathStructure &mstruct, const MathStructure &x_var, const EvaluationOptions &eo) {
+	i_result = 0;
+	i_constants = 0;
+	b_valid = false;
+	compile(mstruct, x_var, eo);
+}
+EvaluationPlan::~EvaluationPlan() {}
+
+void EvaluationPlan::clear() {
+	v_code.clear();
+	v_registers.clear();
+	v_vars.clear();
+	i_result = 0;
+	i_constants = 0;
+	b_valid = false;
+}
+bool EvaluationPlan::isValid() const {return b_valid;}
+size_t EvaluationPlan::countVariables() const {return v_vars.size();}
+size_t EvaluationPlan::size() const {return v_code.size();}
+
+size_t EvaluationPlan::addConstant(const Number &nr) {
+	v_registers.push_back(nr);
+	i_constants++;
+	return v_registers.size() - 1;
+}
+size_t EvaluationPlan::addInstruction(PlanOperation op, size_t arg1, size_t arg2) {
+	PlanInstruction pi;
+	pi.op = op;
+	pi.arg1 = arg1;
+	pi.arg2 = arg2;
+	v_registers.push_back(Number());
+	pi.dest = v_registers.size() - 1;
+	v_code.push_back(pi);
+	return pi.dest;
+}
+
+bool EvaluationPlan::compile(const MathStructure &mstruct, const MathStructure &x_var, const EvaluationOptions &eo) {
+	vector<MathStructure> vars;
+	vars.push_back(x_var);
+	return compile(mstruct, vars, eo);
+}
+bool EvaluationPlan::compile(const MathStructure &mstruct, const vector<MathStructure> &vars, const EvaluationOptions &eo) {
+	clear();
+	o_eo = eo;
+	v_vars = vars;
+	v_registers.resize(v_vars.size());
+	if(!compileNode(mstruct, i_result)) {
+		clear();
+		return false;
+	}
+	b_valid = true;
+	return true;
+}
+
+bool EvaluationPlan::compileNode(const MathStructure &mstruct, size_t &index) {
+	for(size_t i = 0; i < v_vars.size(); i++) {
+		if(mstruct == v_vars[i]) {
+			index = i;
+			return true;
+		}
+	}
+	if(mstruct.uncertainty()) return false;
+	switch(mstruct.type()) {
+		case STRUCT_NUMBER: {
+			Number nr(mstruct.number());
+			if(mstruct.isApproximate()) nr.setApproximate();
+			if(mstruct.precision() > 0 && (nr.precision() < 1 || mstruct.precision() < nr.precision())) nr.setPrecision(mstruct.precision());
+			index = addConstant(nr);
+			return true;
+		}
+		case STRUCT_VARIABLE: {
+			if(!o_eo.calculate_variables || !mstruct.variable()->isKnown()) return false;
+			if(o_eo.approximation != APPROXIMATION_APPROXIMATE && mstruct.variable()->isApproximate()) return false;
+			const MathStructure &mvalue = ((KnownVariable*) mstruct.variable())->get();
+			if(!mvalue.isNumber()) return false;
+			Number nr(mvalue.number());
+			if(mvalue.isApproximate() || mstruct.variable()->isApproximate()) nr.setApproximate();
+			if(o_eo.approximation != APPROXIMATION_APPROXIMATE && nr.isApproximate()) return false;
+			index = addConstant(nr);
+			return true;
+		}
+		case STRUCT_ADDITION: {}
+		case STRUCT_MULTIPLICATION: {
+			if(mstruct.size() == 0) return false;
+			if(!compileNode(mstruct[0], index)) return false;
+			for(size_t i = 1; i < mstruct.size(); i++) {
+				size_t index2 = 0;
+				if(!compileNode(mstruct[i], index2)) return false;
+				index = addInstruction(mstruct.isAddition() ? PLAN_ADD : PLAN_MULTIPLY, index, index2);
+			}
+			return true;
+		}
+		case STRUCT_POWER: {
+			if(mstruct.size() != 2) return false;
+			size_t index1 = 0, index2 = 0;
+			if(!compileNode(mstruct[0], index1) || !compileNode(mstruct[1], index2)) return false;
+			index = addInstruction(PLAN_RAISE, index1, index2);
+			return true;
+		}
+		case STRUCT_DIVISION: {
+			if(mstruct.size() != 2) return false;
+			size_t index1 = 0, index2 = 0;
+			if(!compileNode(mstruct[0], index1) || !compileNode(mstruct[1], index2)) return false;
+			index2 = addInstruction(PLAN_RECIP, index2);
+			index = addInstruction(PLAN_MULTIPLY, index1, index2);
+			return true;
+		}
+		case STRUCT_COMPARISON: {
+			if(!o_eo.test_comparisons || mstruct.size() != 2) return false;
+			size_t index1 = 0, index2 = 0;
+			if(!compileNode(mstruct[0], index1) || !compileNode(mstruct[1], index2)) return false;
+			PlanOperation op;
+			switch(mstruct.comparisonType()) {
+				case COMPARISON_LESS: {op = PLAN_LESS; break;}
+				case COMPARISON_GREATER: {op = PLAN_GREATER; break;}
+				case COMPARISON_EQUALS_LESS: {op = PLAN_EQUALS_LESS; break;}
+				case COMPARISON_EQUALS_GREATER: {op = PLAN_EQUALS_GREATER; break;}
+				case COMPARISON_EQUALS: {op = PLAN_EQUALS; break;}
+				default: {op = PLAN_NOT_EQUALS;}
+			}
+			index = addInstruction(op, index1, index2);
+			return true;
+		}
+		case STRUCT_NEGATE: {}
+		case STRUCT_INVERSE: {
+			if(mstruct.size() != 1) return false;
+			size_t index1 = 0;
+			if(!compileNode(mstruct[0], index1)) return false;
+			index = addInstruction(mstruct.isNegate() ? PLAN_NEGATE : PLAN_RECIP, index1);
+			return true;
+		}
+		case STRUCT_FUNCTION: {
+			if(!o_eo.calculate_functions || mstruct.size() != 1) return false;
+			MathFunction *f = mstruct.function();
+			size_t index1 = 0;
+			if(f == CALCULATOR->f_sqrt || f == CALCULATOR->f_sq) {
+				if(!compileNode(mstruct[0], index1)) return false;
+				index = addInstruction(PLAN_RAISE, index1, addConstant(f == CALCULATOR->f_sqrt ? Number(1, 2) : Number(2, 1)));
+				return true;
+			}
+			PlanOperation op;
+			if(f == CALCULATOR->f_sin) op = PLAN_SIN;
+			else if(f == CALCULATOR->f_cos) op = PLAN_COS;
+			else if(f == CALCULATOR->f_tan) op = PLAN_TAN;
+			else if(f == CALCULATOR->f_exp) op = PLAN_EXP;
+			else if(f == CALCULATOR->f_ln) op = PLAN_LN;
+			else if(f == CALCULATOR->f_abs) op = PLAN_ABS;
+			else return false;
+			if(!compileNode(mstruct[0], index1)) return false;
+			if(op == PLAN_SIN || op == PLAN_TAN) {
+				// the pi constant is needed to recognize multiples of pi (like SinFunction does)
+				Number nr_pi(CALCULATOR->v_pi->get().number());
+				index = addInstruction(op, index1, addConstant(nr_pi));
+			} else {
+				index = addInstruction(op, index1);
+			}
+			return true;
+		}
+		default: {}
+	}
+	return false;
+}
+
+bool EvaluationPlan::run(const Number &x_value, Number &result) {
+	if(!b_valid || v_vars.size() != 1) return false;
+	v_registers[0] = x_value;
+	return execute(result);
+}
+bool EvaluationPlan::run(const Number &value1, const Number &value2, Number &result) {
+	if(!b_valid || v_vars.size() != 2) return false;
+	v_registers[0] = value1;
+	v_registers[1] = value2;
+	return execute(result);
+}
+bool EvaluationPlan::run(const vector<Number> &values, Number &result) {
+	if(!b_valid || values.size() != v_vars.size()) return false;
+	for(size_t i = 0; i < values.size(); i++) v_registers[i] = values[i];
+	return execute(result);
+}
+bool EvaluationPlan::execute(Number &result) {
+	bool b_exact = o_eo.approximation != APPROXIMATION_APPROXIMATE;
+	bool b_ok = true;
+	CALCULATOR->beginTemporaryStopMessages();
+	for(size_t i = 0; b_ok && i < v_code.size(); i++) {
+		const PlanInstruction &pi = v_code[i];
+		Number &nr = v_registers[pi.dest];
+		const Number &nr1 = v_registers[pi.arg1];
+		bool binary = (pi.op == PLAN_ADD || pi.op == PLAN_MULTIPLY || pi.op == PLAN_RAISE || pi.op >= PLAN_LESS);
+		bool was_approx = nr1.isApproximate() || (binary && v_registers[pi.arg2].isApproximate());
+		bool was_complex = nr1.isComplex() || (binary && v_registers[pi.arg2].isComplex());
+		bool was_infinite = nr1.isInfinite() || (binary && v_registers[pi.arg2].isInfinite());
+		nr.set(nr1);
+		switch(pi.op) {
+			case PLAN_ADD: {b_ok = nr.add(v_registers[pi.arg2]); break;}
+			case PLAN_MULTIPLY: {b_ok = nr.multiply(v_registers[pi.arg2]); break;}
+			case PLAN_RAISE: {
+				const Number &nr_exp = v_registers[pi.arg2];
+				// leave roots of negative and complex numbers to eval(), which may prefer a real root
+				if(!nr_exp.isInteger() && (nr.isComplex() || nr.isNegative())) b_ok = false;
+				else b_ok = nr.raise(nr_exp, b_exact);
+				break;
+			}
+			case PLAN_NEGATE: {b_ok = nr.negate(); break;}
+			case PLAN_RECIP: {b_ok = !nr.isZero() && nr.recip(); break;}
+			case PLAN_SIN: {}
+			case PLAN_TAN: {
+				if(!b_exact && !nr.isComplex() && !nr.isInfinite()) {
+					Number nr_test(nr);
+					nr_test /= v_registers[pi.arg2];
+					nr_test.frac();
+					if(nr_test.isZero()) {
+						nr.clear();
+						if(nr1.isApproximate()) nr.setApproximate();
+						break;
+					}
+				}
+				if(pi.op == PLAN_SIN) {
+					b_ok = nr.sin();
+				} else {
+					Number nr_cos(nr);
+					b_ok = nr.sin() && nr_cos.cos() && !nr_cos.isZero() && nr.divide(nr_cos);
+				}
+				break;
+			}
+			case PLAN_COS: {b_ok = nr.cos(); break;}
+			case PLAN_EXP: {b_ok = nr.exp(); break;}
+			case PLAN_LN: {b_ok = !nr.isZero() && nr.ln(); break;}
+			case PLAN_ABS: {b_ok = nr.abs(); break;}
+			default: {
+				const Number &nr2 = v_registers[pi.arg2];
+				// approximate values are compared with regard to precision by eval()
+				if(was_approx || was_complex || was_infinite) {
+					b_ok = false;
+					break;
+				}
+				bool b_true = false;
+				switch(pi.op) {
+					case PLAN_LESS: {b_true = nr1.isLessThan(nr2); break;}
+					case PLAN_GREATER: {b_true = nr1.isGreaterThan(nr2); break;}
+					case PLAN_EQUALS_LESS: {b_true = nr1.isLessThanOrEqualTo(nr2); break;}
+					case PLAN_EQUALS_GREATER: {b_true = nr1.isGreaterThanOrEqualTo(nr2); break;}
+					case PLAN_EQUALS: {b_true = nr1.equals(nr2); break;}
+					default: {b_true = !nr1.equals(nr2);}
+				}
+				nr.setTrue(b_true);
+			}
+		}
+		if(!b_ok) break;
+		if(nr.isUndefined() || (o_eo.approximation == APPROXIMATION_EXACT && nr.isApproximate()) || (b_exact && !was_approx && nr.isApproximate()) || (!o_eo.allow_complex && !was_complex && nr.isComplex()) || (!o_eo.allow_infinite && !was_infinite && nr.isInfinite())) {
+			b_ok = false;
+		}
+	}
+	int message_count = 0, warning_count = 0;
+	if(CALCULATOR->endTemporaryStopMessages(&message_count, &warning_count) > 0 || message_count > 0 || warning_count > 0) b_ok = false;
+	if(b_ok) result = v_registers[i_result];
+	return b_ok;
+}
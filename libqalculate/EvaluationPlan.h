@@ -0,0 +1,128 @@
+/*
+    Qalculate (library)
+
+    Copyright (C) 2016  Hanna Knutsson (hanna_k@fmgirl.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+#ifndef EVALUATION_PLAN_H
+#define EVALUATION_PLAN_H
+
+#include <libqalculate/includes.h>
+#include <libqalculate/Number.h>
+#include <libqalculate/MathStructure.h>
+
+/** @file */
+
+/// Instruction codes for EvaluationPlan
+typedef enum {
+	PLAN_ADD,
+	PLAN_MULTIPLY,
+	PLAN_RAISE,
+	PLAN_NEGATE,
+	PLAN_RECIP,
+	PLAN_SIN,
+	PLAN_COS,
+	PLAN_TAN,
+	PLAN_EXP,
+	PLAN_LN,
+	PLAN_ABS,
+	PLAN_LESS,
+	PLAN_GREATER,
+	PLAN_EQUALS_LESS,
+	PLAN_EQUALS_GREATER,
+	PLAN_EQUALS,
+	PLAN_NOT_EQUALS
+} PlanOperation;
+
+/// A compiled, numeric evaluation plan for an expression with free symbols.
+/**
+* An evaluation plan lowers a parsed MathStructure, with one or more named free symbols (symbols or unknown variables),
+* to a flat list of register based instructions over Number. The plan can then be run repeatedly with new values for the free symbols,
+* without copying the expression tree or running the full MathStructure::eval() pipeline for each value.
+*
+* Only purely numeric expressions (numbers, numeric constants, the free symbols, addition, multiplication, powers, comparisons and a small set of elementary functions) can be compiled.
+* If compile() fails, or run() returns false for a specific set of values, the caller should fall back to normal evaluation.
+* run() returns false whenever the result might differ from that of MathStructure::eval() (for example if an exact calculation would have produced an approximate result
+* or if a warning would have been issued).
+*
+* \code
+* EvaluationPlan plan;
+* if(plan.compile(mstruct, x_var, eo)) {
+* 	Number nr;
+* 	if(plan.run(Number(2, 1), nr)) std::cout << nr.print() << std::endl;
+* }
+* \endcode
+*/
+class EvaluationPlan {
+
+  protected:
+
+	struct PlanInstruction {
+		PlanOperation op;
+		size_t dest, arg1, arg2;
+	};
+
+	vector<PlanInstruction> v_code;
+	vector<Number> v_registers;
+	vector<MathStructure> v_vars;
+	size_t i_result, i_constants;
+	bool b_valid;
+	EvaluationOptions o_eo;
+
+	bool compileNode(const MathStructure &mstruct, size_t &index);
+	size_t addConstant(const Number &nr);
+	size_t addInstruction(PlanOperation op, size_t arg1, size_t arg2 = 0);
+	bool execute(Number &result);
+
+  public:
+
+	EvaluationPlan();
+	/** Create a plan and compile an expression with a single free symbol. Use isValid() to check if the compilation was successful. */
+	EvaluationPlan(const MathStructure &mstruct, const MathStructure &x_var, const EvaluationOptions &eo = default_evaluation_options);
+	~EvaluationPlan();
+
+	/** Compile an expression with a single free symbol.
+	*
+	* @param mstruct Unevaluated expression.
+	* @param x_var The free symbol (symbolic value or unknown variable).
+	* @param eo Evaluation options that results shall be consistent with.
+	* @returns true if the expression was successfully compiled.
+	*/
+	bool compile(const MathStructure &mstruct, const MathStructure &x_var, const EvaluationOptions &eo = default_evaluation_options);
+	/** Compile an expression with any number of free symbols.
+	*
+	* @param mstruct Unevaluated expression.
+	* @param vars Free symbols (symbolic values or unknown variables). The order decides the order of values passed to run().
+	* @param eo Evaluation options that results shall be consistent with.
+	* @returns true if the expression was successfully compiled.
+	*/
+	bool compile(const MathStructure &mstruct, const vector<MathStructure> &vars, const EvaluationOptions &eo = default_evaluation_options);
+	/** Clears the plan. */
+	void clear();
+	/** Returns true if the plan has been successfully compiled. */
+	bool isValid() const;
+	/** Number of free symbols (and values to pass to run()). */
+	size_t countVariables() const;
+	/** Number of instructions in the plan. */
+	size_t size() const;
+
+	/** Run the plan.
+	*
+	* @param values Values for the free symbols, in the order they were passed to compile().
+	* @param[out] result Result of the calculation.
+	* @returns true if the calculation was successful and consistent with MathStructure::eval().
+	*/
+	bool run(const vector<Number> &values, Number &result);
+	/** Run a plan compiled with a single free symbol. */
+	bool run(const Number &x_value, Number &result);
+	/** Run a plan compiled with two free symbols. */
+	bool run(const Number &value1, const Number &value2, Number &result);
+
+};
+
+#endif
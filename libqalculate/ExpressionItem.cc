@@ -15,6 +15,8 @@
 #include "Calculator.h"
 #include "util.h"
 
+#include <glib.h>
+
 ExpressionName::ExpressionName(string sname) : suffix(false), unicode(false), plural(false), reference(false), avoid_input(false) {
 	name = sname;
 	if(text_length_is_one(sname)) {
@@ -440,12 +442,12 @@ void ExpressionItem::setHidden(bool is_hidden) {
 int ExpressionItem::refcount() const {
 	return i_ref;
 }
+// items are referenced from expressions in all threads that are calculating (see CalculationContext)
 void ExpressionItem::ref() {
-	i_ref++;
+	g_atomic_int_inc(&i_ref);
 }
 void ExpressionItem::unref() {
-	i_ref--;
-	if(b_destroyed && i_ref <= 0) {
+	if(g_atomic_int_add(&i_ref, -1) <= 1 && b_destroyed) {
 		delete this;
 	}
 }
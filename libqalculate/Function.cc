@@ -19,6 +19,8 @@
 #include "Number.h"
 #include "Unit.h"
 
+#include <glib.h>
+
 #if HAVE_UNORDERED_MAP
 #	include <unordered_map>
 #elif 	defined(__GNUC__)
@@ -52,9 +54,23 @@
 
 class MathFunction_p {
 	public:
+		MathFunction_p() : deferred_definition(NULL), b_loading(false) {}
 		unordered_map<size_t, Argument*> argdefs;
+		string *deferred_definition;
+		// true while the deferred definition is being loaded (in the thread holding deferred_definition_mutex)
+		bool b_loading;
 };
 
+/*
+	Deferred definitions might be loaded by several threads at the same time (see CalculationContext).
+	deferred_definition is set to NULL, with a memory barrier, only after the definition has been fully loaded,
+	so that a thread that finds it unset can use the function without locking.
+*/
+static GRecMutex deferred_definition_mutex;
+
+// loads the definition of a lazily loaded function before it is used or modified
+#define LOAD_DEFERRED_DEFINITION if(g_atomic_pointer_get(&priv->deferred_definition)) loadDeferredDefinition();
+
 MathFunction::MathFunction(string name_, int argc_, int max_argc_, string cat_, string title_, string descr_, bool is_active) : ExpressionItem(cat_, name_, title_, descr_, false, true, is_active) {
 	priv = new MathFunction_p;
 	argc = argc_;
@@ -82,13 +98,21 @@ MathFunction::MathFunction() {
 	last_argdef_index = 0;
 }
 MathFunction::~MathFunction() {
-	clearArgumentDefinitions();
+	for(unordered_map<size_t, Argument*>::iterator it = priv->argdefs.begin(); it != priv->argdefs.end(); ++it) {
+		delete it->second;
+	}
+	if(priv->deferred_definition) delete priv->deferred_definition;
 	delete priv;
 }
 
 void MathFunction::set(const ExpressionItem *item) {
 	if(item->type() == TYPE_FUNCTION) {
 		MathFunction *f = (MathFunction*) item;
+		if(priv->deferred_definition) {
+			// replaced by the definition of item
+			delete priv->deferred_definition;
+			priv->deferred_definition = NULL;
+		}
 		argc = f->minargs();
 		max_argc = f->maxargs();
 		default_values.clear();
@@ -122,23 +146,57 @@ int MathFunction::subtype() const {
 	}
 	return 1;
 }*/
+void MathFunction::setDeferredDefinition(const string &definition) {
+	if(priv->deferred_definition) delete priv->deferred_definition;
+	priv->deferred_definition = new string(definition);
+}
+bool MathFunction::hasDeferredDefinition() const {
+	return g_atomic_pointer_get(&priv->deferred_definition) != NULL;
+}
+void MathFunction::loadDeferredDefinition() const {
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&deferred_definition_mutex);
+	string *definition = priv->deferred_definition;
+	// the definition might have been loaded by another thread while waiting for the lock, and functions used while loading the definition must not load it again
+	if(!definition || priv->b_loading) {
+		g_rec_mutex_unlock(&deferred_definition_mutex);
+		thread_restore_cancel(cancel_state);
+		return;
+	}
+	priv->b_loading = true;
+	// loading the definition is not a change made by the user
+	bool b_changed = hasChanged();
+	CALCULATOR->loadFunctionDefinition((MathFunction*) this, *definition);
+	((MathFunction*) this)->setChanged(b_changed);
+	priv->b_loading = false;
+	g_atomic_pointer_set(&priv->deferred_definition, NULL);
+	g_rec_mutex_unlock(&deferred_definition_mutex);
+	thread_restore_cancel(cancel_state);
+	delete definition;
+}
 int MathFunction::args() const {
+	LOAD_DEFERRED_DEFINITION
 	return max_argc;
 }
 int MathFunction::minargs() const {
+	LOAD_DEFERRED_DEFINITION
 	return argc;
 }
 int MathFunction::maxargs() const {
+	LOAD_DEFERRED_DEFINITION
 	return max_argc;
 }
 string MathFunction::condition() const {
+	LOAD_DEFERRED_DEFINITION
 	return scondition;
 }
 void MathFunction::setCondition(string expression) {
+	LOAD_DEFERRED_DEFINITION
 	scondition = expression;
 	remove_blank_ends(scondition);
 }
 bool MathFunction::testCondition(const MathStructure &vargs) {
+	LOAD_DEFERRED_DEFINITION
 	if(scondition.empty()) {
 		return true;
 	}
@@ -157,6 +215,7 @@ bool MathFunction::testCondition(const MathStructure &vargs) {
 	return true;
 }
 string MathFunction::printCondition() {
+	LOAD_DEFERRED_DEFINITION
 	if(scondition.empty() || last_argdef_index == 0) return scondition;
 	string str = scondition;
 	string svar, argstr;
@@ -394,23 +453,28 @@ int MathFunction::args(const string &argstr, MathStructure &vargs, const ParseOp
 	return itmp;
 }
 size_t MathFunction::lastArgumentDefinitionIndex() const {
+	LOAD_DEFERRED_DEFINITION
 	return last_argdef_index;
 }
 Argument *MathFunction::getArgumentDefinition(size_t index) {
+	LOAD_DEFERRED_DEFINITION
 	if(priv->argdefs.find(index) != priv->argdefs.end()) {
 		return priv->argdefs[index];
 	}
 	return NULL;
 }
 void MathFunction::clearArgumentDefinitions() {
+	LOAD_DEFERRED_DEFINITION
 	for(unordered_map<size_t, Argument*>::iterator it = priv->argdefs.begin(); it != priv->argdefs.end(); ++it) {
 		delete it->second;
 	}
 	priv->argdefs.clear();
 	last_argdef_index = 0;
 	setChanged(true);
+	if(CALCULATOR && !priv->b_loading) CALCULATOR->parseDefinitionsChanged();
 }
 void MathFunction::setArgumentDefinition(size_t index, Argument *argdef) {
+	LOAD_DEFERRED_DEFINITION
 	if(priv->argdefs.find(index) != priv->argdefs.end()) {
 		delete priv->argdefs[index];
 	}
@@ -420,6 +484,7 @@ void MathFunction::setArgumentDefinition(size_t index, Argument *argdef) {
 	}
 	argdef->setIsLastArgument((int) index == maxargs());
 	setChanged(true);
+	if(CALCULATOR && !priv->b_loading) CALCULATOR->parseDefinitionsChanged();
 }
 bool MathFunction::testArgumentCount(int itmp) {
 	if(itmp >= minargs()) {
@@ -488,6 +553,7 @@ int MathFunction::parse(MathStructure &mstruct, const string &argv, const ParseO
 	return n;
 }
 bool MathFunction::testArguments(MathStructure &vargs) {
+	LOAD_DEFERRED_DEFINITION
 	size_t last = 0;
 	for(unordered_map<size_t, Argument*>::iterator it = priv->argdefs.begin(); it != priv->argdefs.end(); ++it) {
 		if(it->first > last) {
@@ -539,11 +605,14 @@ int MathFunction::calculate(MathStructure&, const MathStructure&, const Evaluati
 	return 0;
 }
 void MathFunction::setDefaultValue(size_t arg_, string value_) {
+	LOAD_DEFERRED_DEFINITION
 	if((int) arg_ > argc && (int) arg_ <= max_argc && (int) default_values.size() >= (int) arg_ - argc) {
 		default_values[arg_ - argc - 1] = value_;
+		if(CALCULATOR && !priv->b_loading) CALCULATOR->parseDefinitionsChanged();
 	}
 }
 const string &MathFunction::getDefaultValue(size_t arg_) const {
+	LOAD_DEFERRED_DEFINITION
 	if((int) arg_ > argc && (int) arg_ <= max_argc && (int) default_values.size() >= (int) arg_ - argc) {
 		return default_values[arg_ - argc - 1];
 	}
@@ -697,16 +766,25 @@ bool MathFunction::representsNonMatrix(const MathStructure &vargs) const {return
 UserFunction::UserFunction(string cat_, string name_, string formula_, bool is_local, int argc_, string title_, string descr_, int max_argc_, bool is_active) : MathFunction(name_, argc_, max_argc_, cat_, title_, descr_, is_active) {
 	b_local = is_local;
 	b_builtin = false;
+	parsed_formula = NULL;
+	parsed_generation = 0;
 	setFormula(formula_, argc_, max_argc_);
 	setChanged(false);
 }
 UserFunction::UserFunction(const UserFunction *function) {
+	parsed_formula = NULL;
+	parsed_generation = 0;
 	set(function);
 }
+UserFunction::~UserFunction() {
+	clearParsedFormula();
+}
 string UserFunction::formula() const {
+	LOAD_DEFERRED_DEFINITION
 	return sformula;
 }
 string UserFunction::internalFormula() const {
+	LOAD_DEFERRED_DEFINITION
 	return sformula_calc;
 }
 ExpressionItem *UserFunction::copy() const {
@@ -716,6 +794,7 @@ void UserFunction::set(const ExpressionItem *item) {
 	if(item->type() == TYPE_FUNCTION && item->subtype() == SUBTYPE_USER_FUNCTION) {
 		sformula = ((UserFunction*) item)->formula();
 		sformula_calc = ((UserFunction*) item)->internalFormula();
+		clearParsedFormula();
 		v_subs.clear();
 		v_precalculate.clear();
 		for(size_t i = 1; i <= ((UserFunction*) item)->countSubfunctions(); i++) {
@@ -729,15 +808,80 @@ int UserFunction::subtype() const {
 	return SUBTYPE_USER_FUNCTION;
 }
 
-int UserFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions &eo) {
+void user_function_find_slots(const MathStructure &mstruct, vector<size_t> &path, vector<vector<size_t> > &slot_paths, vector<size_t> &slots) {
+	if(mstruct.isSymbolic()) {
+		const string &str = mstruct.symbol();
+		if(str.length() > 3 && str[0] == ID_WRAP_LEFT_CH && str[1] == '\\' && str[str.length() - 1] == ID_WRAP_RIGHT_CH) {
+			slot_paths.push_back(path);
+			slots.push_back((size_t) s2i(str.substr(2, str.length() - 3)));
+		}
+		return;
+	}
+	for(size_t i = 0; i < mstruct.size(); i++) {
+		path.push_back(i);
+		user_function_find_slots(mstruct[i], path, slot_paths, slots);
+		path.pop_back();
+	}
+}
+string user_function_placeholder(size_t slot, vector<size_t> &v_id) {
+	string str = ID_WRAP_LEFT "\\";
+	str += i2s(slot);
+	str += ID_WRAP_RIGHT;
+	v_id.push_back(CALCULATOR->addId(new MathStructure(str), true));
+	str = LEFT_PARENTHESIS ID_WRAP_LEFT;
+	str += i2s(v_id[v_id.size() - 1]);
+	str += ID_WRAP_RIGHT RIGHT_PARENTHESIS;
+	return str;
+}
+void user_function_bind_slots(MathStructure &mstruct, const vector<vector<size_t> > &slot_paths, const vector<size_t> &slots, const vector<const MathStructure*> &v_values) {
+	for(size_t i = 0; i < slot_paths.size(); i++) {
+		if(slots[i] >= v_values.size()) continue;
+		MathStructure *m = &mstruct;
+		for(size_t i2 = 0; i2 < slot_paths[i].size(); i2++) {
+			m = &(*m)[slot_paths[i][i2]];
+		}
+		m->set(*v_values[slots[i]]);
+	}
+}
+
+void UserFunction::clearParsedFormula() {
+	if(parsed_formula) {
+		parsed_formula->mstruct->unref();
+		delete parsed_formula;
+		parsed_formula = NULL;
+	}
+	for(size_t i = 0; i < v_parsed_subs.size(); i++) {
+		if(v_parsed_subs[i]) {
+			v_parsed_subs[i]->mstruct->unref();
+			delete v_parsed_subs[i];
+		}
+	}
+	v_parsed_subs.clear();
+}
+// parsed formulas are created on first use, which might happen in several threads at the same time (see CalculationContext)
+static GRecMutex parsed_formula_mutex;
+
+void UserFunction::parseFormula() {
 
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&parsed_formula_mutex);
+	if(parsed_formula && parsed_generation == CALCULATOR->parseGeneration()) {
+		g_rec_mutex_unlock(&parsed_formula_mutex);
+		thread_restore_cancel(cancel_state);
+		return;
+	}
+	clearParsedFormula();
+	
 	ParseOptions po;
+	parsed_formula = new ParsedFormula;
+	parsed_formula->mstruct = new MathStructure();
 	if(args() != 0) {
 		string stmp = sformula_calc;
 		string svar;
 		string v_str, w_str;
 		vector<string> v_strs;
 		vector<size_t> v_id;
+		vector<size_t> path;
 		size_t i2 = 0;
 		int i_args = maxargs();
 		if(i_args < 0) {
@@ -745,26 +889,16 @@ int UserFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 		}
 		
 		for(int i = 0; i < i_args; i++) {
-			v_id.push_back(CALCULATOR->addId(new MathStructure(vargs[i]), true));
-			v_strs.push_back(LEFT_PARENTHESIS ID_WRAP_LEFT);
-			v_strs[i] += i2s(v_id[i]);
-			v_strs[i] += ID_WRAP_RIGHT RIGHT_PARENTHESIS;
+			v_strs.push_back(user_function_placeholder(i, v_id));
 		}
 		if(maxargs() < 0) {
 			if(stmp.find("\\v") != string::npos) {
-				v_id.push_back(CALCULATOR->addId(new MathStructure(produceVector(vargs)), true));
-				v_str = LEFT_PARENTHESIS ID_WRAP_LEFT;
-				v_str += i2s(v_id[v_id.size() - 1]);
-				v_str += ID_WRAP_RIGHT RIGHT_PARENTHESIS;
+				v_str = user_function_placeholder(i_args, v_id);
 			}
 			if(stmp.find("\\w") != string::npos) {
-				v_id.push_back(CALCULATOR->addId(new MathStructure(produceArgumentsVector(vargs)), true));
-				w_str = LEFT_PARENTHESIS ID_WRAP_LEFT;
-				w_str += i2s(v_id[v_id.size() - 1]);
-				w_str += ID_WRAP_RIGHT RIGHT_PARENTHESIS;
+				w_str = user_function_placeholder(i_args + 1, v_id);
 			}
 		}
-
 		for(size_t i = 0; i < v_subs.size(); i++) {
 			if(subfunctionPrecalculated(i + 1)) {
 				string str = v_subs[i];
@@ -814,13 +948,12 @@ int UserFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 						}
 					}			
 				}
-				MathStructure *v_mstruct = new MathStructure();
-				CALCULATOR->parse(v_mstruct, str, po);
-				v_mstruct->eval(eo);
-				v_id.push_back(CALCULATOR->addId(v_mstruct, true));
-				str = LEFT_PARENTHESIS ID_WRAP_LEFT;
-				str += i2s(v_id[v_id.size() - 1]);
-				str += ID_WRAP_RIGHT RIGHT_PARENTHESIS;
+				ParsedFormula *parsed_sub = new ParsedFormula;
+				parsed_sub->mstruct = new MathStructure();
+				CALCULATOR->parse(parsed_sub->mstruct, str, po);
+				user_function_find_slots(*parsed_sub->mstruct, path, parsed_sub->slot_paths, parsed_sub->slots);
+				v_parsed_subs.push_back(parsed_sub);
+				str = user_function_placeholder(i_args + 2 + i, v_id);
 				i2 = 0;
 				svar = '\\';
 				svar += i2s(i + 1);
@@ -836,6 +969,7 @@ int UserFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 					}
 				}
 			} else {
+				v_parsed_subs.push_back(NULL);
 				i2 = 0;
 				svar = '\\';
 				svar += i2s(i + 1);
@@ -905,21 +1039,85 @@ int UserFunction::calculate(MathStructure &mstruct, const MathStructure &vargs,
 				break;
 			}
 		}
-		CALCULATOR->parse(&mstruct, stmp, po);
+		CALCULATOR->parse(parsed_formula->mstruct, stmp, po);
+		user_function_find_slots(*parsed_formula->mstruct, path, parsed_formula->slot_paths, parsed_formula->slots);
 		for(size_t i = 0; i < v_id.size(); i++) {
 			CALCULATOR->delId(v_id[i]);
 		}
-		if(precision() > 0) mstruct.setPrecision(precision(), true);
-		if(isApproximate()) mstruct.setApproximate(true, true);
 	} else {
-		CALCULATOR->parse(&mstruct, sformula_calc, po);
-		if(precision() > 0) mstruct.setPrecision(precision(), true);
-		if(isApproximate()) mstruct.setApproximate(true, true);
+		CALCULATOR->parse(parsed_formula->mstruct, sformula_calc, po);
+	}
+	parsed_generation = CALCULATOR->parseGeneration();
+	g_rec_mutex_unlock(&parsed_formula_mutex);
+	thread_restore_cancel(cancel_state);
+	
+}
+
+int UserFunction::calculate(MathStructure &mstruct, const MathStructure &vargs, const EvaluationOptions &eo) {
+	LOAD_DEFERRED_DEFINITION
+
+	// the parsed formula and subfunctions are shared by calculation contexts, and might be replaced by another thread after the lock is released: copied, without shared numbers (see MathStructure::unshare()), while the lock is held
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&parsed_formula_mutex);
+	parseFormula();
+	vector<ParsedFormula> formulas(v_parsed_subs.size() + 1);
+	for(size_t i = 0; i < formulas.size(); i++) {
+		const ParsedFormula *pf = (i == 0 ? parsed_formula : v_parsed_subs[i - 1]);
+		if(!pf) {
+			formulas[i].mstruct = NULL;
+			continue;
+		}
+		formulas[i].mstruct = new MathStructure(*pf->mstruct);
+		formulas[i].mstruct->unshare();
+		formulas[i].slot_paths = pf->slot_paths;
+		formulas[i].slots = pf->slots;
+	}
+	g_rec_mutex_unlock(&parsed_formula_mutex);
+	thread_restore_cancel(cancel_state);
+
+	if(args() != 0) {
+		int i_args = maxargs();
+		if(i_args < 0) {
+			i_args = minargs();
+		}
+		vector<const MathStructure*> v_values;
+		for(int i = 0; i < i_args; i++) {
+			v_values.push_back(&vargs[i]);
+		}
+		MathStructure v_vector, w_vector;
+		if(maxargs() < 0) {
+			if(sformula_calc.find("\\v") != string::npos) v_vector = produceVector(vargs);
+			if(sformula_calc.find("\\w") != string::npos) w_vector = produceArgumentsVector(vargs);
+		}
+		v_values.push_back(&v_vector);
+		v_values.push_back(&w_vector);
+		vector<MathStructure> v_sub_values(formulas.size() - 1);
+		for(size_t i = 0; i < v_sub_values.size(); i++) {
+			if(formulas[i + 1].mstruct) {
+				v_sub_values[i].set_nocopy(*formulas[i + 1].mstruct);
+				user_function_bind_slots(v_sub_values[i], formulas[i + 1].slot_paths, formulas[i + 1].slots, v_values);
+				v_sub_values[i].eval(eo);
+			}
+		}
+		for(size_t i = 0; i < v_sub_values.size(); i++) {
+			v_values.push_back(&v_sub_values[i]);
+		}
+		mstruct.set_nocopy(*formulas[0].mstruct);
+		user_function_bind_slots(mstruct, formulas[0].slot_paths, formulas[0].slots, v_values);
+	} else {
+		mstruct.set_nocopy(*formulas[0].mstruct);
+	}
+	for(size_t i = 0; i < formulas.size(); i++) {
+		if(formulas[i].mstruct) formulas[i].mstruct->unref();
 	}
+	if(precision() > 0) mstruct.setPrecision(precision(), true);
+	if(isApproximate()) mstruct.setApproximate(true, true);
 	return 1;
 }
 void UserFunction::setFormula(string new_formula, int argc_, int max_argc_) {
+	LOAD_DEFERRED_DEFINITION
 	setChanged(true);
+	clearParsedFormula();
 	sformula = new_formula;
 	default_values.clear();
 	if(sformula.empty() && v_subs.empty()) {
@@ -1071,19 +1269,25 @@ void UserFunction::setFormula(string new_formula, int argc_, int max_argc_) {
 	max_argc = max_argc_;	
 }
 void UserFunction::addSubfunction(string subfunction, bool precalculate) {
+	LOAD_DEFERRED_DEFINITION
 	setChanged(true);
+	clearParsedFormula();
 	v_subs.push_back(subfunction);
 	v_precalculate.push_back(precalculate);
 }
 void UserFunction::setSubfunction(size_t index, string subfunction) {
+	LOAD_DEFERRED_DEFINITION
 	if(index > 0 && index <= v_subs.size()) {
 		setChanged(true);
+		clearParsedFormula();
 		v_subs[index - 1] = subfunction;
 	}
 }
 void UserFunction::delSubfunction(size_t index) {
+	LOAD_DEFERRED_DEFINITION
 	if(index > 0 && index <= v_subs.size()) {
 		setChanged(true);
+		clearParsedFormula();
 		v_subs.erase(v_subs.begin() + (index - 1));
 	}
 	if(index > 0 && index <= v_precalculate.size()) {
@@ -1092,26 +1296,33 @@ void UserFunction::delSubfunction(size_t index) {
 	}
 }
 void UserFunction::clearSubfunctions() {
+	LOAD_DEFERRED_DEFINITION
 	setChanged(true);
+	clearParsedFormula();
 	v_subs.clear();
 	v_precalculate.clear();
 }
 void UserFunction::setSubfunctionPrecalculated(size_t index, bool precalculate) {
+	LOAD_DEFERRED_DEFINITION
 	if(index > 0 && index <= v_precalculate.size()) {
 		setChanged(true);
+		clearParsedFormula();
 		v_precalculate[index - 1] = precalculate;
 	}
 }
 size_t UserFunction::countSubfunctions() const {
+	LOAD_DEFERRED_DEFINITION
 	return v_subs.size();
 }
 const string &UserFunction::getSubfunction(size_t index) const {
+	LOAD_DEFERRED_DEFINITION
 	if(index > 0 && index <= v_subs.size()) {
 		return v_subs[index - 1];
 	}
 	return empty_string;
 }
 bool UserFunction::subfunctionPrecalculated(size_t index) const {
+	LOAD_DEFERRED_DEFINITION
 	if(index > 0 && index <= v_precalculate.size()) {
 		return v_precalculate[index - 1];
 	}
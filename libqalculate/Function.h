@@ -76,6 +76,8 @@ class MathFunction : public ExpressionItem {
 	vector<string> default_values;
 	size_t last_argdef_index;		
 	bool testArguments(MathStructure &vargs);
+	/** Loads the deferred definition, if any. */
+	void loadDeferredDefinition() const;
 	virtual MathStructure createFunctionMathStructureFromVArgs(const MathStructure &vargs);
 	virtual MathStructure createFunctionMathStructureFromSVArgs(vector<string> &svargs);	
 	string scondition;
@@ -174,6 +176,16 @@ class MathFunction : public ExpressionItem {
 	* @param argdef A newly allocated argument definition 
 	*/
 	void setArgumentDefinition(size_t index, Argument *argdef);
+	/** Postpones loading of the formula, condition, subfunctions and argument definitions until they are first needed.
+	* Used for lazy loading of global definitions. The definition is loaded by Calculator::loadFunctionDefinition(), in one thread at a time, before the function is used.
+	* Since the definition could not have been used before, the load does not invalidate parsed expressions (see Calculator::parseDefinitionsChanged()).
+	*
+	* @param definition The elements of the function in the definitions file, inside a function element.
+	*/
+	void setDeferredDefinition(const string &definition);
+	/** Returns true if the definition of the function has not been loaded yet.
+	*/
+	bool hasDeferredDefinition() const;
 	int stringArgs(const string &str, vector<string> &svargs);
 	void setDefaultValue(size_t arg_, string value_);
 	const string &getDefaultValue(size_t arg_) const;
@@ -227,11 +239,27 @@ class UserFunction : public MathFunction {
 	string sformula, sformula_calc;
 	vector<string> v_subs;
 	vector<bool> v_precalculate;
+
+	/// Formula parsed with placeholders for arguments, \\v, \\w and precalculated subfunctions.
+	struct ParsedFormula {
+		MathStructure *mstruct;
+		vector<vector<size_t> > slot_paths;
+		vector<size_t> slots;
+	};
+	ParsedFormula *parsed_formula;
+	vector<ParsedFormula*> v_parsed_subs;
+	size_t parsed_generation;
+
+	/** Parses the formula and precalculated subfunctions, if not already done for the current parse generation. */
+	void parseFormula();
+	/** Removes the cached parsed formula. Called whenever the formula or subfunctions change. */
+	void clearParsedFormula();
 	
   public:
   
 	UserFunction(string cat_, string name_, string formula_, bool is_local = true, int argc_ = -1, string title_ = "", string descr_ = "", int max_argc_ = 0, bool is_active = true);
 	UserFunction(const UserFunction *function);
+	virtual ~UserFunction();
 	void set(const ExpressionItem *item);
 	ExpressionItem *copy() const;
 	/** Returns the external representation of the formula. */
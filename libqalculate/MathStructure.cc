@@ -18,8 +18,11 @@
 #include "Variable.h"
 #include "Unit.h"
 #include "Prefix.h"
+#include "EvaluationPlan.h"
 #include <map>
 #include <algorithm>
+#include <new>
+#include <glib.h>
 
 #define SWAP_CHILDREN(i1, i2)		MathStructure *swap_mstruct = v_subs[v_order[i1]]; v_subs[v_order[i1]] = v_subs[v_order[i2]]; v_subs[v_order[i2]] = swap_mstruct;
 #define CHILD_TO_FRONT(i)		v_order.insert(v_order.begin(), v_order[i]); v_order.erase(v_order.begin() + (i + 1));
@@ -184,6 +187,181 @@ size_t MathStructure::refcount() const {
 }
 
 
+/*
+	Node pool: memory of deleted structures is kept in a free list for each thread and reused for new structures.
+	Structures might be deleted in another thread than they were allocated in, so all memory is allocated with malloc() and freed with free().
+*/
+#define NODE_POOL_MAX_UNUSED 4096
+
+struct MathStructureNodePool {
+	vector<void*> unused;
+	size_t allocated, reused, live, peak;
+	int eval_depth;
+};
+
+void free_node_pool(gpointer data) {
+	MathStructureNodePool *pool = (MathStructureNodePool*) data;
+	for(size_t i = 0; i < pool->unused.size(); i++) free(pool->unused[i]);
+	delete pool;
+}
+
+static GPrivate node_pool_key = G_PRIVATE_INIT(free_node_pool);
+static bool node_pool_enabled = false;
+
+MathStructureNodePool *get_node_pool() {
+	MathStructureNodePool *pool = (MathStructureNodePool*) g_private_get(&node_pool_key);
+	if(!pool) {
+		pool = new MathStructureNodePool;
+		pool->allocated = 0;
+		pool->reused = 0;
+		pool->live = 0;
+		pool->peak = 0;
+		pool->eval_depth = 0;
+		g_private_set(&node_pool_key, pool);
+	}
+	return pool;
+}
+void trim_node_pool(MathStructureNodePool *pool, size_t max_unused) {
+	while(pool->unused.size() > max_unused) {
+		free(pool->unused.back());
+		pool->unused.pop_back();
+	}
+}
+
+void *MathStructure::operator new(size_t size) {
+	void *p = NULL;
+	if(node_pool_enabled && size == sizeof(MathStructure)) {
+		MathStructureNodePool *pool = get_node_pool();
+		pool->allocated++;
+		pool->live++;
+		if(pool->live > pool->peak) pool->peak = pool->live;
+		if(!pool->unused.empty()) {
+			pool->reused++;
+			p = pool->unused.back();
+			pool->unused.pop_back();
+			return p;
+		}
+	}
+	p = malloc(size);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+void MathStructure::operator delete(void *p) {
+	if(!p) return;
+	if(node_pool_enabled) {
+		MathStructureNodePool *pool = get_node_pool();
+		if(pool->live > 0) pool->live--;
+		if(pool->eval_depth > 0 || pool->unused.size() < NODE_POOL_MAX_UNUSED) {
+			pool->unused.push_back(p);
+			return;
+		}
+	}
+	free(p);
+}
+void MathStructure::setNodePoolEnabled(bool enable) {
+	node_pool_enabled = enable;
+	if(!enable) releaseNodePool();
+}
+bool MathStructure::nodePoolEnabled() {
+	return node_pool_enabled;
+}
+void MathStructure::nodePoolStatistics(size_t &allocated, size_t &reused, size_t &live, size_t &peak, size_t &pooled) {
+	MathStructureNodePool *pool = get_node_pool();
+	allocated = pool->allocated;
+	reused = pool->reused;
+	live = pool->live;
+	peak = pool->peak;
+	pooled = pool->unused.size();
+}
+void MathStructure::releaseNodePool() {
+	trim_node_pool(get_node_pool(), 0);
+}
+
+/*
+	Function memoization: with EvaluationOptions::memoize_functions, the results of function calls are remembered, for each thread, during a top-level call to eval()
+	and reused for identical function calls. A result is only reused if the function, the (tested) arguments, the evaluation options and the precision are identical.
+	Calls that issue messages, or that (directly or indirectly) call functions with side effects or random results, are not remembered.
+*/
+#define FUNCTION_MEMO_MAX_ENTRIES 10000
+
+struct FunctionMemoEntry {
+	MathFunction *function;
+	MathStructure args;
+	MathStructure result;
+	EvaluationOptions eo;
+	int precision;
+};
+
+struct FunctionMemo {
+	map<size_t, vector<FunctionMemoEntry*> > entries;
+	size_t n_entries;
+	size_t hits, misses;
+	size_t volatile_calls;
+	int eval_depth;
+};
+
+void clear_function_memo(FunctionMemo *memo) {
+	for(map<size_t, vector<FunctionMemoEntry*> >::iterator it = memo->entries.begin(); it != memo->entries.end(); ++it) {
+		for(size_t i = 0; i < it->second.size(); i++) delete it->second[i];
+	}
+	memo->entries.clear();
+	memo->n_entries = 0;
+}
+void free_function_memo(gpointer data) {
+	FunctionMemo *memo = (FunctionMemo*) data;
+	clear_function_memo(memo);
+	delete memo;
+}
+
+static GPrivate function_memo_key = G_PRIVATE_INIT(free_function_memo);
+
+FunctionMemo *get_function_memo() {
+	FunctionMemo *memo = (FunctionMemo*) g_private_get(&function_memo_key);
+	if(!memo) {
+		memo = new FunctionMemo;
+		memo->n_entries = 0;
+		memo->hits = 0;
+		memo->misses = 0;
+		memo->volatile_calls = 0;
+		memo->eval_depth = 0;
+		g_private_set(&function_memo_key, memo);
+	}
+	return memo;
+}
+
+bool function_memo_volatile(MathFunction *f) {
+	return f == CALCULATOR->f_rand || f == CALCULATOR->f_error || f == CALCULATOR->f_warning || f == CALCULATOR->f_message || f == CALCULATOR->f_save || f == CALCULATOR->f_load || f == CALCULATOR->f_export || f == CALCULATOR->f_register || f == CALCULATOR->f_stack || f == CALCULATOR->f_plot;
+}
+bool function_memo_options_equal(const EvaluationOptions &eo1, const EvaluationOptions &eo2) {
+	const ParseOptions &po1 = eo1.parse_options, &po2 = eo2.parse_options;
+	return eo1.approximation == eo2.approximation && eo1.sync_units == eo2.sync_units && eo1.sync_complex_unit_relations == eo2.sync_complex_unit_relations && eo1.keep_prefixes == eo2.keep_prefixes && eo1.calculate_variables == eo2.calculate_variables && eo1.calculate_functions == eo2.calculate_functions && eo1.test_comparisons == eo2.test_comparisons && eo1.isolate_x == eo2.isolate_x && eo1.expand == eo2.expand && eo1.reduce_divisions == eo2.reduce_divisions && eo1.allow_complex == eo2.allow_complex && eo1.allow_infinite == eo2.allow_infinite && eo1.assume_denominators_nonzero == eo2.assume_denominators_nonzero && eo1.warn_about_denominators_assumed_nonzero == eo2.warn_about_denominators_assumed_nonzero && eo1.split_squares == eo2.split_squares && eo1.keep_zero_units == eo2.keep_zero_units && eo1.auto_post_conversion == eo2.auto_post_conversion && eo1.mixed_units_conversion == eo2.mixed_units_conversion && eo1.structuring == eo2.structuring && eo1.isolate_var == eo2.isolate_var
+	&& po1.variables_enabled == po2.variables_enabled && po1.functions_enabled == po2.functions_enabled && po1.unknowns_enabled == po2.unknowns_enabled && po1.units_enabled == po2.units_enabled && po1.rpn == po2.rpn && po1.base == po2.base && po1.limit_implicit_multiplication == po2.limit_implicit_multiplication && po1.read_precision == po2.read_precision && po1.dot_as_separator == po2.dot_as_separator && po1.comma_as_separator == po2.comma_as_separator && po1.brackets_as_parentheses == po2.brackets_as_parentheses && po1.angle_unit == po2.angle_unit && po1.preserve_format == po2.preserve_format && po1.default_dataset == po2.default_dataset && po1.convert_temperature_units == po2.convert_temperature_units && po1.parsing_mode == po2.parsing_mode;
+}
+// Stricter than equals(): the order of all children and the approximation status of numbers must also be identical
+bool function_memo_identical(const MathStructure &m1, const MathStructure &m2) {
+	if(m1.type() != m2.type() || m1.size() != m2.size() || m1.isApproximate() != m2.isApproximate() || m1.precision() != m2.precision()) return false;
+	if(m1.uncertainty() || m2.uncertainty()) return false;
+	if(m1.isNumber()) return m1.number().isApproximateType() == m2.number().isApproximateType() && m1.number().isApproximate() == m2.number().isApproximate() && m1.number().precision() == m2.number().precision() && m1.number().equals(m2.number());
+	if(m1.size() == 0) return m1.equals(m2);
+	if(m1.isFunction() && m1.function() != m2.function()) return false;
+	if(m1.isComparison() && m1.comparisonType() != m2.comparisonType()) return false;
+	for(size_t i = 0; i < m1.size(); i++) {
+		if(!function_memo_identical(m1[i], m2[i])) return false;
+	}
+	return true;
+}
+
+void MathStructure::memoizationStatistics(size_t &hits, size_t &misses) {
+	FunctionMemo *memo = get_function_memo();
+	hits = memo->hits;
+	misses = memo->misses;
+}
+void MathStructure::resetMemoizationStatistics() {
+	FunctionMemo *memo = get_function_memo();
+	memo->hits = 0;
+	memo->misses = 0;
+}
+
 inline void MathStructure::init() {
 	m_type = STRUCT_NUMBER;
 	b_approx = false;
@@ -1205,6 +1383,15 @@ void MathStructure::setPrecision(int prec, bool recursive) {
 	}
 }
 
+void MathStructure::unshare() {
+	if(m_type == STRUCT_NUMBER) o_number.unshare();
+	if(function_value) function_value->unshare();
+	if(o_uncertainty) o_uncertainty->unshare();
+	for(size_t i = 0; i < SIZE; i++) {
+		CHILD(i).unshare();
+	}
+}
+
 void MathStructure::transform(StructureType mtype, const MathStructure &o) {
 	MathStructure *struct_this = new MathStructure();
 	struct_this->set_nocopy(*this);
@@ -1730,6 +1917,45 @@ bool MathStructure::equals(const MathStructure &o) const {
 	}
 	return true;
 }
+#define HASH_COMBINE(h, v) h ^= (size_t) (v) + 0x9e3779b9 + (h << 6) + (h >> 2);
+size_t MathStructure::structuralHash() const {
+	size_t h = (size_t) m_type;
+	HASH_COMBINE(h, SIZE)
+	switch(m_type) {
+		case STRUCT_UNDEFINED: {return h;}
+		case STRUCT_SYMBOLIC: {
+			for(size_t i = 0; i < s_sym.length(); i++) {
+				HASH_COMBINE(h, (unsigned char) s_sym[i])
+			}
+			return h;
+		}
+		case STRUCT_NUMBER: {HASH_COMBINE(h, o_number.hash()) return h;}
+		case STRUCT_VARIABLE: {HASH_COMBINE(h, (size_t) o_variable) return h;}
+		case STRUCT_UNIT: {
+			Prefix *p = (o_prefix == NULL || o_prefix == CALCULATOR->decimal_null_prefix || o_prefix == CALCULATOR->binary_null_prefix) ? NULL : o_prefix;
+			HASH_COMBINE(h, (size_t) o_unit)
+			HASH_COMBINE(h, (size_t) p)
+			return h;
+		}
+		case STRUCT_COMPARISON: {HASH_COMBINE(h, ct_comp) break;}
+		case STRUCT_FUNCTION: {HASH_COMBINE(h, (size_t) o_function) break;}
+		case STRUCT_LOGICAL_OR: {}
+		case STRUCT_LOGICAL_XOR: {}
+		case STRUCT_LOGICAL_AND: {
+			// the order of the operands is ignored by equals()
+			size_t h_children = 0;
+			for(size_t i = 0; i < SIZE; i++) h_children += CHILD(i).structuralHash();
+			HASH_COMBINE(h, h_children)
+			return h;
+		}
+		default: {}
+	}
+	if(o_uncertainty) HASH_COMBINE(h, o_uncertainty->structuralHash())
+	for(size_t i = 0; i < SIZE; i++) {
+		HASH_COMBINE(h, CHILD(i).structuralHash())
+	}
+	return h;
+}
 bool MathStructure::equals(const Number &o) const {
 	if(m_type != STRUCT_NUMBER) return false;
 	return o_number.equals(o);
@@ -1871,6 +2097,7 @@ ComparisonResult MathStructure::compareApproximately(const MathStructure &o) con
 }
 
 int MathStructure::merge_addition(MathStructure &mstruct, const EvaluationOptions &eo, MathStructure *mparent, size_t index_this, size_t index_mstruct, bool reversed) {
+	if(CALCULATOR->aborted(ABORT_LOCATION_MERGE)) return -1;
 	if(mstruct.type() == STRUCT_NUMBER && m_type == STRUCT_NUMBER) {
 		Number nr(o_number);
 		if(nr.add(mstruct.number()) && (eo.approximation == APPROXIMATION_APPROXIMATE || !nr.isApproximate() || o_number.isApproximate() || mstruct.number().isApproximate())) {
@@ -2331,6 +2558,7 @@ bool addablePower(const MathStructure &mstruct, const EvaluationOptions &eo) {
 }
 
 int MathStructure::merge_multiplication(MathStructure &mstruct, const EvaluationOptions &eo, MathStructure *mparent, size_t index_this, size_t index_mstruct, bool reversed, bool do_append) {
+	if(CALCULATOR->aborted(ABORT_LOCATION_MERGE)) return -1;
 	if(mstruct.type() == STRUCT_NUMBER && m_type == STRUCT_NUMBER) {
 		Number nr(o_number);
 		if(nr.multiply(mstruct.number()) && (eo.approximation == APPROXIMATION_APPROXIMATE || !nr.isApproximate() || o_number.isApproximate() || mstruct.number().isApproximate()) && (eo.allow_complex || !nr.isComplex() || o_number.isComplex() || mstruct.number().isComplex()) && (eo.allow_infinite || !nr.isInfinite() || o_number.isInfinite() || mstruct.number().isInfinite())) {
@@ -3048,6 +3276,7 @@ int MathStructure::merge_multiplication(MathStructure &mstruct, const Evaluation
 }
 
 int MathStructure::merge_power(MathStructure &mstruct, const EvaluationOptions &eo, MathStructure *mparent, size_t index_this, size_t index_mstruct, bool) {
+	if(CALCULATOR->aborted(ABORT_LOCATION_MERGE)) return -1;
 	if(mstruct.type() == STRUCT_NUMBER && m_type == STRUCT_NUMBER) {
 		Number nr(o_number);
 		if(nr.raise(mstruct.number(), eo.approximation != APPROXIMATION_APPROXIMATE) && (eo.approximation == APPROXIMATION_APPROXIMATE || !nr.isApproximate() || o_number.isApproximate() || mstruct.number().isApproximate()) && (eo.allow_complex || !nr.isComplex() || o_number.isComplex() || mstruct.number().isComplex()) && (eo.allow_infinite || !nr.isInfinite() || o_number.isInfinite() || mstruct.number().isInfinite())) {
@@ -4524,6 +4753,7 @@ int MathStructure::merge_bitwise_xor(MathStructure &mstruct, const EvaluationOpt
 
 #define MERGE_ALL(FUNC, TRY_LABEL) 	size_t i2, i3 = SIZE;\
 					for(size_t i = 0; i < SIZE - 1; i++) {\
+						if(CALCULATOR->aborted(ABORT_LOCATION_MERGE)) break;\
 						i2 = i + 1;\
 						TRY_LABEL:\
 						for(; i2 < i; i2++) {\
@@ -4586,6 +4816,8 @@ int MathStructure::merge_bitwise_xor(MathStructure &mstruct, const EvaluationOpt
 
 bool MathStructure::calculatesub(const EvaluationOptions &eo, const EvaluationOptions &feo, bool recursive, MathStructure *mparent, size_t index_this) {	
 	if(b_protected) return false;
+	if(CALCULATOR->aborted(ABORT_LOCATION_CALCULATESUB)) return false;
+	EvaluationStageTimer timer(EVALUATION_STAGE_CALCULATESUB);
 	bool b = false;
 	switch(m_type) {
 		case STRUCT_VARIABLE: {
@@ -5559,6 +5791,8 @@ bool MathStructure::calculateSubtract(const MathStructure &msub, const Evaluatio
 
 bool MathStructure::calculateFunctions(const EvaluationOptions &eo, bool recursive) {
 
+	EvaluationStageTimer timer(EVALUATION_STAGE_CALCULATE_FUNCTIONS);
+
 	if(m_type == STRUCT_FUNCTION) {
 
 		if(function_value) {
@@ -5609,7 +5843,56 @@ bool MathStructure::calculateFunctions(const EvaluationOptions &eo, bool recursi
 			return false;
 		}
 		MathStructure *mstruct = new MathStructure();
-		int i = o_function->calculate(*mstruct, *this, eo);
+		FunctionMemo *memo = NULL;
+		size_t memo_hash = 0;
+		if(eo.memoize_functions) {
+			memo = get_function_memo();
+			if(memo->eval_depth <= 0) memo = NULL;
+		}
+		if(memo && function_memo_volatile(o_function)) {
+			memo->volatile_calls++;
+			memo = NULL;
+		}
+		if(memo) {
+			memo_hash = structuralHash();
+			HASH_COMBINE(memo_hash, (size_t) o_function);
+			map<size_t, vector<FunctionMemoEntry*> >::iterator it = memo->entries.find(memo_hash);
+			if(it != memo->entries.end()) {
+				for(size_t i2 = 0; i2 < it->second.size(); i2++) {
+					FunctionMemoEntry *entry = it->second[i2];
+					if(entry->function == o_function && entry->precision == PRECISION && function_memo_identical(entry->args, *this) && function_memo_options_equal(entry->eo, eo)) {
+						memo->hits++;
+						mstruct->set(entry->result);
+						set_nocopy(*mstruct, true);
+						if(recursive) calculateFunctions(eo);
+						mstruct->unref();
+						return true;
+					}
+				}
+			}
+			memo->misses++;
+		}
+		size_t message_count = 0, volatile_calls = 0;
+		if(memo) {
+			message_count = CALCULATOR->messageCount();
+			volatile_calls = memo->volatile_calls;
+		}
+		int i;
+		{
+			EvaluationStageTimer function_timer(EVALUATION_STAGE_FUNCTION, o_function);
+			i = o_function->calculate(*mstruct, *this, eo);
+		}
+		if(memo && i > 0 && memo->n_entries < FUNCTION_MEMO_MAX_ENTRIES && message_count == CALCULATOR->messageCount() && volatile_calls == memo->volatile_calls) {
+			FunctionMemoEntry *entry = new FunctionMemoEntry;
+			entry->function = o_function;
+			entry->args.set(*this);
+			entry->args.setType(STRUCT_VECTOR);
+			entry->result.set(*mstruct);
+			entry->eo = eo;
+			entry->precision = PRECISION;
+			memo->entries[memo_hash].push_back(entry);
+			memo->n_entries++;
+		}
 		if(i > 0) {
 			set_nocopy(*mstruct, true);
 			if(recursive) calculateFunctions(eo);
@@ -6620,6 +6903,8 @@ bool factor1(const MathStructure &mstruct, MathStructure &mnum, MathStructure &m
 
 bool MathStructure::simplify(const EvaluationOptions &eo, bool unfactorize) {
 
+	EvaluationStageTimer timer(EVALUATION_STAGE_SIMPLIFY);
+
 	if(SIZE == 0) return false;
 
 	if(unfactorize) {
@@ -6730,6 +7015,19 @@ void MathStructure::calculateUncertaintyPropagation(const EvaluationOptions &eo)
 
 MathStructure &MathStructure::eval(const EvaluationOptions &eo) {
 
+	EvaluationStageTimer timer(EVALUATION_STAGE_TOTAL);
+
+	MathStructureNodePool *pool = NULL;
+	if(node_pool_enabled) {
+		pool = get_node_pool();
+		pool->eval_depth++;
+	}
+	FunctionMemo *memo = NULL;
+	if(eo.memoize_functions) {
+		memo = get_function_memo();
+		memo->eval_depth++;
+	}
+
 	unformat(eo);
 
 	bool found_complex_relations = false;
@@ -6846,7 +7144,14 @@ MathStructure &MathStructure::eval(const EvaluationOptions &eo) {
 		clean_multiplications(*this);
 	}
 	
-	
+	if(memo) {
+		memo->eval_depth--;
+		if(memo->eval_depth == 0) clear_function_memo(memo);
+	}
+	if(pool) {
+		pool->eval_depth--;
+		if(pool->eval_depth == 0) trim_node_pool(pool, NODE_POOL_MAX_UNUSED);
+	}
 
 	return *this;
 }
@@ -6868,6 +7173,19 @@ bool factorize_find_multiplier(const MathStructure &mstruct, MathStructure &mnew
 				}
 			}
 			if(mstruct.size() > 0) {
+				// structural hashes of the factors in the terms (and of the bases, for powers), to avoid most comparisons
+				vector<vector<size_t> > cmp_hashes(mstruct.size()), cmp_base_hashes(mstruct.size());
+				for(size_t i2 = 1; i2 < mstruct.size(); i2++) {
+					if(mstruct[i2].isMultiplication()) {
+						for(size_t i3 = 0; i3 < mstruct[i2].size(); i3++) {
+							cmp_hashes[i2].push_back(mstruct[i2][i3].structuralHash());
+							cmp_base_hashes[i2].push_back(mstruct[i2][i3].isPower() ? mstruct[i2][i3][0].structuralHash() : 0);
+						}
+					} else {
+						cmp_hashes[i2].push_back(mstruct[i2].structuralHash());
+						cmp_base_hashes[i2].push_back(mstruct[i2].isPower() ? mstruct[i2][0].structuralHash() : 0);
+					}
+				}
 				size_t i = 0;
 				const MathStructure *cur_mstruct;
 				while(true) {
@@ -6888,6 +7206,7 @@ bool factorize_find_multiplier(const MathStructure &mstruct, MathStructure &mnew
 						} else {
 							bas = cur_mstruct;
 						}
+						size_t bas_hash = bas->structuralHash();
 						bool b = true;
 						for(size_t i2 = 1; i2 < mstruct.size(); i2++) {
 							b = false;
@@ -6902,13 +7221,13 @@ bool factorize_find_multiplier(const MathStructure &mstruct, MathStructure &mnew
 								} else {
 									cmp_mstruct = &mstruct[i2];
 								}
-								if(cmp_mstruct->equals(*bas)) {
+								if(cmp_hashes[i2][i3] == bas_hash && cmp_mstruct->equals(*bas)) {
 									if(exp) {
 										exp = NULL;
 									}
 									b = true;
 									break;
-								} else if(cmp_mstruct->isPower() && cmp_mstruct->base()->equals(*bas)) {
+								} else if(cmp_mstruct->isPower() && cmp_base_hashes[i2][i3] == bas_hash && cmp_mstruct->base()->equals(*bas)) {
 									if(exp) {
 										if(IS_REAL((*cmp_mstruct)[1])) {
 											if(cmp_mstruct->exponent()->number().isLessThan(exp->number())) {
@@ -8853,6 +9172,8 @@ bool MathStructure::integerFactorize() {
 	return true;
 }
 bool MathStructure::factorize(const EvaluationOptions &eo) {
+	if(CALCULATOR->aborted(ABORT_LOCATION_FACTORIZE)) return false;
+	EvaluationStageTimer timer(EVALUATION_STAGE_FACTORIZE);
 	MathStructure mden, mnum;
 	if(containsDivision() && factor1(*this, mnum, mden, eo)) {
 		set_nocopy(mnum);
@@ -9156,6 +9477,7 @@ bool MathStructure::factorize(const EvaluationOptions &eo) {
 							prevdeg = curdeg;
 						}
 						while(b && degree > 2) {
+							if(CALCULATOR->aborted(ABORT_LOCATION_FACTORIZE)) break;
 							for(int i = 1; i <= 1000; i++) {
 								if(i > pcof) break;
 								if(pcof % i == 0) ps.push_back(i);
@@ -9501,6 +9823,10 @@ void MathStructure::addChild(const MathStructure &o) {
 void MathStructure::addChild_nocopy(MathStructure *o) {
 	APPEND_POINTER(o);
 }
+void MathStructure::reserveChildren(size_t n) {
+	v_subs.reserve(n);
+	v_order.reserve(n);
+}
 void MathStructure::delChild(size_t index) {
 	if(index > 0 && index <= SIZE) {
 		ERASE(index - 1);
@@ -9589,6 +9915,7 @@ StructureType MathStructure::type() const {
 	return m_type;
 }
 void MathStructure::unformat(const EvaluationOptions &eo) {
+	EvaluationStageTimer timer(EVALUATION_STAGE_UNFORMAT);
 	for(size_t i = 0; i < SIZE; i++) {
 		CHILD(i).unformat(eo);
 	}
@@ -10583,6 +10910,7 @@ void MathStructure::prefixCurrencies() {
 }
 
 void MathStructure::format(const PrintOptions &po) {
+	EvaluationStageTimer timer(EVALUATION_STAGE_FORMAT);
 	if(!po.preserve_format) {
 		if(po.place_units_separately) {
 			factorizeUnits();
@@ -11369,6 +11697,7 @@ int MathStructure::neededMultiplicationSign(const PrintOptions &po, const Intern
 }
 
 string MathStructure::print(const PrintOptions &po, const InternalPrintStruct &ips) const {
+	EvaluationStageTimer timer(EVALUATION_STAGE_PRINT);
 	if(ips.depth == 0 && po.is_approximate) *po.is_approximate = false;
 	string print_str;
 	InternalPrintStruct ips_n = ips;
@@ -12153,6 +12482,7 @@ int MathStructure::gaussianElimination(const EvaluationOptions &eo, bool det) {
 	
 	size_t r0 = 0;
 	for(size_t c0 = 0; c0 < n && r0 < m - 1; ++c0) {
+		if(CALCULATOR->aborted(ABORT_LOCATION_GAUSSIAN_ELIMINATION)) return 0;
 		int indx = pivot(r0, c0, true);
 		if(indx == -1) {
 			sign = 0;
@@ -12608,6 +12938,7 @@ int MathStructure::isUnitCompatible(const MathStructure &mstruct) {
 }
 
 bool MathStructure::syncUnits(bool sync_complex_relations, bool *found_complex_relations, bool calculate_new_functions, const EvaluationOptions &feo) {
+	EvaluationStageTimer timer(EVALUATION_STAGE_SYNC_UNITS);
 	vector<Unit*> base_units;
 	vector<AliasUnit*> alias_units;
 	vector<CompositeUnit*> composite_units;	
@@ -13288,14 +13619,21 @@ MathStructure MathStructure::generateVector(MathStructure x_mstruct, const MathS
 	if(!step.isNumber() || step.number().isNegative()) {
 		return y_vector;
 	}
+	EvaluationPlan plan;
+	bool b_plan = plan.compile(*this, x_mstruct, eo);
+	Number nr_y;
 	for(int i = 0; i < steps; i++) {
 		if(x_vector) {
 			x_vector->addChild(x_value);
 		}
-		y_value = *this;
-		y_value.replace(x_mstruct, x_value);
-		y_value.eval(eo);
-		y_vector.addChild(y_value);
+		if(b_plan && x_value.isNumber() && plan.run(x_value.number(), nr_y)) {
+			y_vector.addChild_nocopy(new MathStructure(nr_y));
+		} else {
+			y_value = *this;
+			y_value.replace(x_mstruct, x_value);
+			y_value.eval(eo);
+			y_vector.addChild(y_value);
+		}
 		x_value.calculateAdd(step, eo);
 	}
 	return y_vector;
@@ -13313,15 +13651,22 @@ MathStructure MathStructure::generateVector(MathStructure x_mstruct, const MathS
 			return y_vector;
 		}
 	}
+	EvaluationPlan plan;
+	bool b_plan = plan.compile(*this, x_mstruct, eo);
+	Number nr_y;
 	ComparisonResult cr = max.compare(x_value);
 	while(COMPARISON_IS_EQUAL_OR_LESS(cr)) {
 		if(x_vector) {
 			x_vector->addChild(x_value);
 		}
-		y_value = *this;
-		y_value.replace(x_mstruct, x_value);
-		y_value.eval(eo);
-		y_vector.addChild(y_value);
+		if(b_plan && x_value.isNumber() && plan.run(x_value.number(), nr_y)) {
+			y_vector.addChild_nocopy(new MathStructure(nr_y));
+		} else {
+			y_value = *this;
+			y_value.replace(x_mstruct, x_value);
+			y_value.eval(eo);
+			y_vector.addChild(y_value);
+		}
 		x_value.calculateAdd(step, eo);
 		if(cr == COMPARISON_RESULT_EQUAL) break;
 		cr = max.compare(x_value);
@@ -13332,11 +13677,18 @@ MathStructure MathStructure::generateVector(MathStructure x_mstruct, const MathS
 	MathStructure y_value;
 	MathStructure y_vector;
 	y_vector.clearVector();
+	EvaluationPlan plan;
+	bool b_plan = plan.compile(*this, x_mstruct, eo);
+	Number nr_y;
 	for(size_t i = 1; i <= x_vector.countChildren(); i++) {
-		y_value = *this;
-		y_value.replace(x_mstruct, x_vector.getChild(i));
-		y_value.eval(eo);
-		y_vector.addChild(y_value);
+		if(b_plan && x_vector.getChild(i)->isNumber() && plan.run(x_vector.getChild(i)->number(), nr_y)) {
+			y_vector.addChild_nocopy(new MathStructure(nr_y));
+		} else {
+			y_value = *this;
+			y_value.replace(x_mstruct, x_vector.getChild(i));
+			y_value.eval(eo);
+			y_vector.addChild(y_value);
+		}
 	}
 	return y_vector;
 }
@@ -14968,6 +15320,7 @@ bool MathStructure::isolate_x(const EvaluationOptions &eo, const MathStructure &
 }
 bool MathStructure::isolate_x(const EvaluationOptions &eo, const EvaluationOptions &feo, const MathStructure &x_varp, bool check_result) {
 	if(isProtected()) return false;
+	EvaluationStageTimer timer(EVALUATION_STAGE_ISOLATE_X);
 	if(!isComparison()) {		
 		bool b = false;
 		for(size_t i = 0; i < SIZE; i++) {
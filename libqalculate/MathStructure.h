@@ -223,6 +223,43 @@ class MathStructure {
 		MathStructure(const Number &o);
 		~MathStructure();
 		//@}
+
+		/** @name Functions for allocation of structures */
+		//@{
+		void *operator new(size_t size);
+		void operator delete(void *p);
+		/** Enables or disables the node pool. When enabled, the memory of deleted structures (allocated with new) is kept in a pool, for each thread, and reused for new structures.
+		* Unused memory is released in bulk, down to a limit, when a top-level call to eval() finishes. The pool is disabled by default.
+		*
+		* @param enable Enable the node pool.
+		*/
+		static void setNodePoolEnabled(bool enable = true);
+		/** Returns true if the node pool is enabled. */
+		static bool nodePoolEnabled();
+		/** Returns allocation statistics for the current thread, counted while the node pool was enabled.
+		*
+		* @param[out] allocated Number of structures allocated with new.
+		* @param[out] reused Number of allocations that reused memory from the pool.
+		* @param[out] live Number of allocated structures that have not been deleted.
+		* @param[out] peak Highest number of live structures.
+		* @param[out] pooled Number of unused structures currently kept in the pool.
+		*/
+		static void nodePoolStatistics(size_t &allocated, size_t &reused, size_t &live, size_t &peak, size_t &pooled);
+		/** Releases all unused memory in the node pool of the current thread. */
+		static void releaseNodePool();
+		//@}
+
+		/** @name Functions for memoization of function calls */
+		//@{
+		/** Returns the number of reused (hits) and calculated (misses) function calls, in the current thread, during evaluations with EvaluationOptions::memoize_functions set to true.
+		*
+		* @param[out] hits Number of function calls that reused the result of an identical earlier function call.
+		* @param[out] misses Number of function calls that were calculated.
+		*/
+		static void memoizationStatistics(size_t &hits, size_t &misses);
+		/** Resets the memoization statistics of the current thread. */
+		static void resetMemoizationStatistics();
+		//@}
 		
 		/** @name Functions/operators for setting type and content */
 		//@{
@@ -409,6 +446,8 @@ class MathStructure {
 		void childToFront(size_t index);
 		void addChild(const MathStructure &o);
 		void addChild_nocopy(MathStructure *o);
+		/** Reserves space for the specified number of children, to avoid repeated reallocation when many children are added. */
+		void reserveChildren(size_t n);
 		void delChild(size_t index);
 		void insertChild(const MathStructure &o, size_t index);
 		void insertChild_nocopy(MathStructure *o, size_t index);
@@ -497,6 +536,10 @@ class MathStructure {
 		void setApproximate(bool is_approx = true, bool recuresive = false);
 		bool isApproximate() const;		
 		void setPrecision(int prec, bool recursive = false);
+		/** Replaces all numbers in the structure with equal numbers in newly allocated memory (see Number::unshare()).
+		* Used for copies of values shared by calculation contexts in different threads.
+		*/
+		void unshare();
 		int precision() const;
 		void mergePrecision(const MathStructure &o);
 		//@}
@@ -619,6 +662,11 @@ class MathStructure {
 		bool equals(Unit *u) const;
 		bool equals(Variable *v) const;
 		bool equals(string sym) const;
+		/** Returns a hash value for the structure. Structures that are equal according to equals() always have the same hash value,
+		* so structures with different hash values can be considered unequal without further comparison.
+		* The hash value is calculated from the whole structure each time this function is called.
+		*/
+		size_t structuralHash() const;
 		
 		ComparisonResult compare(const MathStructure &o) const;
 		ComparisonResult compareApproximately(const MathStructure &o) const;
@@ -15,6 +15,8 @@
 #include "Calculator.h"
 
 #include <limits.h>
+#include <float.h>
+#include <cmath>
 #include <sstream>
 #include "util.h"
 
@@ -29,6 +31,66 @@
 
 using namespace cln;
 
+/*
+	Hardware float mode (Calculator::useHardwareFloat()): floating point calculations with real numbers use machine doubles and libm, instead of CLN, when the precision is DBL_DIG or less.
+	Exact calculations, complex numbers and results that are not finite or underflow are left to CLN.
+*/
+bool hardware_float_mode() {
+	return PRECISION <= DBL_DIG && CALCULATOR->usesHardwareFloat();
+}
+bool hardware_float_value(const cl_N &x, double &d) {
+	if(!cln::instanceof(x, cln::cl_R_ring)) return false;
+	d = cln::double_approx(cln::realpart(x));
+	return std::isfinite(d);
+}
+// the operand must be a floating point number
+bool hardware_float_operand(const cl_N &x, double &d) {
+	if(cln::instanceof(x, cln::cl_RA_ring)) return false;
+	return hardware_float_mode() && hardware_float_value(x, d);
+}
+// at least one of the operands must be a floating point number
+bool hardware_float_operands(const cl_N &x1, const cl_N &x2, double &d1, double &d2) {
+	if(cln::instanceof(x1, cln::cl_RA_ring) && cln::instanceof(x2, cln::cl_RA_ring)) return false;
+	return hardware_float_mode() && hardware_float_value(x1, d1) && hardware_float_value(x2, d2);
+}
+bool hardware_float_result(double d) {
+	return std::isfinite(d) && std::fabs(d) >= DBL_MIN;
+}
+
+/*
+	cln::default_float_format is shared by all threads and only follows the precision of the default calculation context (see Calculator::setPrecision()).
+	CLN takes the float format from it when a function is called with an exact argument, so exact arguments are converted to the float format of the current context first.
+*/
+cln::float_format_t precision_float_format(int precision, bool hardware_float) {
+	if(hardware_float && precision <= DBL_DIG) return cln::float_format_dfloat;
+	if(precision < cln::float_format_lfloat_min) return cln::float_format(cln::float_format_lfloat_min + 5);
+	return cln::float_format(precision + 5);
+}
+cln::float_format_t context_float_format() {
+	return precision_float_format(PRECISION, CALCULATOR->usesHardwareFloat());
+}
+bool context_uses_default_float_format() {
+	return context_float_format() == cln::default_float_format;
+}
+bool exact_value(const cl_N &x) {
+	if(cln::instanceof(x, cln::cl_R_ring)) return cln::instanceof(x, cln::cl_RA_ring);
+	return cln::instanceof(cln::realpart(x), cln::cl_RA_ring) && cln::instanceof(cln::imagpart(x), cln::cl_RA_ring);
+}
+// exact zero is left as is, since CLN returns exact results for it
+cl_N context_float(const cl_N &x) {
+	cln::float_format_t f = context_float_format();
+	if(f == cln::default_float_format || cln::zerop(x)) return x;
+	if(cln::instanceof(x, cln::cl_R_ring)) {
+		if(!cln::instanceof(x, cln::cl_RA_ring)) return x;
+		return cln::cl_float(cln::realpart(x), f);
+	}
+	cln::cl_R re = cln::realpart(x);
+	cln::cl_R im = cln::imagpart(x);
+	if(cln::instanceof(re, cln::cl_RA_ring)) re = cln::cl_float(re, f);
+	if(cln::instanceof(im, cln::cl_RA_ring)) im = cln::cl_float(im, f);
+	return cln::complex(re, im);
+}
+
 /*
 void cln::cl_abort() {
 	CALCULATOR->error(true, "CLN Error: see terminal output (probably too large or small floating point number)", NULL);
@@ -251,7 +313,7 @@ Number::~Number() {
 
 void Number::set(string number, const ParseOptions &po) {
 
-	b_inf = false; b_pinf = false; b_minf = false; b_approx = false;
+	b_inf = false; b_pinf = false; b_minf = false; b_approx = false; b_small = false;
 
 	if(po.base == BASE_ROMAN_NUMERALS) {
 		remove_blanks(number);
@@ -531,6 +593,7 @@ void Number::set(string number, const ParseOptions &po) {
 				Number divisor(1, 1);
 				Number num_temp;
 				value = 0;
+				b_small = false;
 				i_precision = -1;				
 				index = 0;				
 				while(index_colon < number.size()) {
@@ -587,8 +650,10 @@ void Number::set(string number, const ParseOptions &po) {
 	if(minus) num = -num;
 	if(b_cplx) {
 		value = cln::complex(0, num / den);
+		b_small = false;
 	} else {
 		value = num / den;
+		testSmall();
 	}
 	if(po.read_precision == ALWAYS_READ_PRECISION || (in_decimals && po.read_precision == READ_PRECISION_WHEN_DECIMALS)) {
 		if(base != 10) {
@@ -608,9 +673,11 @@ void Number::set(string number, const ParseOptions &po) {
 void Number::set(int numerator, int denominator, int exp_10) {
 	b_inf = false; b_pinf = false; b_minf = false; b_approx = false;
 	i_precision = -1;
-	value = numerator;
 	if(denominator) {
-		value = value / denominator;
+		setSmall(numerator, denominator);
+	} else {
+		value = numerator;
+		b_small = false;
 	}
 	if(exp_10 != 0) {
 		exp10(exp_10);
@@ -619,16 +686,35 @@ void Number::set(int numerator, int denominator, int exp_10) {
 void Number::setFloat(double d_value) {
 	b_inf = false; b_pinf = false; b_minf = false; b_approx = true;
 	value = d_value;
+	b_small = false;
 	i_precision = 8;
 }
 void Number::setInternal(const cl_N &cln_value) {
 	b_inf = false; b_pinf = false; b_minf = false; b_approx = false;
 	value = cln_value;
+	testSmall();
 	i_precision = -1;
 	testApproximate();
 }
+cl_R unshared_real(const cl_R &x) {
+	if(cln::instanceof(x, cln::cl_RA_ring)) {
+		cl_RA r = cln::rational(x);
+		cl_I num = -(-cln::numerator(r));
+		cl_I den = -(-cln::denominator(r));
+		if(den == 1) return num;
+		return num / den;
+	}
+	const cl_F &f = The(cl_F)(x);
+	if(cln::zerop(f)) return cln::cl_float(0, cln::float_format(f));
+	return -(-f);
+}
+void Number::unshare() {
+	if(cln::instanceof(value, cln::cl_R_ring)) value = unshared_real(cln::realpart(value));
+	else value = cln::complex(unshared_real(cln::realpart(value)), unshared_real(cln::imagpart(value)));
+}
 void Number::setImaginaryPart(const Number &o) {
 	value = cln::complex(cln::realpart(value), cln::realpart(o.internalNumber()));
+	b_small = false;
 	testApproximate();
 }
 void Number::setImaginaryPart(int numerator, int denominator, int exp_10) {
@@ -640,6 +726,11 @@ void Number::set(const Number &o) {
 	b_pinf = o.isPlusInfinity(); 
 	b_minf = o.isMinusInfinity();
 	value = o.internalNumber();
+	b_small = o.b_small;
+	if(b_small) {
+		l_num = o.l_num;
+		l_den = o.l_den;
+	}
 	b_approx = o.isApproximate();
 	i_precision = o.precision();
 }
@@ -649,6 +740,7 @@ void Number::setInfinity() {
 	b_minf = false;
 	b_approx = false;
 	value = 0;
+	b_small = false;
 	i_precision = -1;
 }
 void Number::setPlusInfinity() {
@@ -657,6 +749,7 @@ void Number::setPlusInfinity() {
 	b_minf = false;
 	b_approx = false;
 	value = 0;
+	b_small = false;
 	i_precision = -1;
 }
 void Number::setMinusInfinity() {
@@ -665,15 +758,93 @@ void Number::setMinusInfinity() {
 	b_minf = true;
 	b_approx = false;
 	value = 0;
+	b_small = false;
 	i_precision = -1;
 }
 
 void Number::clear() {
 	b_inf = false; b_pinf = false; b_minf = false; b_approx = false;
 	value = 0;
+	b_small = true;
+	l_num = 0;
+	l_den = 1;
 	i_precision = -1;
 }
 
+/*
+	Small exact rational numbers (numerator and denominator with an absolute value not larger than LONG_MAX) are also stored inline in l_num and l_den.
+	Arithmetic with and tests of such numbers use native integer operations, with overflow checks, instead of the generic CLN functions.
+	If the result does not fit, the CLN value is used as usual.
+*/
+long int small_gcd(long int a, long int b) {
+	if(a < 0) a = -a;
+	while(b != 0) {
+		long int r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+// returns false if the reduced fraction does not fit
+bool small_fraction(long int &num, long int &den) {
+	if(den == 0 || num == LONG_MIN || den == LONG_MIN) return false;
+	if(den < 0) {
+		num = -num;
+		den = -den;
+	}
+	if(den != 1) {
+		long int g = small_gcd(num, den);
+		if(g > 1) {
+			num /= g;
+			den /= g;
+		}
+	}
+	return true;
+}
+bool small_add(long int n1, long int d1, long int n2, long int d2, long int &num, long int &den) {
+	if(d1 == 1 && d2 == 1) {
+		den = 1;
+		return !__builtin_add_overflow(n1, n2, &num) && num != LONG_MIN;
+	}
+	long int a, b;
+	if(__builtin_mul_overflow(n1, d2, &a) || __builtin_mul_overflow(n2, d1, &b) || __builtin_add_overflow(a, b, &num) || __builtin_mul_overflow(d1, d2, &den)) return false;
+	return small_fraction(num, den);
+}
+bool small_multiply(long int n1, long int d1, long int n2, long int d2, long int &num, long int &den) {
+	if(d1 != 1 || d2 != 1) {
+		// cross-reduce first to avoid unnecessary overflow
+		long int g1 = small_gcd(n1, d2), g2 = small_gcd(n2, d1);
+		if(g1 > 1) {n1 /= g1; d2 /= g1;}
+		if(g2 > 1) {n2 /= g2; d1 /= g2;}
+	}
+	if(__builtin_mul_overflow(n1, n2, &num) || __builtin_mul_overflow(d1, d2, &den)) return false;
+	return num != LONG_MIN && den != LONG_MIN;
+}
+
+void Number::setSmall(long int numerator, long int denominator) {
+	if(!small_fraction(numerator, denominator)) {
+		value = cln::cl_I(numerator);
+		if(denominator != 1) value = value / cln::cl_I(denominator);
+		b_small = false;
+		return;
+	}
+	l_num = numerator;
+	l_den = denominator;
+	b_small = true;
+	if(l_den == 1) value = cln::cl_I(l_num);
+	else value = cln::cl_I(l_num) / cln::cl_I(l_den);
+}
+void Number::testSmall() {
+	b_small = false;
+	if(isInfinite() || !cln::instanceof(value, cln::cl_RA_ring)) return;
+	cl_RA r = cln::rational(cln::realpart(value));
+	cl_I num = cln::numerator(r), den = cln::denominator(r);
+	if(num > LONG_MAX || num < -LONG_MAX || den > LONG_MAX) return;
+	l_num = cln::cl_I_to_long(num);
+	l_den = cln::cl_I_to_long(den);
+	b_small = true;
+}
+
 const cl_N &Number::internalNumber() const {
 	return value;
 }
@@ -682,6 +853,7 @@ double Number::floatValue() const {
 	return double_approx(cln::realpart(value));
 }
 int Number::intValue(bool *overflow) const {
+	if(b_small && l_den == 1 && l_num <= INT_MAX && l_num >= INT_MIN) return (int) l_num;
 	cl_I i;
 	try {
 		i = cln::round1(cln::realpart(value));
@@ -702,6 +874,7 @@ bool Number::isApproximate() const {
 	return b_approx || isApproximateType();	
 }
 bool Number::isApproximateType() const {
+	if(b_small) return false;
 	return !isInfinite() && (!cln::instanceof(cln::realpart(value), cln::cl_RA_ring) || (isComplex() && !cln::instanceof(cln::imagpart(value), cln::cl_RA_ring)));	
 }
 void Number::setApproximate(bool is_approximate) {
@@ -714,6 +887,7 @@ void Number::setApproximate(bool is_approximate) {
 		} else {
 			if(isApproximateType()) {
 				value = cln::complex(cln::rational(cln::realpart(value)), cln::rational(cln::imagpart(value)));
+				b_small = false;
 			}
 			i_precision = -1;
 			b_approx = false;
@@ -779,8 +953,8 @@ Number Number::complexDenominator() const {
 }
 
 void Number::operator = (const Number &o) {set(o);}
-void Number::operator -- (int) {value = cln::minus1(value);}
-void Number::operator ++ (int) {value = cln::plus1(value);}
+void Number::operator -- (int) {value = cln::minus1(value); b_small = false;}
+void Number::operator ++ (int) {value = cln::plus1(value); b_small = false;}
 Number Number::operator - () const {Number o(*this); o.negate(); return o;}
 Number Number::operator * (const Number &o) const {Number o2(*this); o2.multiply(o); return o2;}
 Number Number::operator / (const Number &o) const {Number o2(*this); o2.divide(o); return o2;}
@@ -804,6 +978,7 @@ bool Number::bitAnd(const Number &o) {
 	if(!o.isInteger() || !isInteger()) return false;
 	try {
 		value = cln::logand(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -814,6 +989,7 @@ bool Number::bitOr(const Number &o) {
 	if(!o.isInteger() || !isInteger()) return false;
 	try {
 		value = cln::logior(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -824,6 +1000,7 @@ bool Number::bitXor(const Number &o) {
 	if(!o.isInteger() || !isInteger()) return false;
 	try {
 		value = cln::logxor(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -834,6 +1011,7 @@ bool Number::bitNot() {
 	if(!isInteger()) return false;
 	try {
 		value = cln::lognot(cln::numerator(cln::rational(cln::realpart(value))));
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -843,6 +1021,7 @@ bool Number::bitEqv(const Number &o) {
 	if(!o.isInteger() || !isInteger()) return false;
 	try {
 		value = cln::logeqv(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -856,6 +1035,7 @@ bool Number::shiftLeft(const Number &o) {
 		intval = cln::numerator(cln::rational(cln::realpart(value)));
 		intval << cln::numerator(cln::rational(cln::realpart(o.internalNumber())));
 		value = intval;
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -869,6 +1049,7 @@ bool Number::shiftRight(const Number &o) {
 		intval = cln::numerator(cln::rational(cln::realpart(value)));
 		intval >> cln::numerator(cln::rational(cln::realpart(o.internalNumber())));
 		value = intval;
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -879,6 +1060,7 @@ bool Number::shift(const Number &o) {
 	if(!o.isInteger() || !isInteger()) return false;
 	try {
 		value = cln::ash(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -887,6 +1069,7 @@ bool Number::shift(const Number &o) {
 }
 
 bool Number::hasRealPart() const {
+	if(b_small) return l_num != 0;
 	if(isInfinite()) return true;
 	bool b = false;
 	try {
@@ -897,6 +1080,7 @@ bool Number::hasRealPart() const {
 	return b;
 }
 bool Number::hasImaginaryPart() const {
+	if(b_small) return false;
 	if(isInfinite()) return false;
 	bool b = false;
 	try {
@@ -912,15 +1096,19 @@ void Number::removeFloatZeroPart() {
 			cl_F f_value = MIN_PRECISION_FLOAT_RE(value) + MIN_PRECISION_FLOAT_IM(value);
 			if(MIN_PRECISION_FLOAT(f_value) == MIN_PRECISION_FLOAT_RE(value)) {
 				value = cln::realpart(value);
+				b_small = false;
 			} else if(MIN_PRECISION_FLOAT(f_value) == MIN_PRECISION_FLOAT_IM(value)) {
 				value = cln::complex(0, cln::imagpart(value));
+				b_small = false;
 			}
 		} else {
 			cl_F f_value = REAL_PRECISION_FLOAT_RE(value) + REAL_PRECISION_FLOAT_IM(value);
 			if(REAL_PRECISION_FLOAT(f_value) == REAL_PRECISION_FLOAT_RE(value)) {
 				value = cln::realpart(value);
+				b_small = false;
 			} else if(REAL_PRECISION_FLOAT(f_value) == REAL_PRECISION_FLOAT_IM(value)) {
 				value = cln::complex(0, cln::imagpart(value));
+				b_small = false;
 			}
 		}
 	}
@@ -952,6 +1140,7 @@ void Number::testInteger() {
 				return;
 			}
 			value = new_value;
+			b_small = false;
 		}
 	}
 }
@@ -969,12 +1158,14 @@ Number Number::integer() const {
 	return nr;
 }
 bool Number::isInteger() const {
+	if(b_small) return l_den == 1;
 	if(isInfinite()) return false;
 	if(isComplex()) return false;
 	if(isApproximateType()) return false;
 	return cln::denominator(cln::rational(cln::realpart(value))) == 1;
 }
 bool Number::isRational() const {
+	if(b_small) return true;
 	return !isInfinite() && !isComplex() && !isApproximateType();
 }
 bool Number::isReal() const {
@@ -989,6 +1180,7 @@ bool Number::isFraction() const {
 	return false; 
 }
 bool Number::isZero() const {
+	if(b_small) return l_num == 0;
 	if(isInfinite()) return false;
 	bool b = false;
 	try {
@@ -999,10 +1191,12 @@ bool Number::isZero() const {
 	return b;
 }
 bool Number::isOne() const {
+	if(b_small) return l_num == 1 && l_den == 1;
 	if(isInfinite()) return false;
 	return value == 1;
 }
 bool Number::isTwo() const {
+	if(b_small) return l_num == 2 && l_den == 1;
 	if(isInfinite()) return false;
 	return value == 2;
 }
@@ -1017,6 +1211,7 @@ bool Number::isI() const {
 	return b && cln::imagpart(value) == 1;
 }
 bool Number::isMinusOne() const {
+	if(b_small) return l_num == -1 && l_den == 1;
 	if(isInfinite()) return false;
 	return value == -1;
 }
@@ -1031,15 +1226,19 @@ bool Number::isMinusI() const {
 	return b && cln::imagpart(value) == -1;
 }
 bool Number::isNegative() const {
+	if(b_small) return l_num < 0;
 	return b_minf || (!isInfinite() && !isComplex() && cln::minusp(cln::realpart(value)));
 }
 bool Number::isNonNegative() const {
+	if(b_small) return l_num >= 0;
 	return b_pinf || (!isInfinite() && !isComplex() && !cln::minusp(cln::realpart(value)));
 }
 bool Number::isPositive() const {
+	if(b_small) return l_num > 0;
 	return b_pinf || (!isInfinite() && !isComplex() && cln::plusp(cln::realpart(value)));
 }
 bool Number::isNonPositive() const {
+	if(b_small) return l_num <= 0;
 	return b_minf || (!isInfinite() && !isComplex() && !cln::plusp(cln::realpart(value)));
 }
 bool Number::realPartIsNegative() const {
@@ -1080,12 +1279,19 @@ bool Number::equalsZero() const {
 	return false;
 }
 bool Number::equals(const Number &o) const {
+	if(b_small && o.b_small) return l_num == o.l_num && l_den == o.l_den;
 	if(b_inf) return false;
 	if(b_pinf) return false;
 	if(b_minf) return false;
 	if(o.isInfinite()) return false;
 	return value == o.internalNumber();
 }
+size_t Number::hash() const {
+	if(b_inf) return 1;
+	if(b_pinf) return 2;
+	if(b_minf) return 3;
+	return cln::equal_hashcode(value);
+}
 bool Number::equalsApproximately(const Number &o, int prec) const {
 	if(b_inf) return false;
 	if(b_pinf) return false;
@@ -1354,6 +1560,7 @@ bool Number::isLessThanOrEqualTo(const Number &o) const {
 	return false;
 }
 bool Number::isEven() const {
+	if(b_small) return l_den == 1 && l_num % 2 == 0;
 	return isInteger() && cln::evenp(cln::numerator(cln::rational(cln::realpart(value))));
 }
 bool Number::denominatorIsEven() const {
@@ -1372,6 +1579,7 @@ bool Number::numeratorIsMinusOne() const {
 	return !isInfinite() && !isComplex() && !isApproximateType() && cln::numerator(cln::rational(cln::realpart(value))) == -1;
 }
 bool Number::isOdd() const {
+	if(b_small) return l_den == 1 && l_num % 2 != 0;
 	return isInteger() && cln::oddp(cln::numerator(cln::rational(cln::realpart(value))));
 }
 
@@ -1382,6 +1590,14 @@ int Number::integerLength() const {
 
 
 bool Number::add(const Number &o) {
+	if(b_small && o.b_small) {
+		long int num, den;
+		if(small_add(l_num, l_den, o.l_num, o.l_den, num, den)) {
+			setSmall(num, den);
+			setPrecisionAndApproximateFrom(o);
+			return true;
+		}
+	}
 	if(b_inf) return !o.isInfinite();
 	if(o.isInfinity()) {
 		if(isInfinite()) return false;
@@ -1394,22 +1610,32 @@ bool Number::add(const Number &o) {
 	if(o.isPlusInfinity()) {
 		b_pinf = true;
 		value = 0;
+		b_small = false;
 		setPrecisionAndApproximateFrom(o);
 		return true;
 	}
 	if(o.isMinusInfinity()) {
 		b_minf = true;
 		value = 0;
+		b_small = false;
 		setPrecisionAndApproximateFrom(o);
 		return true;
 	}
 	if(isApproximateType() || o.isApproximateType()) {
 		if(equalsApproximately(-o, EQUALS_PRECISION_DEFAULT)) {
 			value = 0;
+			b_small = false;
 			setPrecisionAndApproximateFrom(o);
 			return true;
 		}
 	}
+	double d1, d2;
+	if(hardware_float_operands(value, o.internalNumber(), d1, d2) && hardware_float_result(d1 + d2)) {
+		value = cln::cl_DF(d1 + d2);
+		b_small = false;
+		setPrecisionAndApproximateFrom(o);
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
 		new_value = value + o.internalNumber();
@@ -1418,12 +1644,21 @@ bool Number::add(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
 
 bool Number::subtract(const Number &o) {
+	if(b_small && o.b_small) {
+		long int num, den;
+		if(small_add(l_num, l_den, -o.l_num, o.l_den, num, den)) {
+			setSmall(num, den);
+			setPrecisionAndApproximateFrom(o);
+			return true;
+		}
+	}
 	if(b_inf) {
 		return !o.isInfinite();
 	}
@@ -1452,10 +1687,18 @@ bool Number::subtract(const Number &o) {
 	if(isApproximateType() || o.isApproximateType()) {
 		if(equalsApproximately(o, EQUALS_PRECISION_DEFAULT)) {
 			value = 0;
+			b_small = false;
 			setPrecisionAndApproximateFrom(o);
 			return true;
 		}
 	}
+	double d1, d2;
+	if(hardware_float_operands(value, o.internalNumber(), d1, d2) && hardware_float_result(d1 - d2)) {
+		value = cln::cl_DF(d1 - d2);
+		b_small = false;
+		setPrecisionAndApproximateFrom(o);
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
 		new_value = value - o.internalNumber();
@@ -1464,11 +1707,20 @@ bool Number::subtract(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
 bool Number::multiply(const Number &o) {
+	if(b_small && o.b_small) {
+		long int num, den;
+		if(small_multiply(l_num, l_den, o.l_num, o.l_den, num, den)) {
+			setSmall(num, den);
+			setPrecisionAndApproximateFrom(o);
+			return true;
+		}
+	}
 	if(o.isInfinite() && isZero()) return false;
 	if(isInfinite() && o.isZero()) return false;
 	if((isInfinite() && o.isComplex()) || (o.isInfinite() && isComplex())) {
@@ -1508,6 +1760,13 @@ bool Number::multiply(const Number &o) {
 		setPrecisionAndApproximateFrom(o);
 		return true;
 	}
+	double d1, d2;
+	if(hardware_float_operands(value, o.internalNumber(), d1, d2) && hardware_float_result(d1 * d2)) {
+		value = cln::cl_DF(d1 * d2);
+		b_small = false;
+		setPrecisionAndApproximateFrom(o);
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
 		new_value = value * o.internalNumber();
@@ -1516,11 +1775,20 @@ bool Number::multiply(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
 bool Number::divide(const Number &o) {
+	if(b_small && o.b_small && o.l_num != 0) {
+		long int num, den;
+		if(small_multiply(l_num, l_den, o.l_den, o.l_num, num, den)) {
+			setSmall(num, den);
+			setPrecisionAndApproximateFrom(o);
+			return true;
+		}
+	}
 	if(isInfinite() && o.isInfinite()) return false;
 	if(isInfinite() && o.isZero()) {
 		//setInfinity();
@@ -1553,6 +1821,13 @@ bool Number::divide(const Number &o) {
 		setPrecisionAndApproximateFrom(o);
 		return true;
 	}
+	double d1, d2;
+	if(hardware_float_operands(value, o.internalNumber(), d1, d2) && hardware_float_result(d1 / d2)) {
+		value = cln::cl_DF(d1 / d2);
+		b_small = false;
+		setPrecisionAndApproximateFrom(o);
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
 		new_value = value / o.internalNumber();
@@ -1561,11 +1836,16 @@ bool Number::divide(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
 bool Number::recip() {
+	if(b_small && l_num != 0) {
+		setSmall(l_den, l_num);
+		return true;
+	}
 	if(isZero()) {
 		//division by zero!!!
 		//setInfinity();
@@ -1584,6 +1864,7 @@ bool Number::recip() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	return true;
 }
@@ -1646,6 +1927,15 @@ bool Number::raise(const Number &o, bool try_exact) {
 			return true;
 		}
 	}
+	double d1, d2;
+	if(hardware_float_operands(value, o.internalNumber(), d1, d2) && (d1 > 0 || (d1 < 0 && o.isInteger())) && hardware_float_result(std::pow(d1, d2))) {
+		value = cln::cl_DF(std::pow(d1, d2));
+		b_small = false;
+		setPrecisionAndApproximateFrom(o);
+		testApproximate();
+		testInteger();
+		return true;
+	}
 	cln::cl_N new_value = value;
 	bool neg = false;	
 	if(isNegative() && !o.isComplex() && !o.isApproximateType() && !o.numeratorIsEven() && !o.denominatorIsEven()) {
@@ -1657,14 +1947,21 @@ bool Number::raise(const Number &o, bool try_exact) {
 
 	if(o.isRational() && isRational() && (!try_exact || (cln::abs(new_value) <= 1 + dmax && cln::abs(new_value) >= 1 - dmax)) && new_value != 1 && new_value != -1 && (cln::numerator(cln::rational(cln::realpart(o.internalNumber()))) > 10000 || cln::numerator(cln::rational(cln::realpart(o.internalNumber()))) < -10000)) {
 		try {
-			new_value = cln::expt(cln::cl_float(cln::realpart(new_value)), cln::cl_float(cln::realpart(o.internalNumber())));
+			new_value = cln::expt(cln::cl_float(cln::realpart(new_value), context_float_format()), cln::cl_float(cln::realpart(o.internalNumber()), context_float_format()));
 		} catch(runtime_exception &e) {
 			CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 			return false;
 		}
 	} else {
 		try {
-			new_value = cln::expt(new_value, o.internalNumber());
+			if(!context_uses_default_float_format() && exact_value(new_value) && exact_value(o.internalNumber())) {
+				// CLN would calculate an inexact result with cln::default_float_format
+				cln::cl_N base = new_value;
+				new_value = cln::expt(base, o.internalNumber());
+				if(!exact_value(new_value)) new_value = cln::expt(context_float(base), context_float(o.internalNumber()));
+			} else {
+				new_value = cln::expt(new_value, o.internalNumber());
+			}
 		} catch(runtime_exception &e) {
 			CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 			return false;
@@ -1680,6 +1977,7 @@ bool Number::raise(const Number &o, bool try_exact) {
 	}
 	
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	setPrecisionAndApproximateFrom(o);
 	testApproximate();
@@ -1749,10 +2047,15 @@ bool Number::square() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 
 bool Number::negate() {
+	if(b_small) {
+		setSmall(-l_num, l_den);
+		return true;
+	}
 	if(isInfinite()) {
 		b_pinf = !b_pinf;
 		b_minf = !b_minf;
@@ -1766,6 +2069,7 @@ bool Number::negate() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 void Number::setNegative(bool is_negative) {
@@ -1773,6 +2077,7 @@ void Number::setNegative(bool is_negative) {
 		if(isInfinite()) {b_pinf = !b_pinf; b_minf = !b_minf; return;}
 		try {
 			value = cln::complex(-cln::realpart(value), cln::imagpart(value));
+			b_small = false;
 		} catch(runtime_exception &e) {
 			CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		}
@@ -1784,11 +2089,13 @@ bool Number::abs() {
 		return true;
 	}
 	value = cln::abs(value);
+	b_small = false;
 	return true;
 }
 bool Number::signum() {
 	if(isInfinite()) return false;
 	value = cln::signum(value);
+	b_small = false;
 	return true;
 }
 bool Number::round() {
@@ -1801,6 +2108,7 @@ bool Number::round() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	if(b_approx) {
 		if(isInteger()) {
 			bool b_zero = false;
@@ -1831,6 +2139,7 @@ bool Number::floor() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::ceil() {
@@ -1844,6 +2153,7 @@ bool Number::ceil() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::trunc() {
@@ -1857,6 +2167,7 @@ bool Number::trunc() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::round(const Number &o) {
@@ -1873,6 +2184,7 @@ bool Number::round(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -1890,6 +2202,7 @@ bool Number::floor(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -1907,6 +2220,7 @@ bool Number::ceil(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -1924,6 +2238,7 @@ bool Number::trunc(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -1938,6 +2253,7 @@ bool Number::mod(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -1952,6 +2268,7 @@ bool Number::frac() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::rem(const Number &o) {
@@ -1965,6 +2282,7 @@ bool Number::rem(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -1980,6 +2298,7 @@ bool Number::smod(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }	
@@ -1994,6 +2313,7 @@ bool Number::irem(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::irem(const Number &o, Number &q) {
@@ -2003,6 +2323,7 @@ bool Number::irem(const Number &o, Number &q) {
 		const cln::cl_I_div_t rem_quo = cln::truncate2(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
 		q.setInternal(rem_quo.quotient);
 		value = rem_quo.remainder;
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -2019,6 +2340,7 @@ bool Number::iquo(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::iquo(const Number &o, Number &r) {
@@ -2028,6 +2350,7 @@ bool Number::iquo(const Number &o, Number &r) {
 		const cln::cl_I_div_t rem_quo = cln::truncate2(cln::numerator(cln::rational(cln::realpart(value))), cln::numerator(cln::rational(cln::realpart(o.internalNumber()))));
 		r.setInternal(rem_quo.remainder);
 		value = rem_quo.quotient;
+		b_small = false;
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 	}
@@ -2045,6 +2368,7 @@ bool Number::isqrt() {
 			return false;
 		}
 		value = new_value;
+		b_small = false;
 		return true;
 	}
 	return false;
@@ -2064,8 +2388,10 @@ void Number::toBoolean() {
 void Number::setTrue(bool is_true) {
 	if(is_true) {
 		value = 1;
+		b_small = false;
 	} else {
 		value = 0;
+		b_small = false;
 	}
 }
 void Number::setFalse() {
@@ -2076,16 +2402,16 @@ void Number::setLogicalNot() {
 }
 
 void Number::e() {
-	setInternal(cln::exp1());
+	setInternal(cln::exp1(context_float_format()));
 }
 void Number::pi() {
-	setInternal(cln::pi());
+	setInternal(cln::pi(context_float_format()));
 }
 void Number::catalan() {
-	setInternal(cln::catalanconst());
+	setInternal(cln::catalanconst(context_float_format()));
 }
 void Number::euler() {
-	setInternal(cln::eulerconst());
+	setInternal(cln::eulerconst(context_float_format()));
 }
 bool Number::zeta() {
 	if(isOne()) {
@@ -2104,26 +2430,36 @@ bool Number::zeta() {
 	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::zeta(i); 
+		new_value = cln::zeta(i, context_float_format());
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }			
 
 bool Number::sin() {
 	if(isInfinite()) return false;
 	if(isZero()) return true;
+	double d;
+	if(hardware_float_operand(value, d) && hardware_float_result(std::sin(d))) {
+		value = cln::cl_DF(std::sin(d));
+		b_small = false;
+		testApproximate();
+		testInteger();
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::sin(value);
+		new_value = cln::sin(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2134,12 +2470,13 @@ bool Number::asin() {
 	if(isZero()) return true;
 	cln::cl_N new_value;
 	try {
-		new_value = cln::asin(value);
+		new_value = cln::asin(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2150,12 +2487,13 @@ bool Number::sinh() {
 	if(isZero()) return true;
 	cln::cl_N new_value;
 	try {
-		new_value = cln::sinh(value);
+		new_value = cln::sinh(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2166,12 +2504,13 @@ bool Number::asinh() {
 	if(isZero()) return true;
 	cln::cl_N new_value;
 	try {
-		new_value = cln::asinh(value);
+		new_value = cln::asinh(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2183,14 +2522,23 @@ bool Number::cos() {
 		set(1);
 		return true;
 	}
+	double d;
+	if(hardware_float_operand(value, d) && hardware_float_result(std::cos(d))) {
+		value = cln::cl_DF(std::cos(d));
+		b_small = false;
+		testApproximate();
+		testInteger();
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::cos(value);
+		new_value = cln::cos(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2204,12 +2552,13 @@ bool Number::acos() {
 	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::acos(value);
+		new_value = cln::acos(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2227,12 +2576,13 @@ bool Number::cosh() {
 	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::cosh(value);
+		new_value = cln::cosh(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2243,12 +2593,13 @@ bool Number::acosh() {
 	if(isMinusInfinity()) return false;
 	cln::cl_N new_value;
 	try {
-		new_value = cln::acosh(value);
+		new_value = cln::acosh(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2257,14 +2608,23 @@ bool Number::acosh() {
 bool Number::tan() {
 	if(isInfinite()) return false;
 	if(isZero()) return true;
+	double d;
+	if(hardware_float_operand(value, d) && hardware_float_result(std::tan(d))) {
+		value = cln::cl_DF(std::tan(d));
+		b_small = false;
+		testApproximate();
+		testInteger();
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::tan(value);
+		new_value = cln::tan(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2281,12 +2641,13 @@ bool Number::atan() {
 	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::atan(value);
+		new_value = cln::atan(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2299,12 +2660,13 @@ bool Number::tanh() {
 	if(isZero()) return true;
 	cln::cl_N new_value;
 	try {
-		new_value = cln::tanh(value);
+		new_value = cln::tanh(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2323,12 +2685,13 @@ bool Number::atanh() {
 	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::atanh(value);
+		new_value = cln::atanh(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2345,14 +2708,23 @@ bool Number::ln() {
 		setMinusInfinity();
 		return true;
 	}
+	double d;
+	if(hardware_float_operand(value, d) && d > 0 && hardware_float_result(std::log(d))) {
+		value = cln::cl_DF(std::log(d));
+		b_small = false;
+		testApproximate();
+		testInteger();
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::log(value);
+		new_value = cln::log(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	testApproximate();
 	testInteger();
@@ -2387,6 +2759,7 @@ bool Number::log(const Number &o) {
 	if(!isApproximate() && !o.isApproximate() && isFraction()) {	
 		try {		
 			new_value = -cln::log(cln::recip(value), o.internalNumber());			
+			if(!context_uses_default_float_format() && !exact_value(new_value)) new_value = -cln::log(context_float(cln::recip(value)), context_float(o.internalNumber()));
 		} catch(runtime_exception &e) {
 			CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 			return false;
@@ -2394,12 +2767,14 @@ bool Number::log(const Number &o) {
 	} else {
 		try {
 			new_value = cln::log(value, o.internalNumber());
+			if(!context_uses_default_float_format() && exact_value(value) && exact_value(o.internalNumber()) && !exact_value(new_value)) new_value = cln::log(context_float(value), context_float(o.internalNumber()));
 		} catch(runtime_exception &e) {
 			CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 			return false;
 		}
 	}
 	value = new_value;
+	b_small = false;
 	removeFloatZeroPart();
 	setPrecisionAndApproximateFrom(o);
 	testApproximate();
@@ -2413,14 +2788,23 @@ bool Number::exp() {
 		clear();
 		return true;
 	}
+	double d;
+	if(!isZero() && hardware_float_operand(value, d) && hardware_float_result(std::exp(d))) {
+		value = cln::cl_DF(std::exp(d));
+		b_small = false;
+		testApproximate();
+		testInteger();
+		return true;
+	}
 	cln::cl_N new_value;
 	try {
-		new_value = cln::exp(value);
+		new_value = cln::exp(context_float(value));
 	} catch(runtime_exception &e) {
 		CALCULATOR->error(true, _("CLN Exception: %s"), e.what());
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	testApproximate();
 	testInteger();
 	return true;
@@ -2429,9 +2813,10 @@ bool Number::lambertW() {
 	if(!isReal()) return false;
 	if(isZero()) return true;
 	cln::cl_R x = cln::realpart(value);
-	cln::cl_R m1_div_exp1 = -1 / cln::exp1();
+	cln::cl_R m1_div_exp1 = -1 / cln::exp1(context_float_format());
 	if(x == m1_div_exp1) {
 		value = -1;
+		b_small = false;
 		if(!b_approx) {
 			i_precision = PRECISION;
 			b_approx = true;
@@ -2471,6 +2856,7 @@ bool Number::lambertW() {
 		}
 	}
 	value = new_value;
+	b_small = false;
 	if(!b_approx) {
 		i_precision = PRECISION;
 		b_approx = true;
@@ -2496,6 +2882,7 @@ bool Number::gcd(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	setPrecisionAndApproximateFrom(o);
 	return true;
 }
@@ -2509,6 +2896,7 @@ bool Number::lcm(const Number &o) {
 			return false;
 		}
 		value = new_value;
+		b_small = false;
 		return true;
 	}
 	return multiply(o);
@@ -2534,7 +2922,9 @@ bool Number::factorial() {
 	try {
 		cln::cl_I i = cln::numerator(cln::rational(cln::realpart(new_value)));
 		i = cln::minus1(i);
-		for(; !cln::zerop(i); i = cln::minus1(i)) {
+		for(long int n = 1; !cln::zerop(i); i = cln::minus1(i), n++) {
+			// checking every iteration would be noticeable for small factorials
+			if(n % 1000 == 0 && CALCULATOR->aborted(ABORT_LOCATION_FACTORIAL)) return false;
 			new_value = new_value * i;
 		}
 	} catch(runtime_exception &e) {
@@ -2542,6 +2932,7 @@ bool Number::factorial() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::multiFactorial(const Number &o) {
@@ -2571,6 +2962,7 @@ bool Number::multiFactorial(const Number &o) {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::doubleFactorial() {
@@ -2598,6 +2990,7 @@ bool Number::doubleFactorial() {
 		return false;
 	}
 	value = new_value;
+	b_small = false;
 	return true;
 }
 bool Number::binomial(const Number &m, const Number &k) {
@@ -2642,6 +3035,7 @@ bool Number::binomial(const Number &m, const Number &k) {
 			}
 			clear();
 			value = new_value;
+			b_small = false;
 			divide(k_fac);
 		} else {
 			try {
@@ -2652,6 +3046,7 @@ bool Number::binomial(const Number &m, const Number &k) {
 			}
 			clear();
 			value = new_value;
+			b_small = false;
 		}		
 		setPrecisionAndApproximateFrom(m);
 		setPrecisionAndApproximateFrom(k);
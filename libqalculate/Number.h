@@ -39,11 +39,17 @@ class Number {
 		void testApproximate();
 		void testInteger();
 		void setPrecisionAndApproximateFrom(const Number &o);
+		void setSmall(long int numerator, long int denominator);
+		void testSmall();
 
 		cln::cl_N value;
 		bool b_inf, b_pinf, b_minf;
 		bool b_approx;
 		int i_precision;
+		/* Inline copy of exact rational values with small numerator and denominator, used for fast arithmetic and tests.
+		If b_small is true, value is always equal to l_num / l_den, l_den is positive and the fraction is reduced. Every change of value must update or unset b_small. */
+		bool b_small;
+		long int l_num, l_den;
 
 	public:
 	
@@ -80,6 +86,10 @@ class Number {
 		void setFloat(double d_value);
 
 		void setInternal(const cln::cl_N &cln_value);
+		/** Replaces the internal number with an equal number in newly allocated memory.
+		* CLN numbers are reference counted without synchronization, so a number shared with another thread must be copied, and made unshared, while no other thread uses it.
+		*/
+		void unshare();
 
 		void setImaginaryPart(const Number &o);
 		void setImaginaryPart(int numerator, int denominator = 1, int exp_10 = 0);
@@ -214,6 +224,8 @@ class Number {
 		bool hasPositiveSign() const;
 		bool equalsZero() const;
 		bool equals(const Number &o) const;
+		/** Returns a hash value for the number. Numbers that are equal according to equals() always have the same hash value. */
+		size_t hash() const;
 		bool equalsApproximately(const Number &o, int prec) const;
 		ComparisonResult compare(const Number &o) const;
 		ComparisonResult compareApproximately(const Number &o, int prec = EQUALS_PRECISION_LOWEST) const;
@@ -17,6 +17,8 @@
 #include "MathStructure.h"
 #include "Number.h"
 
+#include <glib.h>
+
 Assumptions::Assumptions() : i_type(ASSUMPTION_TYPE_NONE), i_sign(ASSUMPTION_SIGN_UNKNOWN), fmin(NULL), fmax(NULL), b_incl_min(true), b_incl_max(true) {}
 Assumptions::~Assumptions() {}
 
@@ -185,7 +187,11 @@ bool UnknownVariable::representsNonMatrix() {
 	return CALCULATOR->defaultAssumptions()->isNonMatrix();
 }
 
+size_t recursion_checks_avoided = 0;
+
 KnownVariable::KnownVariable(string cat_, string name_, const MathStructure &o, string title_, bool is_local, bool is_builtin, bool is_active) : Variable(cat_, name_, title_, is_local, is_builtin, is_active) {
+	i_value_version = 0;
+	i_recursive = -1;
 	mstruct = new MathStructure(o);
 	setApproximate(mstruct->isApproximate());
 	setPrecision(mstruct->precision());
@@ -195,19 +201,26 @@ KnownVariable::KnownVariable(string cat_, string name_, const MathStructure &o,
 	setChanged(false);
 }
 KnownVariable::KnownVariable(string cat_, string name_, string expression_, string title_, bool is_local, bool is_builtin, bool is_active) : Variable(cat_, name_, title_, is_local, is_builtin, is_active) {
+	i_value_version = 0;
+	i_recursive = -1;
 	mstruct = NULL;
 	calculated_precision = 0;
 	set(expression_);
 	setChanged(false);
 }
 KnownVariable::KnownVariable() : Variable() {
+	i_value_version = 0;
+	i_recursive = -1;
 	mstruct = NULL;
 }
 KnownVariable::KnownVariable(const KnownVariable *variable) {
+	i_value_version = 0;
+	i_recursive = -1;
 	mstruct = NULL;
 	set(variable);
 }
 KnownVariable::~KnownVariable() {
+	clearDependencies();
 	if(mstruct) delete mstruct;
 }
 ExpressionItem *KnownVariable::copy() const {
@@ -224,6 +237,8 @@ void KnownVariable::set(const ExpressionItem *item) {
 		calculated_precision = 0;
 		sexpression = ((KnownVariable*) item)->expression();
 		b_expression = ((KnownVariable*) item)->isExpression();
+		i_value_version++;
+		clearDependencies();
 		if(!b_expression) {
 			set(((KnownVariable*) item)->get());
 		}
@@ -238,6 +253,8 @@ void KnownVariable::set(const MathStructure &o) {
 	calculated_precision = 0;
 	b_expression = false;
 	sexpression = "";
+	i_value_version++;
+	clearDependencies();
 	setChanged(true);
 }
 void KnownVariable::set(string expression_) {
@@ -249,6 +266,8 @@ void KnownVariable::set(string expression_) {
 	sexpression = expression_;
 	remove_blank_ends(sexpression);
 	calculated_precision = 0;
+	i_value_version++;
+	clearDependencies();
 	setChanged(true);
 }
 bool set_precision_of_numbers(MathStructure &mstruct, int i_prec) {
@@ -273,29 +292,93 @@ bool set_precision_of_numbers(MathStructure &mstruct, int i_prec) {
 	}
 	return b;
 }
-const MathStructure &KnownVariable::get() {
-	if(b_expression && !mstruct) {
-		ParseOptions po;
-		if(isApproximate() && precision() < 1) {
-			po.read_precision = READ_PRECISION_WHEN_DECIMALS;
+void KnownVariable::parseExpression() {
+	ParseOptions po;
+	if(isApproximate() && precision() < 1) {
+		po.read_precision = READ_PRECISION_WHEN_DECIMALS;
+	}
+	mstruct = new MathStructure();
+	CALCULATOR->parse(mstruct, sexpression, po);
+	if(precision() > 0) {
+		if(mstruct->precision() < 1 || precision() < mstruct->precision()) {
+			if(!set_precision_of_numbers(*mstruct, precision())) mstruct->setPrecision(precision(), true);
 		}
-		mstruct = new MathStructure();
-		CALCULATOR->parse(mstruct, sexpression, po);
-		if(precision() > 0) {
-			if(mstruct->precision() < 1 || precision() < mstruct->precision()) {
-				if(!set_precision_of_numbers(*mstruct, precision())) mstruct->setPrecision(precision(), true);
-			}
-		} else if(isApproximate()) {
-			if(!mstruct->isApproximate()) {
-				if(!set_precision_of_numbers(*mstruct, precision())) mstruct->setApproximate(true, true);
-			}
+	} else if(isApproximate()) {
+		if(!mstruct->isApproximate()) {
+			if(!set_precision_of_numbers(*mstruct, precision())) mstruct->setApproximate(true, true);
 		}
 	}
-	if(mstruct->contains(this, false, true, true) > 0) {
-		CALCULATOR->error(true, _("Recursive variable: %s = %s"), name().c_str(), mstruct->print().c_str(), NULL);
+}
+bool KnownVariable::collectDependencies(const MathStructure &m) {
+	if(m.isVariable()) {
+		if(m.variable() == this) return true;
+		if(!m.variable()->isKnown()) return false;
+		KnownVariable *v = (KnownVariable*) m.variable();
+		for(size_t i = 0; i < v_dependencies.size(); i++) {
+			if(v_dependencies[i] == v) return false;
+		}
+		v->ref();
+		v_dependencies.push_back(v);
+		v_dependency_versions.push_back(v->i_value_version);
+		if(v->b_expression && !v->mstruct) v->parseExpression();
+		if(v->mstruct) return collectDependencies(*v->mstruct);
+		// only dynamic variables (with values that do not depend on other variables) are without a value here; not calculated while variable_get_mutex is locked
+		return false;
+	}
+	if(m.isFunction()) {
+		if(m.functionValue()) return collectDependencies(*m.functionValue());
+		return false;
+	}
+	for(size_t i = 0; i < m.size(); i++) {
+		if(collectDependencies(m[i])) return true;
+	}
+	return false;
+}
+void KnownVariable::clearDependencies() {
+	for(size_t i = 0; i < v_dependencies.size(); i++) {
+		v_dependencies[i]->unref();
+	}
+	v_dependencies.clear();
+	v_dependency_versions.clear();
+	i_recursive = -1;
+}
+// parsed expressions and results of recursion checks are updated on use, which might happen in several threads at the same time (see CalculationContext)
+static GRecMutex variable_get_mutex;
+
+const MathStructure &KnownVariable::get() {
+	int cancel_state = thread_disable_cancel();
+	g_rec_mutex_lock(&variable_get_mutex);
+	if(b_expression && !mstruct) {
+		parseExpression();
+	}
+	bool b_checked = i_recursive >= 0;
+	for(size_t i = 0; b_checked && i < v_dependencies.size(); i++) {
+		if(v_dependencies[i]->i_value_version != v_dependency_versions[i]) b_checked = false;
+	}
+	if(b_checked) {
+		recursion_checks_avoided++;
+	} else {
+		clearDependencies();
+		i_recursive = collectDependencies(*mstruct) ? 1 : 0;
+	}
+	// each calculation context uses its own copy of the value (see Calculator::setContextValue()), made while the lock is held
+	const MathStructure *m = CALCULATOR->getContextValue(this, 0, i_value_version);
+	if(!m) m = &CALCULATOR->setContextValue(this, 0, i_value_version, *mstruct);
+	if(i_recursive > 0) {
+		g_rec_mutex_unlock(&variable_get_mutex);
+		thread_restore_cancel(cancel_state);
+		CALCULATOR->error(true, _("Recursive variable: %s = %s"), name().c_str(), m->print().c_str(), NULL);
 		return m_undefined;
 	}
-	return *mstruct;
+	g_rec_mutex_unlock(&variable_get_mutex);
+	thread_restore_cancel(cancel_state);
+	return *m;
+}
+size_t KnownVariable::valueVersion() const {
+	return i_value_version;
+}
+size_t KnownVariable::recursionChecksAvoided() {
+	return recursion_checks_avoided;
 }
 bool KnownVariable::representsPositive(bool allow_units) {return get().representsPositive(allow_units);}
 bool KnownVariable::representsNegative(bool allow_units) {return get().representsNegative(allow_units);}
@@ -332,20 +415,60 @@ DynamicVariable::DynamicVariable() : KnownVariable() {
 	setChanged(false);
 }
 DynamicVariable::~DynamicVariable() {
-	if(mstruct) delete mstruct;
+	for(size_t i = 0; i < v_calculated.size(); i++) delete v_calculated[i];
+	// mstruct is one of the calculated values
+	mstruct = NULL;
 }
 void DynamicVariable::set(const ExpressionItem *item) {
 	ExpressionItem::set(item);
 }
 void DynamicVariable::set(const MathStructure&) {}
 void DynamicVariable::set(string) {}
+// protects the calculated values of all dynamic variables (only held during lookup, not while calculating)
+static GMutex dynamic_variable_mutex;
+
 const MathStructure &DynamicVariable::get() {
-	if(calculated_precision != CALCULATOR->getPrecision() || !mstruct) {
-		mstruct = new MathStructure();
-		calculated_precision = CALCULATOR->getPrecision();
-		calculate();
+	int prec = CALCULATOR->getPrecision();
+	int cancel_state = thread_disable_cancel();
+	g_mutex_lock(&dynamic_variable_mutex);
+	// each calculation context uses its own copy of the value (see Calculator::setContextValue()), made while the lock is held
+	const MathStructure *m = CALCULATOR->getContextValue(this, prec, 0);
+	if(!m) {
+		for(size_t i = 0; i < v_calculated_precisions.size(); i++) {
+			if(v_calculated_precisions[i] == prec) {
+				m = &CALCULATOR->setContextValue(this, prec, 0, *v_calculated[i]);
+				break;
+			}
+		}
+	}
+	g_mutex_unlock(&dynamic_variable_mutex);
+	thread_restore_cancel(cancel_state);
+	if(m) return *m;
+	// several threads might calculate the same value at the same time; only the first result is kept
+	MathStructure *m_new = new MathStructure();
+	calculate(*m_new);
+	cancel_state = thread_disable_cancel();
+	g_mutex_lock(&dynamic_variable_mutex);
+	MathStructure *m_calculated = NULL;
+	for(size_t i = 0; i < v_calculated_precisions.size(); i++) {
+		if(v_calculated_precisions[i] == prec) {
+			m_calculated = v_calculated[i];
+			break;
+		}
+	}
+	if(m_calculated) {
+		delete m_new;
+	} else {
+		v_calculated.push_back(m_new);
+		v_calculated_precisions.push_back(prec);
+		m_calculated = m_new;
 	}
-	return *mstruct;
+	mstruct = m_calculated;
+	calculated_precision = prec;
+	m = &CALCULATOR->setContextValue(this, prec, 0, *m_calculated);
+	g_mutex_unlock(&dynamic_variable_mutex);
+	thread_restore_cancel(cancel_state);
+	return *m;
 }
 int DynamicVariable::calculatedPrecision() const {
 	return calculated_precision;
@@ -353,19 +476,19 @@ int DynamicVariable::calculatedPrecision() const {
 
 
 PiVariable::PiVariable() : DynamicVariable("Constants", "pi") {}
-void PiVariable::calculate() const {
-	Number nr; nr.pi(); mstruct->set(nr);
+void PiVariable::calculate(MathStructure &m) const {
+	Number nr; nr.pi(); m.set(nr);
 }
 EVariable::EVariable() : DynamicVariable("Constants", "e") {}
-void EVariable::calculate() const {
-	Number nr; nr.e(); mstruct->set(nr);
+void EVariable::calculate(MathStructure &m) const {
+	Number nr; nr.e(); m.set(nr);
 }
 EulerVariable::EulerVariable() : DynamicVariable("Constants", "euler") {}
-void EulerVariable::calculate() const {
-	Number nr; nr.euler(); mstruct->set(nr);
+void EulerVariable::calculate(MathStructure &m) const {
+	Number nr; nr.euler(); m.set(nr);
 }
 CatalanVariable::CatalanVariable() : DynamicVariable("Constants", "catalan") {}
-void CatalanVariable::calculate() const {
-	Number nr; nr.catalan(); mstruct->set(nr);
+void CatalanVariable::calculate(MathStructure &m) const {
+	Number nr; nr.catalan(); m.set(nr);
 }
 
@@ -19,7 +19,7 @@
 
 #define DECLARE_BUILTIN_VARIABLE(x)	class x : public DynamicVariable { \
 					  private: \
-						void calculate() const;	\
+						void calculate(MathStructure &m) const;	\
  					  public: \
 						x(); \
 						x(const x *variable) {set(variable);} \
@@ -235,6 +235,22 @@ class KnownVariable : public Variable {
  	int calculated_precision;
 	string sexpression;
 
+	size_t i_value_version;
+	int i_recursive;
+	vector<KnownVariable*> v_dependencies;
+	vector<size_t> v_dependency_versions;
+
+	/** Parses the text string expression. */
+	void parseExpression();
+	/** Adds all known variables that a value depends on to the dependencies of the variable, including variables referenced by the values of other variables.
+	*
+	* @param m Value to search.
+	* @returns true if the variable itself was found (the variable is recursive).
+	*/
+	bool collectDependencies(const MathStructure &m);
+	/** Removes all dependencies and the result of the recursion check. */
+	void clearDependencies();
+
   public:
   
 	/** Create a known variable with a value. 
@@ -300,6 +316,16 @@ class KnownVariable : public Variable {
 	* @returns The value of the variable..
 	*/
 	virtual const MathStructure &get();
+	/** Returns a counter that is incremented whenever the value or expression of the variable changes.
+	*
+	* @returns Version of the value.
+	*/
+	size_t valueVersion() const;
+	/** Returns the total number of times get() has used the cached result of the check for recursive variables instead of searching through the value.
+	*
+	* @returns Number of avoided searches.
+	*/
+	static size_t recursionChecksAvoided();
 	
 	virtual bool representsPositive(bool = false);
 	virtual bool representsNegative(bool = false);
@@ -320,13 +346,19 @@ class KnownVariable : public Variable {
 };
 
 /// Abstract base class for variables with a value which is recalculated when the precision has changed.
-/**
+/** The value is calculated once for each precision, and kept until the variable is deleted, so that references returned by get() stay valid when other threads use a different precision.
 */
 class DynamicVariable : public KnownVariable {
 
   protected:
   
-  	virtual void calculate() const = 0;
+	vector<MathStructure*> v_calculated;
+	vector<int> v_calculated_precisions;
+	/** Calculates the value with the current precision.
+	*
+	* @param m Structure to set to the value.
+	*/
+  	virtual void calculate(MathStructure &m) const = 0;
   	
   public:
 
@@ -475,6 +475,64 @@ typedef enum {
 	ANGLE_UNIT_GRADIANS
 } AngleUnit;
 
+/// Format of numbers in exported CSV files. See Calculator::exportCSV().
+typedef enum {
+	/// Numbers are formatted as in a displayed result, with decimal fractions
+	CSV_NUMBER_FORMAT_DEFAULT,
+	/// Rational numbers are written exactly, as integers or fractions (e.g. 1/3)
+	CSV_NUMBER_FORMAT_EXACT,
+	/// Real numbers are written as decimals with a fixed number of significant digits
+	CSV_NUMBER_FORMAT_DECIMAL
+} CSVNumberFormat;
+
+/// Stages of a calculation. See Calculator::lastEvaluationProfile().
+typedef enum {
+	/// The whole calculation (Calculator::calculate() or MathStructure::eval())
+	EVALUATION_STAGE_TOTAL,
+	/// Parsing of the expression
+	EVALUATION_STAGE_PARSE,
+	/// MathStructure::unformat()
+	EVALUATION_STAGE_UNFORMAT,
+	/// Synchronization of units (MathStructure::syncUnits())
+	EVALUATION_STAGE_SYNC_UNITS,
+	/// MathStructure::calculateFunctions()
+	EVALUATION_STAGE_CALCULATE_FUNCTIONS,
+	/// Calculation of a single function (MathFunction::calculate())
+	EVALUATION_STAGE_FUNCTION,
+	/// Evaluation steps (MathStructure::calculatesub())
+	EVALUATION_STAGE_CALCULATESUB,
+	/// Isolation of unknown variables (MathStructure::isolate_x())
+	EVALUATION_STAGE_ISOLATE_X,
+	/// MathStructure::simplify()
+	EVALUATION_STAGE_SIMPLIFY,
+	/// MathStructure::factorize()
+	EVALUATION_STAGE_FACTORIZE,
+	/// MathStructure::format()
+	EVALUATION_STAGE_FORMAT,
+	/// MathStructure::print()
+	EVALUATION_STAGE_PRINT
+} EvaluationStage;
+
+/// Places where an aborted calculation can stop. See Calculator::abortCount().
+typedef enum {
+	/// Between evaluation steps (MathStructure::calculatesub())
+	ABORT_LOCATION_CALCULATESUB,
+	/// While merging terms, factors or powers
+	ABORT_LOCATION_MERGE,
+	/// In the iterations of sum(), product() and for()
+	ABORT_LOCATION_SUM,
+	/// During gaussian elimination of a matrix
+	ABORT_LOCATION_GAUSSIAN_ELIMINATION,
+	/// During factorization
+	ABORT_LOCATION_FACTORIZE,
+	/// During calculation of a factorial
+	ABORT_LOCATION_FACTORIAL,
+	/// Elsewhere
+	ABORT_LOCATION_OTHER,
+	/// The calculation did not stop in time and the calculation thread was cancelled
+	ABORT_LOCATION_FORCED
+} AbortLocation;
+
 typedef enum {
 	/// The default adaptive mode works as the "parse implicit multiplication first" mode, unless spaces are found (<quote>1/5x = 1/(5*x)</quote>, but <quote>1/5 x = (1/5)*x</quote>). In the adaptive mode unit expressions are parsed separately (<quote>5 m/5 m/s = (5*m)/(5*(m/s)) = 1 s</quote>).
 	PARSING_MODE_ADAPTIVE,
@@ -571,7 +629,9 @@ static const struct EvaluationOptions {
 	ParseOptions parse_options;
 	/// If set will decide which variable to isolate in an equation. Default: NULL
 	const MathStructure *isolate_var;
-	EvaluationOptions() : approximation(APPROXIMATION_TRY_EXACT), sync_units(true), sync_complex_unit_relations(true), keep_prefixes(false), calculate_variables(true), calculate_functions(true), test_comparisons(true), isolate_x(true), expand(true), reduce_divisions(true), allow_complex(true), allow_infinite(true), assume_denominators_nonzero(false), warn_about_denominators_assumed_nonzero(false), split_squares(true), keep_zero_units(true), auto_post_conversion(POST_CONVERSION_NONE), mixed_units_conversion(MIXED_UNITS_CONVERSION_DEFAULT), structuring(STRUCTURING_SIMPLIFY), isolate_var(NULL) {}
+	/// If results of function calls will be remembered and reused for identical function calls (with identical arguments) during the same evaluation. Function calls with side effects or random results are never reused. Default: false
+	bool memoize_functions;
+	EvaluationOptions() : approximation(APPROXIMATION_TRY_EXACT), sync_units(true), sync_complex_unit_relations(true), keep_prefixes(false), calculate_variables(true), calculate_functions(true), test_comparisons(true), isolate_x(true), expand(true), reduce_divisions(true), allow_complex(true), allow_infinite(true), assume_denominators_nonzero(false), warn_about_denominators_assumed_nonzero(false), split_squares(true), keep_zero_units(true), auto_post_conversion(POST_CONVERSION_NONE), mixed_units_conversion(MIXED_UNITS_CONVERSION_DEFAULT), structuring(STRUCTURING_SIMPLIFY), isolate_var(NULL), memoize_functions(false) {}
 } default_evaluation_options;
 
 extern MathStructure m_undefined, m_empty_vector, m_empty_matrix, m_zero, m_one, m_minus_one;
@@ -24,5 +24,6 @@
 #include <libqalculate/DataSet.h>
 #include <libqalculate/Unit.h>
 #include <libqalculate/BuiltinFunctions.h>
+#include <libqalculate/EvaluationPlan.h>
 
 #endif
@@ -700,6 +700,37 @@ bool text_length_is_one(const string &str) {
 	return true;
 }
 
+// Hash of a string with ASCII letters in lower case and other characters converted using g_utf8_strdown(), so that strings that are equal according to equalsIgnoreCase() always have the same hash
+size_t expression_name_hash(const string &name) {
+	size_t h = 2166136261U;
+	for(size_t i = 0; i < name.length(); i++) {
+		if(name[i] < 0 && i + 1 < name.length()) {
+			size_t i2 = 1;
+			while(i + i2 < name.length() && name[i + i2] < 0) i2++;
+			gchar *gstr = g_utf8_strdown(name.c_str() + (sizeof(char) * i), i2);
+			for(size_t i3 = 0; gstr[i3] != '\0'; i3++) {
+				h ^= (unsigned char) gstr[i3];
+				h *= 16777619U;
+			}
+			g_free(gstr);
+			i += i2 - 1;
+		} else {
+			char c = name[i];
+			if(c >= 'A' && c <= 'Z') c += 32;
+			h ^= (unsigned char) c;
+			h *= 16777619U;
+		}
+	}
+	return h;
+}
+// 64-bit FNV-1a hash, used for the keys of cache files. Pass the previous hash as h to continue hashing.
+unsigned long long fnv1a_hash(const char *data, size_t len, unsigned long long h) {
+	for(size_t i = 0; i < len; i++) {
+		h ^= (unsigned char) data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
 bool equalsIgnoreCase(const string &str1, const string &str2) {
 	if(str1.length() != str2.length()) return false;
 	for(size_t i = 0; i < str1.length(); i++) {
@@ -782,6 +813,12 @@ string getLocalTmpDir() {
 	g_free(gstr);
 	return tmpdir;
 }
+string getLocalCacheDir() {
+	gchar *gstr = g_build_filename(g_get_user_cache_dir(), "qalculate", NULL);
+	string cachedir = gstr;
+	g_free(gstr);
+	return cachedir;
+}
 
 string getPackageDataDir() {
 #ifdef USE_ABSOLUTE_PACKAGE_PATHS
@@ -813,29 +850,32 @@ string getPackageLocaleDir() {
 }
 
 
+bool Thread::isRunning() const {
+	return g_atomic_int_get(&m_running) != 0;
+}
+void Thread::setRunning(bool is_running) {
+	g_atomic_int_set(&m_running, is_running ? 1 : 0);
+}
+
 #ifdef __unix__
 
 Thread::Thread() :
-	running(false),
-	m_pipe_r(NULL),
-	m_pipe_w(NULL)
+	m_running(0)
 {
 	pthread_attr_init(&m_thread_attr);
-	int pipe_wr[] = {0, 0};
-	pipe(pipe_wr);
-	m_pipe_r = fdopen(pipe_wr[0], "r");
-	m_pipe_w = fdopen(pipe_wr[1], "w");
+	pthread_mutex_init(&m_queue_mutex, NULL);
+	pthread_cond_init(&m_queue_cond, NULL);
 }
 
 Thread::~Thread() {
-	fclose(m_pipe_r);
-	fclose(m_pipe_w);
+	pthread_cond_destroy(&m_queue_cond);
+	pthread_mutex_destroy(&m_queue_mutex);
 	pthread_attr_destroy(&m_thread_attr);
 }
 
 void Thread::doCleanup(void *data) {
 	Thread *thread = (Thread *) data;
-	thread->running = false;
+	thread->setRunning(false);
 }
 
 void *Thread::doRun(void *data) {
@@ -853,21 +893,61 @@ void *Thread::doRun(void *data) {
 
 bool Thread::start() {
 	int ret = pthread_create(&m_thread, &m_thread_attr, &Thread::doRun, this);
-	running = (ret == 0);
-	return running;
+	setRunning(ret == 0);
+	return ret == 0;
 }
 
 bool Thread::cancel() {
 	int ret = pthread_cancel(m_thread);
-	running = (ret != 0);
-	return !running;
+	if(ret != 0) return false;
+	// wait for the thread to stop, so that it cannot interfere with a restarted thread
+	pthread_join(m_thread, NULL);
+	setRunning(false);
+	return true;
+}
+
+int thread_disable_cancel() {
+	int old_state = PTHREAD_CANCEL_ENABLE;
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_state);
+	return old_state;
+}
+void thread_restore_cancel(int state) {
+	// a pending cancellation is acted upon here
+	pthread_setcancelstate(state, NULL);
+}
+
+bool Thread::writeData(const void *data, size_t size) {
+	pthread_mutex_lock(&m_queue_mutex);
+	m_queue.append((const char*) data, size);
+	pthread_cond_signal(&m_queue_cond);
+	pthread_mutex_unlock(&m_queue_mutex);
+	return true;
+}
+
+void Thread::unlockQueue(void *data) {
+	pthread_mutex_unlock((pthread_mutex_t*) data);
+}
+
+void Thread::readData(void *data, size_t size) {
+	// the thread might be cancelled while waiting: use deferred cancellation, so that the queue mutex is always unlocked
+	int old_type = PTHREAD_CANCEL_ASYNCHRONOUS;
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &old_type);
+	pthread_mutex_lock(&m_queue_mutex);
+	pthread_cleanup_push(&Thread::unlockQueue, &m_queue_mutex);
+	while(m_queue.length() < size) {
+		pthread_cond_wait(&m_queue_cond, &m_queue_mutex);
+	}
+	m_queue.copy((char*) data, size);
+	m_queue.erase(0, size);
+	pthread_cleanup_pop(1);
+	pthread_setcanceltype(old_type, NULL);
 }
 
 #elif defined(_WIN32)
 
 
 Thread::Thread() :
-	running(false),
+	m_running(0),
 	m_thread(NULL),
 	m_threadReadyEvent(NULL),
 	m_threadID(0)
@@ -894,20 +974,27 @@ bool Thread::start() {
 	m_thread = CreateThread(NULL, 0, Thread::doRun, this, 0, &m_threadID);
 	if (m_thread == NULL) return false;
 	WaitForSingleObject(m_threadReadyEvent, INFINITE);
-	running = (m_thread != NULL);
-	return running;
+	setRunning(m_thread != NULL);
+	return m_thread != NULL;
 }
 
 bool Thread::cancel() {
 	// FIXME: this is dangerous
 	int ret = TerminateThread(m_thread, 0);
 	if (ret == 0) return false;
+	WaitForSingleObject(m_thread, INFINITE);
 	CloseHandle(m_thread);
 	m_thread = NULL;
 	m_threadID = 0;
-	running = false;
+	setRunning(false);
 	return true;
 }
 
+// TerminateThread() cannot be deferred
+int thread_disable_cancel() {
+	return 0;
+}
+void thread_restore_cancel(int) {}
+
 
 #endif
@@ -92,6 +92,8 @@ int gcd(int i1, int i2);
 size_t unicode_length(const string &str);
 size_t unicode_length(const char *str);
 bool text_length_is_one(const string &str);
+size_t expression_name_hash(const string &name);
+unsigned long long fnv1a_hash(const char *data, size_t len, unsigned long long h = 14695981039346656037ULL);
 bool equalsIgnoreCase(const string &str1, const string &str2);
 bool equalsIgnoreCase(const string &str1, const char *str2);
 
@@ -103,18 +105,24 @@ string getPackageDataDir();
 string getPackageLocaleDir();
 string getLocalDataDir();
 string getLocalTmpDir();
+string getLocalCacheDir();
+
+/** Disables cancellation of the calling thread (see Thread::cancel()) until thread_restore_cancel() is called with the returned state. Process-wide locks used during calculations are held with cancellation disabled, so that a cancelled calculation thread never leaves them locked. */
+int thread_disable_cancel();
+void thread_restore_cancel(int state);
 
 class Thread {
 public:
 	Thread();
 	virtual ~Thread();
 	bool start();
+	/** Cancels the thread and waits until it has stopped. The thread is stopped when it leaves any section with cancellation disabled (see thread_disable_cancel()). */
 	bool cancel();
+	/** Returns true if the thread has been started and has not finished or been cancelled. */
+	bool isRunning() const;
 	template <class T> bool write(T data) {
 #ifdef __unix__
-		fwrite(&data, sizeof(T), 1, m_pipe_w);
-		fflush(m_pipe_w);
-		return true;
+		return writeData(&data, sizeof(T));
 
 #elif defined(_WIN32)
 		int ret = PostThreadMessage(m_threadID, WM_USER, (WPARAM) data, 0);
@@ -122,15 +130,12 @@ public:
 #endif
 	}
 
-	// FIXME: this is technically wrong -- needs memory barriers (std::atomic?)
-	volatile bool running;
-
 protected:
 	virtual void run() = 0;
 	template <class T> T read() {
 #ifdef __unix__
 		T x;
-		fread(&x, sizeof(T), 1, m_pipe_r);
+		readData(&x, sizeof(T));
 		return x;
 
 #elif defined(_WIN32)
@@ -141,13 +146,23 @@ protected:
 	}
 
 private:
+	// accessed atomically
+	int m_running;
+	void setRunning(bool is_running);
+
 #ifdef __unix__
 	static void doCleanup(void *data);
 	static void *doRun(void *data);
+	static void unlockQueue(void *data);
+	bool writeData(const void *data, size_t size);
+	void readData(void *data, size_t size);
 
 	pthread_t m_thread;
 	pthread_attr_t m_thread_attr;
-	FILE *m_pipe_r, *m_pipe_w;
+	// in-process message queue, read by the thread and written by other threads
+	pthread_mutex_t m_queue_mutex;
+	pthread_cond_t m_queue_cond;
+	string m_queue;
 
 #elif defined(_WIN32)
 	static DWORD WINAPI doRun(void *data);
@@ -0,0 +1,114 @@
+/*
+    Qalculate
+
+    Copyright (C) 2016  Hanna Knutsson (hanna_k@fmgirl.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+#include "support.h"
+#include <libqalculate/qalculate.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/*
+	Measures the throughput of Calculator::calculateBatch() with one thread and with the specified number of threads.
+
+	batchbench [-t threads] [-n expressions] [-m msecs per expression] [file with one expression per line]
+*/
+
+const char *batch_templates[] = {
+	"%i^2 + 3*%i - 7",
+	"sqrt(%i) + ln(%i)",
+	"sin(%i) * cos(%i)",
+	"%i km/h to m/s",
+	"gcd(%i * 12, 180)",
+	"(%i/7)^3 - %i/3",
+	"sum(\\x^2, 1, 20) + %i",
+	"factorial(%i mod 20 + 5)",
+	NULL
+};
+
+void generate_expressions(vector<string> &expressions, int n) {
+	size_t templates = 0;
+	while(batch_templates[templates]) templates++;
+	for(int i = 0; i < n; i++) {
+		string str = batch_templates[i % templates];
+		gsub("%i", i2s(i + 1), str);
+		expressions.push_back(str);
+	}
+}
+
+double run_batch(const vector<string> &expressions, int threads, int msecs, const EvaluationOptions &eo, size_t &aborted_count) {
+	vector<MathStructure> results;
+	struct timeval tv_start, tv_end;
+	gettimeofday(&tv_start, NULL);
+	CALCULATOR->calculateBatch(expressions, results, eo, threads, msecs);
+	gettimeofday(&tv_end, NULL);
+	aborted_count = 0;
+	for(size_t i = 0; i < results.size(); i++) {
+		if(results[i].isAborted()) aborted_count++;
+	}
+	return (tv_end.tv_sec - tv_start.tv_sec) + (tv_end.tv_usec - tv_start.tv_usec) / 1000000.0;
+}
+
+int main(int argc, char *argv[]) {
+
+	int threads = 0, n = 2000, msecs = 0;
+	string filename;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threads = s2i(argv[++i]);
+		} else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = s2i(argv[++i]);
+		} else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			msecs = s2i(argv[++i]);
+		} else {
+			filename = argv[i];
+		}
+	}
+
+	new Calculator();
+	CALCULATOR->loadGlobalDefinitions();
+
+	vector<string> expressions;
+	if(!filename.empty()) {
+		FILE *file = fopen(filename.c_str(), "r");
+		if(!file) {
+			fprintf(stderr, "Could not open %s.\n", filename.c_str());
+			return 1;
+		}
+		char buffer[10000];
+		while(fgets(buffer, 10000, file)) {
+			string str = buffer;
+			remove_blank_ends(str);
+			if(!str.empty() && str[0] != '#') expressions.push_back(CALCULATOR->unlocalizeExpression(str));
+		}
+		fclose(file);
+	} else {
+		generate_expressions(expressions, n);
+	}
+	if(expressions.empty()) return 1;
+
+	EvaluationOptions eo;
+	eo.approximation = APPROXIMATION_TRY_EXACT;
+
+	size_t aborted_count = 0;
+	double secs = run_batch(expressions, 1, msecs, eo, aborted_count);
+	printf("1 thread: %u expressions in %.3f s (%.0f expressions/s, %u aborted)\n", (unsigned int) expressions.size(), secs, expressions.size() / secs, (unsigned int) aborted_count);
+	if(threads != 1) {
+		secs = run_batch(expressions, threads, msecs, eo, aborted_count);
+		if(threads < 1) printf("All processors: ");
+		else printf("%i threads: ", threads);
+		printf("%u expressions in %.3f s (%.0f expressions/s, %u aborted)\n", (unsigned int) expressions.size(), secs, expressions.size() / secs, (unsigned int) aborted_count);
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,100 @@
+/*
+    Qalculate
+
+    Copyright (C) 2016  Hanna Knutsson (hanna_k@fmgirl.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+#include "support.h"
+#include <libqalculate/qalculate.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+	Measures the speed of Number arithmetic and tests with small exact numbers (inline representation),
+	with large exact numbers (CLN representation), and of the same operations with cln::cl_N directly.
+
+	numberbench [-n iterations]
+*/
+
+double elapsed(const struct timeval &tv_start) {
+	struct timeval tv_end;
+	gettimeofday(&tv_end, NULL);
+	return (tv_end.tv_sec - tv_start.tv_sec) + (tv_end.tv_usec - tv_start.tv_usec) / 1000000.0;
+}
+
+double bench_number(int n, const Number &offset, size_t &tests) {
+	struct timeval tv_start;
+	gettimeofday(&tv_start, NULL);
+	tests = 0;
+	Number sum;
+	Number three(3, 1), seven(7, 1), half(1, 2);
+	for(int i = 0; i < n; i++) {
+		Number nr(i % 1000, 1);
+		nr += offset;
+		nr *= three;
+		nr -= seven;
+		nr *= half;
+		if(nr.isZero() || nr.isOne() || nr.isMinusOne()) tests++;
+		if(nr.isInteger() && nr.isPositive()) tests++;
+		nr /= three;
+		sum += nr;
+		sum -= nr;
+	}
+	return elapsed(tv_start);
+}
+
+double bench_cln(int n, const cln::cl_N &offset, size_t &tests) {
+	struct timeval tv_start;
+	gettimeofday(&tv_start, NULL);
+	tests = 0;
+	cln::cl_N sum = 0;
+	cln::cl_N three = 3, seven = 7, half = cln::cl_I(1) / cln::cl_I(2);
+	for(int i = 0; i < n; i++) {
+		cln::cl_N nr = i % 1000;
+		nr = nr + offset;
+		nr = nr * three;
+		nr = nr - seven;
+		nr = nr * half;
+		if(cln::zerop(nr) || nr == 1 || nr == -1) tests++;
+		if(cln::instanceof(nr, cln::cl_I_ring) && cln::plusp(cln::realpart(nr))) tests++;
+		nr = nr / three;
+		sum = sum + nr;
+		sum = sum - nr;
+	}
+	return elapsed(tv_start);
+}
+
+int main(int argc, char *argv[]) {
+
+	int n = 1000000;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			n = s2i(argv[++i]);
+		}
+	}
+
+	new Calculator();
+
+	size_t tests = 0;
+	Number small_offset(5, 1);
+	double secs = bench_number(n, small_offset, tests);
+	printf("Number, small exact values: %.3f s (%.0f iterations/s, %u)\n", secs, n / secs, (unsigned int) tests);
+	double secs_cln = bench_cln(n, small_offset.internalNumber(), tests);
+	printf("cln::cl_N, small exact values: %.3f s (%.0f iterations/s, %u)\n", secs_cln, n / secs_cln, (unsigned int) tests);
+	Number large_offset(10, 1);
+	large_offset.raise(Number(30, 1));
+	secs = bench_number(n, large_offset, tests);
+	printf("Number, large exact values: %.3f s (%.0f iterations/s, %u)\n", secs, n / secs, (unsigned int) tests);
+	secs_cln = bench_cln(n, large_offset.internalNumber(), tests);
+	printf("cln::cl_N, large exact values: %.3f s (%.0f iterations/s, %u)\n", secs_cln, n / secs_cln, (unsigned int) tests);
+
+	return 0;
+
+}
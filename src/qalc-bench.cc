@@ -0,0 +1,514 @@
+/*
+    Qalculate
+
+    Copyright (C) 2016  Hanna Knutsson (hanna_k@fmgirl.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+*/
+
+#include "support.h"
+#include <libqalculate/qalculate.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#ifndef VERSION
+#	define VERSION "unknown"
+#endif
+
+/*
+	Runs a fixed corpus of expressions, grouped in categories, and reports median and 99th percentile latency,
+	C++ operator new calls per operation and peak resident memory, as text or as JSON (for comparison of two builds).
+	Only operator new and new[] are counted; memory allocated with malloc() directly, for example by GMP in CLN, is not included.
+
+	qalc-bench [-n iterations] [-c category] [-json] [-list]
+
+	With -startup, the time needed to load the global definitions, and the peak resident memory, is measured instead, from XML,
+	from the definitions cache, and from the cache with lazy loading of functions (each run in a new process).
+
+	qalc-bench -startup [-n runs] [-json]
+
+	With -dataset, a data set with the specified number of objects is created in memory, and the memory used per object,
+	the time of object lookups and property reads, and the time needed to parse all values (see DataSet::materializeProperties()),
+	with and without the definitions cache, are measured.
+
+	qalc-bench -dataset objects [-json]
+*/
+
+// calls of operator new and new[] (replaced below)
+static size_t new_calls = 0;
+
+void *operator new(size_t size) {
+	new_calls++;
+	void *p = malloc(size > 0 ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+void *operator new[](size_t size) {
+	new_calls++;
+	void *p = malloc(size > 0 ? size : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+void operator delete(void *p) throw() {
+	free(p);
+}
+void operator delete[](void *p) throw() {
+	free(p);
+}
+
+typedef enum {
+	BENCH_PARSE,
+	BENCH_CALCULATE,
+	BENCH_FACTORIZE,
+	BENCH_PRINT
+} BenchType;
+
+const char *corpus_parsing[] = {
+	"5x^2 + 3x - 7 = 0",
+	"sqrt(2) * sin(pi/4) + ln(e^2) - log(1000, 10)",
+	"(1 + 2i) * (3 - 4i) / (5 + 6i)",
+	"5 km/h + 3 m/s to mph",
+	"[[1, 2, 3], [4, 5, 6], [7, 8, 10]]",
+	"sum(\\x^2 / (\\x + 1), 1, 100) + product(\\x, 1, 10)",
+	"if(5 > 3, 2^10, 0) + 0x1F + 0b1011 + 1.5E-3",
+	"12/2(1+2) + 5x/5y - 3 m/5 s",
+	NULL
+};
+const char *corpus_exact[] = {
+	"1/3 + 2/7 - 5/11",
+	"sqrt(8) * sqrt(18)",
+	"(2/3)^10 * 3^10",
+	"gcd(462, 1071) + lcm(12, 18)",
+	"sum(\\x^2, 1, 100)",
+	"binomial(30, 12)",
+	"(3 + 4i) * (3 - 4i) / 5",
+	"1/(1 + 1/(1 + 1/(1 + 1/(1 + 1/2))))",
+	NULL
+};
+const char *corpus_bignum[] = {
+	"factorial(300)",
+	"2^3000 - 3^1800",
+	"binomial(1000, 500)",
+	"12345678901234567890^12 / 98765432109876543210^5",
+	"gcd(2^120 - 1, 2^180 - 1)",
+	"(10^50 + 7) mod 1000003",
+	NULL
+};
+const char *corpus_units[] = {
+	"5 km/h to m/s",
+	"60 mph to km/h",
+	"100 ft^3 to l",
+	"1 kWh to J",
+	"9.81 m/s^2 * 70 kg to N",
+	"3 h + 25 min to s",
+	"25 oC to oF",
+	"1 lightyear / c to days",
+	NULL
+};
+const char *corpus_factorize[] = {
+	"x^4 - 1",
+	"x^3 - 6x^2 + 11x - 6",
+	"6x^2 + 5x - 6",
+	"x^5 - x^4 - 7x^3 + 7x^2 + 12x - 12",
+	"4x^2 y - 9y",
+	"gcd(2^40 - 1, 2^60 - 1)",
+	NULL
+};
+const char *corpus_matrix[] = {
+	"det([[1, 2, 3], [4, 5, 6], [7, 8, 10]])",
+	"inverse([[2, 1, 1], [1, 3, 2], [1, 0, 0]])",
+	"[[1, 2], [3, 4]] * [[5, 6], [7, 8]]",
+	"transpose([[1, 2, 3], [4, 5, 6]])",
+	"rank([[1, 2, 3], [2, 4, 6], [1, 0, 1]])",
+	"det([[x, 1, 2], [3, x, 4], [5, 6, x]])",
+	NULL
+};
+const char *corpus_calculus[] = {
+	"integrate(x^2 + 3x)",
+	"integrate(x * e^x)",
+	"diff(x^3 * ln(x))",
+	"solve(x^2 - 5x + 6 = 0)",
+	"x^2 = 16",
+	"2x + 3 = 7x - 12",
+	NULL
+};
+const char *corpus_printing[] = {
+	"1/3 + sqrt(2)",
+	"factorial(100)",
+	"5 km/h to m/s",
+	"[[1, 2], [3, 4]]^2",
+	"x^3 + 2x^2 - x + 7",
+	"pi * 10^20",
+	NULL
+};
+const char *corpus_dataset[] = {
+	"atom(\"Fe\", \"weight\")",
+	"atom(\"Au\", \"density\")",
+	"atom(79, \"melting\")",
+	"planet(\"Earth\", \"mass\")",
+	"planet(\"Jupiter\", \"satellites\")",
+	NULL
+};
+
+struct BenchCategory {
+	const char *name;
+	BenchType type;
+	const char **expressions;
+};
+
+BenchCategory categories[] = {
+	{"parsing", BENCH_PARSE, corpus_parsing},
+	{"exact", BENCH_CALCULATE, corpus_exact},
+	{"bignum", BENCH_CALCULATE, corpus_bignum},
+	{"units", BENCH_CALCULATE, corpus_units},
+	{"factorize", BENCH_FACTORIZE, corpus_factorize},
+	{"matrix", BENCH_CALCULATE, corpus_matrix},
+	{"calculus", BENCH_CALCULATE, corpus_calculus},
+	{"printing", BENCH_PRINT, corpus_printing},
+	{"dataset", BENCH_CALCULATE, corpus_dataset},
+	{NULL, BENCH_CALCULATE, NULL}
+};
+
+struct BenchResult {
+	const char *name;
+	size_t expressions, samples;
+	double median, p99, total;
+	double new_calls;
+};
+
+double usecs_since(const struct timeval &tv_start) {
+	struct timeval tv_end;
+	gettimeofday(&tv_end, NULL);
+	return (tv_end.tv_sec - tv_start.tv_sec) * 1000000.0 + (tv_end.tv_usec - tv_start.tv_usec);
+}
+
+double percentile(const vector<double> &sorted_samples, double p) {
+	if(sorted_samples.empty()) return 0.0;
+	size_t i = (size_t) (p * (sorted_samples.size() - 1) + 0.5);
+	if(i >= sorted_samples.size()) i = sorted_samples.size() - 1;
+	return sorted_samples[i];
+}
+
+void run_expression(const BenchCategory &category, const string &str, const EvaluationOptions &eo, const PrintOptions &po, const MathStructure &mresult) {
+	switch(category.type) {
+		case BENCH_PARSE: {
+			MathStructure m = CALCULATOR->parse(str, eo.parse_options);
+			break;
+		}
+		case BENCH_CALCULATE: {}
+		case BENCH_FACTORIZE: {
+			MathStructure m = CALCULATOR->calculate(str, eo);
+			break;
+		}
+		case BENCH_PRINT: {
+			MathStructure m(mresult);
+			m.format(po);
+			string result = m.print(po);
+			break;
+		}
+	}
+}
+
+void clear_messages() {
+	CalculatorMessage *msg = CALCULATOR->message();
+	while(msg) msg = CALCULATOR->nextMessage();
+}
+
+BenchResult run_category(const BenchCategory &category, int iterations) {
+	EvaluationOptions eo;
+	eo.approximation = APPROXIMATION_TRY_EXACT;
+	if(category.type == BENCH_FACTORIZE) eo.structuring = STRUCTURING_FACTORIZE;
+	PrintOptions po;
+	po.number_fraction_format = FRACTION_DECIMAL_EXACT;
+	// measure the parser, not the parse cache
+	size_t parse_cache_size = CALCULATOR->parseCacheSize();
+	if(category.type == BENCH_PARSE) CALCULATOR->setParseCacheSize(0);
+	vector<double> samples;
+	size_t n_new_calls = 0;
+	BenchResult result;
+	result.name = category.name;
+	result.expressions = 0;
+	result.total = 0.0;
+	for(size_t i = 0; category.expressions[i]; i++) {
+		string str = CALCULATOR->unlocalizeExpression(category.expressions[i]);
+		MathStructure mresult;
+		if(category.type == BENCH_PRINT) mresult = CALCULATOR->calculate(str, eo);
+		// warm up (loads data set objects, fills caches used by every iteration)
+		run_expression(category, str, eo, po, mresult);
+		clear_messages();
+		for(int i2 = 0; i2 < iterations; i2++) {
+			size_t new_calls_before = new_calls;
+			struct timeval tv_start;
+			gettimeofday(&tv_start, NULL);
+			run_expression(category, str, eo, po, mresult);
+			double usecs = usecs_since(tv_start);
+			n_new_calls += new_calls - new_calls_before;
+			samples.push_back(usecs);
+			result.total += usecs;
+		}
+		clear_messages();
+		result.expressions++;
+	}
+	if(category.type == BENCH_PARSE) CALCULATOR->setParseCacheSize(parse_cache_size);
+	sort(samples.begin(), samples.end());
+	result.samples = samples.size();
+	result.median = percentile(samples, 0.5);
+	result.p99 = percentile(samples, 0.99);
+	result.new_calls = samples.empty() ? 0.0 : (double) n_new_calls / samples.size();
+	return result;
+}
+
+long int peak_rss() {
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+	// kilobytes on Linux
+	return usage.ru_maxrss;
+}
+
+struct StartupMode {
+	const char *name;
+	bool cache, lazy;
+};
+
+StartupMode startup_modes[] = {
+	{"xml", false, false},
+	{"cache", true, false},
+	{"cache+lazy", true, true},
+	{NULL, false, false}
+};
+
+// Loads the global definitions in a child process and returns the time in microseconds (or a negative value on failure) and the peak resident memory
+double startup_time(const StartupMode &mode, long int &rss) {
+	int fds[2];
+	if(pipe(fds) != 0) return -1.0;
+	pid_t pid = fork();
+	if(pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1.0;
+	}
+	if(pid == 0) {
+		close(fds[0]);
+		struct timeval tv_start;
+		gettimeofday(&tv_start, NULL);
+		new Calculator();
+		CALCULATOR->setDefinitionsCacheEnabled(mode.cache);
+		CALCULATOR->setLazyDefinitionsEnabled(mode.lazy);
+		double result[2] = {-1.0, 0.0};
+		if(CALCULATOR->loadGlobalDefinitions()) result[0] = usecs_since(tv_start);
+		result[1] = peak_rss();
+		if(write(fds[1], result, sizeof(result)) != sizeof(result)) _exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	double result[2] = {-1.0, 0.0};
+	if(read(fds[0], result, sizeof(result)) != sizeof(result)) result[0] = -1.0;
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	rss = (long int) result[1];
+	return result[0];
+}
+
+int run_startup(int runs, bool json) {
+	long int rss = 0;
+	// writes the snapshots, if necessary
+	if(startup_time(startup_modes[1], rss) < 0.0) {
+		fprintf(stderr, "Failed to load global definitions.\n");
+		return 1;
+	}
+	size_t n_modes = 0;
+	while(startup_modes[n_modes].name) n_modes++;
+	vector<vector<double> > samples(n_modes);
+	vector<vector<double> > rss_samples(n_modes);
+	for(int i = 0; i < runs; i++) {
+		// alternate, so that all modes are equally affected by changing system load
+		for(size_t i2 = 0; i2 < n_modes; i2++) {
+			samples[i2].push_back(startup_time(startup_modes[i2], rss));
+			rss_samples[i2].push_back(rss);
+		}
+	}
+	if(json) printf("{\n\t\"version\": \"%s\",\n\t\"runs\": %i,\n\t\"startup\": [\n", VERSION, runs);
+	else printf("%-12s %12s %12s %14s\n", "startup", "median (ms)", "p99 (ms)", "peak RSS (kB)");
+	for(size_t i = 0; i < n_modes; i++) {
+		sort(samples[i].begin(), samples[i].end());
+		sort(rss_samples[i].begin(), rss_samples[i].end());
+		double median = percentile(samples[i], 0.5), p99 = percentile(samples[i], 0.99), median_rss = percentile(rss_samples[i], 0.5);
+		if(json) printf("\t\t{\"name\": \"%s\", \"median_ms\": %.3f, \"p99_ms\": %.3f, \"peak_rss_kb\": %.0f}%s\n", startup_modes[i].name, median / 1000.0, p99 / 1000.0, median_rss, i + 1 < n_modes ? "," : "");
+		else printf("%-12s %12.3f %12.3f %14.0f\n", startup_modes[i].name, median / 1000.0, p99 / 1000.0, median_rss);
+	}
+	if(json) printf("\t]\n}\n");
+	return 0;
+}
+
+
+#define DATASET_NUMBER_PROPERTIES 8
+
+DataSet *create_dataset(vector<DataProperty*> &dps) {
+	DataSet *ds = new DataSet("", "bench_set", "", "Benchmark set");
+	DataProperty *dp_name = new DataProperty(ds, "name");
+	dp_name->setKey();
+	dp_name->setPropertyType(PROPERTY_STRING);
+	ds->addProperty(dp_name);
+	DataProperty *dp_number = new DataProperty(ds, "number");
+	dp_number->setKey();
+	dp_number->setPropertyType(PROPERTY_NUMBER);
+	ds->addProperty(dp_number);
+	dps.clear();
+	dps.push_back(dp_name);
+	dps.push_back(dp_number);
+	for(int i = 0; i < DATASET_NUMBER_PROPERTIES; i++) {
+		DataProperty *dp = new DataProperty(ds, string("p") + i2s(i + 1));
+		dp->setPropertyType(PROPERTY_NUMBER);
+		ds->addProperty(dp);
+		dps.push_back(dp);
+	}
+	return ds;
+}
+void add_dataset_objects(DataSet *ds, const vector<DataProperty*> &dps, int n_objects) {
+	for(int i = 0; i < n_objects; i++) {
+		DataObject *o = new DataObject(ds);
+		o->setProperty(dps[0], string("Object ") + i2s(i));
+		o->setProperty(dps[1], i2s(i + 1));
+		for(size_t i2 = 2; i2 < dps.size(); i2++) o->setProperty(dps[i2], i2s(i * i2 + 1) + ".25", 1);
+		ds->addObject(o);
+	}
+}
+// Returns the time of DataSet::materializeProperties() for a new data set
+double materialize_dataset(int n_objects, int threads, bool use_cache) {
+	vector<DataProperty*> dps;
+	DataSet *ds = create_dataset(dps);
+	add_dataset_objects(ds, dps, n_objects);
+	CALCULATOR->setDefinitionsCacheEnabled(use_cache);
+	struct timeval tv_start;
+	gettimeofday(&tv_start, NULL);
+	ds->materializeProperties(threads);
+	double usecs = usecs_since(tv_start);
+	delete ds;
+	return usecs;
+}
+
+int run_dataset(int n_objects, bool json) {
+	new Calculator();
+	vector<DataProperty*> dps;
+	DataSet *ds = create_dataset(dps);
+	long int rss_before = peak_rss();
+	struct timeval tv_start;
+	gettimeofday(&tv_start, NULL);
+	add_dataset_objects(ds, dps, n_objects);
+	double create_usecs = usecs_since(tv_start);
+	long int rss_after = peak_rss();
+	// lookups by name, and reads of all properties of the found objects
+	size_t n_lookups = (n_objects < 10000 ? n_objects : 10000), n_found = 0, n_chars = 0;
+	ds->getObject("Object 0");
+	gettimeofday(&tv_start, NULL);
+	for(size_t i = 0; i < n_lookups; i++) {
+		if(ds->getObject(string("object ") + i2s((i * 7919) % n_objects))) n_found++;
+	}
+	double lookup_usecs = usecs_since(tv_start);
+	vector<DataObject*> found;
+	for(size_t i = 0; i < n_lookups; i++) found.push_back(ds->getObject(string("Object ") + i2s((i * 7919) % n_objects)));
+	gettimeofday(&tv_start, NULL);
+	for(int i2 = 0; i2 < 10; i2++) {
+		for(size_t i = 0; i < found.size(); i++) {
+			for(size_t i3 = 2; i3 < dps.size(); i3++) n_chars += found[i]->getProperty(dps[i3]).length();
+		}
+	}
+	double read_usecs = usecs_since(tv_start);
+	size_t n_reads = found.size() * (dps.size() - 2) * 10;
+	double kb_per_object = (double) (rss_after - rss_before) / n_objects;
+	// parsing of all values, in one and in all threads, and reading of the values from the cache (written by the first run with the cache enabled)
+	double parse_usecs = materialize_dataset(n_objects, 1, false);
+	double parse_threads_usecs = materialize_dataset(n_objects, 0, false);
+	materialize_dataset(n_objects, 1, true);
+	double cache_usecs = materialize_dataset(n_objects, 1, true);
+	if(json) {
+		printf("{\n\t\"version\": \"%s\",\n\t\"objects\": %i,\n\t\"properties\": %i,\n", VERSION, n_objects, DATASET_NUMBER_PROPERTIES + 2);
+		printf("\t\"rss_kb\": %li,\n\t\"bytes_per_object\": %.0f,\n\t\"create_ms\": %.3f,\n", rss_after - rss_before, kb_per_object * 1024.0, create_usecs / 1000.0);
+		printf("\t\"lookup_us\": %.3f,\n\t\"property_read_ns\": %.1f,\n", lookup_usecs / n_lookups, read_usecs * 1000.0 / n_reads);
+		printf("\t\"parse_ms\": %.3f,\n\t\"parse_threads_ms\": %.3f,\n\t\"cache_ms\": %.3f\n}\n", parse_usecs / 1000.0, parse_threads_usecs / 1000.0, cache_usecs / 1000.0);
+	} else {
+		printf("objects: %i, properties: %i\n", n_objects, DATASET_NUMBER_PROPERTIES + 2);
+		printf("memory: %li kB (%.0f bytes/object)\n", rss_after - rss_before, kb_per_object * 1024.0);
+		printf("create: %.3f ms\n", create_usecs / 1000.0);
+		printf("lookup by name: %.3f us (%u found)\n", lookup_usecs / n_lookups, (unsigned int) n_found);
+		printf("property read: %.1f ns (%u)\n", read_usecs * 1000.0 / n_reads, (unsigned int) n_chars);
+		printf("parse all values: %.3f ms (%.3f ms in parallel)\n", parse_usecs / 1000.0, parse_threads_usecs / 1000.0);
+		printf("read values from cache: %.3f ms\n", cache_usecs / 1000.0);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+
+	int iterations = 20;
+	bool json = false, startup = false;
+	int dataset_objects = 0;
+	vector<string> selected;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = s2i(argv[++i]);
+		} else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			selected.push_back(argv[++i]);
+		} else if(strcmp(argv[i], "-json") == 0 || strcmp(argv[i], "--json") == 0) {
+			json = true;
+		} else if(strcmp(argv[i], "-startup") == 0 || strcmp(argv[i], "--startup") == 0) {
+			startup = true;
+		} else if((strcmp(argv[i], "-dataset") == 0 || strcmp(argv[i], "--dataset") == 0) && i + 1 < argc) {
+			dataset_objects = s2i(argv[++i]);
+		} else if(strcmp(argv[i], "-list") == 0 || strcmp(argv[i], "--list") == 0) {
+			for(size_t i2 = 0; categories[i2].name; i2++) {
+				printf("%s\n", categories[i2].name);
+				for(size_t i3 = 0; categories[i2].expressions[i3]; i3++) printf("\t%s\n", categories[i2].expressions[i3]);
+			}
+			return 0;
+		} else {
+			fprintf(stderr, "usage: qalc-bench [-n iterations] [-c category] [-json] [-list] [-startup] [-dataset objects]\n");
+			return 1;
+		}
+	}
+	if(iterations < 1) iterations = 1;
+
+	if(startup) return run_startup(iterations, json);
+	if(dataset_objects > 0) return run_dataset(dataset_objects, json);
+
+	new Calculator();
+	CALCULATOR->loadGlobalDefinitions();
+
+	vector<BenchResult> results;
+	for(size_t i = 0; categories[i].name; i++) {
+		if(!selected.empty() && find(selected.begin(), selected.end(), string(categories[i].name)) == selected.end()) continue;
+		results.push_back(run_category(categories[i], iterations));
+	}
+	if(results.empty()) {
+		fprintf(stderr, "No such category.\n");
+		return 1;
+	}
+
+	if(json) {
+		printf("{\n\t\"version\": \"%s\",\n\t\"iterations\": %i,\n\t\"peak_rss_kb\": %li,\n\t\"categories\": [\n", VERSION, iterations, peak_rss());
+		for(size_t i = 0; i < results.size(); i++) {
+			printf("\t\t{\"name\": \"%s\", \"expressions\": %u, \"samples\": %u, \"median_us\": %.1f, \"p99_us\": %.1f, \"total_ms\": %.3f, \"new_calls_per_op\": %.1f}%s\n", results[i].name, (unsigned int) results[i].expressions, (unsigned int) results[i].samples, results[i].median, results[i].p99, results[i].total / 1000.0, results[i].new_calls, i + 1 < results.size() ? "," : "");
+		}
+		printf("\t]\n}\n");
+	} else {
+		printf("%-12s %12s %12s %12s %14s\n", "category", "median (us)", "p99 (us)", "total (ms)", "new/op");
+		for(size_t i = 0; i < results.size(); i++) {
+			printf("%-12s %12.1f %12.1f %12.3f %14.1f\n", results[i].name, results[i].median, results[i].p99, results[i].total / 1000.0, results[i].new_calls);
+		}
+		printf("peak RSS: %li kB\n", peak_rss());
+	}
+
+	return 0;
+
+}
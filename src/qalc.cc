@@ -63,6 +63,7 @@ bool interactive_mode;
 bool ask_questions;
 
 bool result_only;
+bool print_profile;
 
 static char buffer[1000];
 
@@ -934,6 +935,7 @@ int main(int argc, char *argv[]) {
 	cfile = NULL;
 	interactive_mode = false;
 	result_only = false;
+	print_profile = false;
 	bool load_units = true, load_functions = true, load_variables = true, load_currencies = true, load_datasets = true;
 	load_global_defs = true;
 	printops.use_unicode_signs = false;
@@ -985,6 +987,8 @@ int main(int argc, char *argv[]) {
 			fputs("\t", stdout); PUTS_UNICODE(_("do not load any global units from file"));
 			fputs("\n\t-novariables\n", stdout);
 			fputs("\t", stdout); PUTS_UNICODE(_("do not load any global variables from file"));
+			fputs("\n\t--profile\n", stdout);
+			fputs("\t", stdout); PUTS_UNICODE(_("displays the time spent in each stage of the calculation after the result"));
 			fputs("\n\t-t, -terse\n", stdout);
 			fputs("\t", stdout); PUTS_UNICODE(_("reduces output to just the result of the input expression"));
 			fputs("\n\t-s, -set", stdout); fputs(" \"", stdout); FPUTS_UNICODE(_("OPTION"), stdout); fputs(" ", stdout); FPUTS_UNICODE(_("VALUE"), stdout); fputs("\"\n", stdout);
@@ -1010,6 +1014,8 @@ int main(int argc, char *argv[]) {
 			set_option_strings.push_back(set_base_str);
 		} else if(!calc_arg_begun && (strcmp(argv[i], "-terse") == 0 || strcmp(argv[i], "--terse") == 0 || strcmp(argv[i], "-t") == 0)) {
 			result_only = true;
+		} else if(!calc_arg_begun && (strcmp(argv[i], "-profile") == 0 || strcmp(argv[i], "--profile") == 0)) {
+			print_profile = true;
 		} else if(!calc_arg_begun && (strcmp(argv[i], "-interactive") == 0 || strcmp(argv[i], "--interactive") == 0 || strcmp(argv[i], "-i") == 0)) {
 			interactive_mode = true;
 		} else if(!calc_arg_begun && (strcmp(argv[i], "-list") == 0 || strcmp(argv[i], "--list") == 0 || strcmp(argv[i], "-l") == 0)) {
@@ -1062,6 +1068,7 @@ int main(int argc, char *argv[]) {
 
 	//create the almighty Calculator object
 	new Calculator();
+	if(print_profile) CALCULATOR->setProfilingEnabled();
 
 	//load application specific preferences
 	load_preferences();
@@ -2777,6 +2784,39 @@ bool display_errors(bool goto_input) {
 	return true;
 }
 
+const char *evaluation_stage_name(EvaluationStage stage) {
+	switch(stage) {
+		case EVALUATION_STAGE_TOTAL: {return "total";}
+		case EVALUATION_STAGE_PARSE: {return "parse";}
+		case EVALUATION_STAGE_UNFORMAT: {return "unformat";}
+		case EVALUATION_STAGE_SYNC_UNITS: {return "syncUnits";}
+		case EVALUATION_STAGE_CALCULATE_FUNCTIONS: {return "calculateFunctions";}
+		case EVALUATION_STAGE_FUNCTION: {return "function";}
+		case EVALUATION_STAGE_CALCULATESUB: {return "calculatesub";}
+		case EVALUATION_STAGE_ISOLATE_X: {return "isolate_x";}
+		case EVALUATION_STAGE_SIMPLIFY: {return "simplify";}
+		case EVALUATION_STAGE_FACTORIZE: {return "factorize";}
+		case EVALUATION_STAGE_FORMAT: {return "format";}
+		case EVALUATION_STAGE_PRINT: {return "print";}
+	}
+	return "";
+}
+
+void display_profile() {
+	vector<EvaluationProfileEntry> entries = CALCULATOR->lastEvaluationProfile();
+	if(entries.empty()) return;
+	PUTS_UNICODE(_("Profile:"));
+	for(size_t i = 0; i < entries.size(); i++) {
+		string name = evaluation_stage_name(entries[i].stage);
+		if(entries[i].stage == EVALUATION_STAGE_FUNCTION) {
+			name = "  ";
+			name += entries[i].function;
+			name += "()";
+		}
+		printf("  %-24s %8u %12.3f ms\n", name.c_str(), (unsigned int) entries[i].calls, entries[i].seconds * 1000.0);
+	}
+}
+
 void on_abort_display() {
 	CALCULATOR->abortPrint();
 }
@@ -2980,6 +3020,7 @@ void setResult(Prefix *prefix, bool update_parse, bool goto_input, size_t stack_
 		} else {
 			PUTS_UNICODE(result_text.c_str());
 		}
+		if(print_profile) display_profile();
 		if(goto_input) printf("\n");
 	}
 
@@ -3058,7 +3099,7 @@ void execute_command(int command_type, bool show_result) {
 	command_aborted = false;
 	CALCULATOR->saveState();
 
-	if(!command_thread->running) {
+	if(!command_thread->isRunning()) {
 		command_thread->start();
 	}
 